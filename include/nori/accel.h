@@ -20,6 +20,7 @@
 #define __NORI_BVH_H
 
 #include <nori/mesh.h>
+#include <memory>
 
 NORI_NAMESPACE_BEGIN
 
@@ -62,6 +63,20 @@ public:
     /// Build the BVH
     void build();
 
+    /**
+     * \brief Create a copy of the data accessed during traversal for the
+     * NUMA node with the given index (see \ref getCurrentNumaNode())
+     *
+     * The BVH nodes, triangle index list, vertex positions and triangle
+     * indices are copied by the calling thread, which should therefore
+     * be pinned to that node: the operating system then places the copy
+     * in the node's local memory. Afterwards, \ref rayIntersect() uses the
+     * copy whenever it is called from a thread working for the node.
+     *
+     * This function must not be called while rays are being traced.
+     */
+    void addReplica(uint32_t node);
+
     /**
      * \brief Intersect a ray against all triangle meshes registered
      * with the BVH
@@ -163,11 +178,20 @@ protected:
         }
     };
 private:
+    /// Node-local copy of the data accessed during traversal
+    struct Replica {
+        std::vector<BVHNode> nodes;
+        std::vector<uint32_t> indices;
+        std::vector<MatrixXf> positions;
+        std::vector<MatrixXu> triangles;
+    };
+
     std::vector<Mesh *> m_meshes;       ///< List of meshes registered with the BVH
     std::vector<uint32_t> m_meshOffset; ///< Index of the first triangle for each shape
     std::vector<BVHNode> m_nodes;       ///< BVH nodes
     std::vector<uint32_t> m_indices;    ///< Index references by BVH nodes
     BoundingBox3f m_bbox;               ///< Bounding box of the entire BVH
+    std::vector<std::unique_ptr<Replica>> m_replicas; ///< Per-NUMA node copies
 };
 
 NORI_NAMESPACE_END
@@ -20,6 +20,7 @@
 
 #include <nori/color.h>
 #include <nori/vector.h>
+#include <memory>
 
 NORI_NAMESPACE_BEGIN
 
@@ -51,4 +52,30 @@ public:
     void savePNG(const std::string &filename);
 };
 
+/**
+ * \brief Writes a tiled OpenEXR file one tile at a time
+ *
+ * Unlike \ref Bitmap::saveEXR(), this never requires the full image to be
+ * in memory: tiles can be written in any order as soon as they are done.
+ */
+class TiledEXRWriter {
+public:
+    /// Create an EXR file with the specified filename, image and tile size
+    TiledEXRWriter(const std::string &filename, const Vector2i &size, int tileSize);
+
+    /// Finish writing the file
+    ~TiledEXRWriter();
+
+    /**
+     * \brief Write the tile at the given tile coordinates
+     *
+     * The bitmap must have the size of the tile, which is smaller than
+     * the nominal tile size along the right and bottom edge of the image.
+     */
+    void writeTile(int tileX, int tileY, const Bitmap &tile);
+private:
+    struct TiledEXRWriterPrivate;
+    std::unique_ptr<TiledEXRWriterPrivate> d;
+};
+
 NORI_NAMESPACE_END
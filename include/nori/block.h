@@ -43,6 +43,10 @@ NORI_NAMESPACE_BEGIN
  * this region. For that reason, this class also stores information about
  * a small border region around the rectangle, whose size depends on the
  * properties of the reconstruction filter.
+ *
+ * Importance sampled filters (see \ref ReconstructionFilter::sample())
+ * are the exception: each sample is then recorded in exactly one pixel
+ * with an explicit weight, and the block has no border region.
  */
 class ImageBlock : public Eigen::Array<Color4f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> {
 public:
@@ -88,8 +92,26 @@ public:
     /// Clear all contents
     void clear() { setConstant(Color4f()); }
 
-    /// Record a sample with the given position and radiance value
-    void put(const Point2f &pos, const Color3f &value);
+    /**
+     * \brief Record a sample with the given position and radiance value
+     *
+     * The optional \c weight scales the contribution of the sample. It is
+     * used to pass the weight of importance sampled filters, in which case
+     * \c pos should be the center of the pixel that receives the sample.
+     */
+    void put(const Point2f &pos, const Color3f &value, float weight = 1.0f);
+
+    /**
+     * \brief Record a batch of samples with the given positions and
+     * radiance values
+     *
+     * This is equivalent to calling \ref put() for each sample, but
+     * considerably cheaper when consecutive samples land in the same
+     * pixel (e.g. all samples of a pixel row rendered with a box filter),
+     * since their contributions are summed up before touching the block.
+     */
+    void put(const Point2f *pos, const Color3f *values,
+             const float *weights, size_t count);
 
     /**
      * \brief Merge another image block into this one
@@ -107,6 +129,13 @@ public:
 
     /// Return a human-readable string summary
     std::string toString() const;
+protected:
+    /// Return the weighted sample if it should be splatted, and complain otherwise
+    bool prepareSample(const Color3f &value, float weight, Color4f &weighted) const;
+
+    /// Return the index of the pixel containing the given sample (single-pixel mode only)
+    Eigen::Index pixelIndex(const Point2f &pos) const;
+
 protected:
     Point2i m_offset;
     Vector2i m_size;
@@ -116,6 +145,10 @@ protected:
     float *m_weightsX = nullptr;
     float *m_weightsY = nullptr;
     float m_lookupFactor = 0;
+    /// Does every sample land in exactly one pixel (box or importance sampled filter)?
+    bool m_singlePixel = false;
+    /// Single allocation holding the filter table and weight scratch space
+    float *m_filterStorage = nullptr;
     mutable tbb::mutex m_mutex;
 };
 
@@ -135,17 +168,24 @@ public:
      *      Size of the image that should be split into blocks
      * \param blockSize
      *      Maximum size of the individual blocks
+     * \param offset
+     *      Offset of the region to be split (e.g. when only rendering
+     *      a crop window of the image)
      */
-    BlockGenerator(const Vector2i &size, int blockSize);
+    BlockGenerator(const Vector2i &size, int blockSize,
+                   const Point2i &offset = Point2i(0, 0));
     
     /**
      * \brief Return the next block to be rendered
      *
      * This function is thread-safe
      *
+     * \param index
+     *      If not \c nullptr, receives the position of the block in the
+     *      generated sequence (starting at zero)
      * \return \c false if there were no more blocks
      */
-    bool next(ImageBlock &block);
+    bool next(ImageBlock &block, int *index = nullptr);
 
     /// Return the total number of blocks
     int getBlockCount() const { return m_blocksLeft; }
@@ -154,6 +194,7 @@ protected:
 
     Point2i m_block;
     Vector2i m_numBlocks;
+    Point2i m_offset;
     Vector2i m_size;
     int m_blockSize;
     int m_numSteps;
@@ -57,6 +57,31 @@ public:
         const Point2f &samplePosition,
         const Point2f &apertureSample) const = 0;
 
+    /**
+     * \brief Evaluate the importance emitted along a ray leaving the
+     * camera (for connecting points in the scene to the camera)
+     *
+     * \param d
+     *    Direction of the ray, which starts at the origin of the rays
+     *    generated by \ref sampleRay()
+     *
+     * \param position
+     *    Set to the position on the film that corresponds to the ray,
+     *    expressed in fractional pixel coordinates
+     *
+     * \param pdf
+     *    Set to the solid angle density of \ref sampleRay() generating
+     *    this direction, when given a uniformly distributed position on
+     *    the film
+     *
+     * \return
+     *    The importance, normalized so that it integrates to one over the
+     *    film, times the cosine between the ray and the viewing direction
+     *    (i.e. the camera's share of the geometry term). Zero if the ray
+     *    does not pass through the film.
+     */
+    virtual float evalImportance(const Vector3f &d, Point2f &position, float &pdf) const = 0;
+
     /// Return the size of the output image in pixels
     const Vector2i &getOutputSize() const { return m_outputSize; }
 
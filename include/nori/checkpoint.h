@@ -0,0 +1,90 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/block.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Progress of a multi-pass render that can be saved and resumed
+ *
+ * A render consisting of several passes over the image accumulates all
+ * samples in one full-frame \ref ImageBlock (the "film"). This class keeps
+ * track of the pass that is currently being rendered, along with the
+ * number of samples that have been merged into each pixel of the film.
+ * Since image blocks are merged one at a time, the per-pixel counts tell
+ * exactly which blocks of the current pass are already complete.
+ *
+ * \ref save() writes the film (weighted sums and filter weights, including
+ * its border) together with this information to a compact binary file.
+ * Loading it back and skipping the blocks reported by \ref isComplete()
+ * continues the render where it left off.
+ */
+class RenderCheckpoint {
+public:
+    /// Create an empty checkpoint for the given region of the image
+    RenderCheckpoint(const Point2i &offset, const Vector2i &size, uint32_t samplesPerPass);
+
+    /// Return the index of the pass that is currently being rendered
+    uint32_t getPass() const { return m_pass; }
+
+    /// Set the index of the pass that is currently being rendered
+    void setPass(uint32_t pass) { m_pass = pass; }
+
+    /// Return the number of samples per pixel that are rendered in each pass
+    uint32_t getSamplesPerPass() const { return m_samplesPerPass; }
+
+    /// Return the number of samples that have been merged into a pixel
+    uint32_t getSampleCount(int x, int y) const {
+        return m_counts[(y - m_offset.y()) * m_size.x() + x - m_offset.x()];
+    }
+
+    /// Record that \c block has been rendered and merged into the film
+    void addBlock(const ImageBlock &block);
+
+    /// Has the given block already been merged during the current pass?
+    bool isComplete(const ImageBlock &block) const;
+
+    /**
+     * \brief Save the checkpoint along with the film to a file
+     *
+     * The file is written under a temporary name first and then
+     * renamed, hence an interrupted write never destroys an older
+     * checkpoint. The caller must ensure that no blocks are merged into
+     * the film (or recorded using \ref addBlock()) in the meantime.
+     */
+    void save(const std::string &filename, const ImageBlock &film) const;
+
+    /**
+     * \brief Load a checkpoint and the associated film from a file
+     *
+     * Throws a \ref NoriException when the file does not match the
+     * current render (e.g. different image, crop window or filter size)
+     */
+    void load(const std::string &filename, ImageBlock &film);
+private:
+    Point2i m_offset;
+    Vector2i m_size;
+    uint32_t m_samplesPerPass;
+    uint32_t m_pass = 0;
+    std::vector<uint32_t> m_counts;
+};
+
+NORI_NAMESPACE_END
@@ -237,6 +237,13 @@ inline int mod(int a, int b) {
     return (r < 0) ? r+b : r;
 }
 
+/// Power heuristic (with exponent 2) for weighting the first of two sampling strategies
+inline float powerHeuristic(float pdfA, float pdfB) {
+    pdfA *= pdfA;
+    pdfB *= pdfB;
+    return pdfA > 0.0f ? pdfA / (pdfA + pdfB) : 0.0f;
+}
+
 /// Compute a direction for the given coordinates in spherical coordinates
 extern Vector3f sphericalDirection(float theta, float phi);
 
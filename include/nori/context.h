@@ -0,0 +1,322 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/block.h>
+#include <nori/sampler.h>
+
+NORI_NAMESPACE_BEGIN
+
+class SplatFilm;
+struct Intersection;
+
+/**
+ * \brief Simple bump allocator for short-lived scratch memory
+ *
+ * Memory is handed out from a list of large chunks and is never released
+ * individually. A call to \ref reset() makes all chunks available again
+ * without returning them to the operating system, hence an arena that
+ * has "warmed up" services all further requests without touching the heap.
+ */
+class MemoryArena {
+public:
+    /// Create an empty arena that allocates chunks of the given size
+    explicit MemoryArena(size_t chunkSize = 256 * 1024) : m_chunkSize(chunkSize) { }
+
+    /// Release all memory
+    ~MemoryArena();
+
+    /// Allocate \c size bytes (aligned to 16 bytes)
+    void *alloc(size_t size);
+
+    /// Allocate storage for \c count instances of \c T (no constructors are run)
+    template <typename T> T *alloc(size_t count = 1) {
+        return static_cast<T *>(alloc(sizeof(T) * count));
+    }
+
+    /// Make all previously allocated memory available again
+    void reset() { m_chunk = 0; m_offset = 0; }
+
+    /// Return the total amount of memory owned by the arena
+    size_t getCapacity() const;
+private:
+    MemoryArena(const MemoryArena &) = delete;
+    MemoryArena &operator=(const MemoryArena &) = delete;
+
+    struct Chunk {
+        uint8_t *data;
+        size_t size;
+    };
+
+    std::vector<Chunk> m_chunks;
+    size_t m_chunkSize;
+    size_t m_chunk = 0;
+    size_t m_offset = 0;
+};
+
+/**
+ * \brief Staging area for samples that are splatted into an image block
+ *
+ * Rather than splatting every sample right away, the rendering loop
+ * collects the samples of a pixel row here and hands them to
+ * \ref ImageBlock::put() in one batch.
+ */
+class SampleBuffer {
+public:
+    /// Create a buffer with space for the given number of samples
+    explicit SampleBuffer(size_t capacity = 4096)
+        : m_positions(capacity), m_values(capacity), m_weights(capacity) { }
+
+    /// Stage a sample, flushing the buffer into \c block when it is full
+    void put(ImageBlock &block, const Point2f &pos, const Color3f &value, float weight = 1.0f) {
+        m_positions[m_size] = pos;
+        m_values[m_size] = value;
+        m_weights[m_size] = weight;
+        if (++m_size == m_positions.size())
+            flush(block);
+    }
+
+    /// Splat all staged samples into \c block
+    void flush(ImageBlock &block) {
+        block.put(m_positions.data(), m_values.data(), m_weights.data(), m_size);
+        m_size = 0;
+    }
+private:
+    std::vector<Point2f> m_positions;
+    std::vector<Color3f> m_values;
+    std::vector<float> m_weights;
+    size_t m_size = 0;
+};
+
+/**
+ * \brief Counters that are collected by each rendering thread
+ *
+ * The counters are plain integers that are only ever touched by the thread
+ * owning the \ref RenderContext, so incrementing them is essentially free.
+ * They are summed up once the render is done.
+ */
+struct RenderStatistics {
+    /// Number of image blocks rendered
+    uint64_t blocks = 0;
+
+    /// Number of pixel samples (i.e. camera rays) computed
+    uint64_t samples = 0;
+
+    /// Number of rays traced to find the closest intersection
+    uint64_t closestHitRays = 0;
+
+    /// Number of shadow (i.e. any-hit) rays traced
+    uint64_t shadowRays = 0;
+
+    /// Number of BVH nodes whose bounding box was tested
+    uint64_t nodesVisited = 0;
+
+    /// Number of ray-triangle intersection tests
+    uint64_t trianglesTested = 0;
+
+    /// Number of samples with invalid (NaN or infinite) radiance values
+    uint64_t invalidSamples = 0;
+
+    /// Time spent rendering blocks (in seconds)
+    double renderTime = 0.0;
+
+    /// Return the total number of rays traced through the scene
+    uint64_t getRayCount() const { return closestHitRays + shadowRays; }
+
+    /// Accumulate the counters of another thread
+    RenderStatistics &operator+=(const RenderStatistics &stats) {
+        blocks += stats.blocks;
+        samples += stats.samples;
+        closestHitRays += stats.closestHitRays;
+        shadowRays += stats.shadowRays;
+        nodesVisited += stats.nodesVisited;
+        trianglesTested += stats.trianglesTested;
+        invalidSamples += stats.invalidSamples;
+        renderTime += stats.renderTime;
+        return *this;
+    }
+};
+
+/**
+ * \brief Reusable per-thread rendering state
+ *
+ * A render context bundles everything a rendering thread needs while
+ * it processes image blocks: the image block receiving its samples, a
+ * private clone of the scene's sampler, a sample staging buffer, a
+ * scratch memory arena and a set of statistics counters. One context is
+ * created per thread at the beginning of a render and reused for all of
+ * its blocks, so that the rendering loop itself never has to allocate
+ * memory.
+ *
+ * While a thread is rendering, its context can be retrieved using
+ * \ref get(). Integrators may use this to obtain scratch memory from
+ * \ref getArena(), which is reset after every pixel sample.
+ */
+class RenderContext {
+public:
+    /**
+     * \brief Create a new context for rendering the given scene
+     *
+     * \param splatFilm
+     *     Film shared by all threads, which receives samples that are not
+     *     associated with the pixel being rendered (only needed by
+     *     integrators that request it, see \ref Integrator::usesSplatFilm())
+     */
+    RenderContext(const Scene *scene, SplatFilm *splatFilm = nullptr);
+
+    /// Return the image block that is currently being rendered
+    ImageBlock &getBlock() { return m_block; }
+
+    /// Return the sampler of this thread
+    Sampler *getSampler() { return m_sampler.get(); }
+
+    /// Return the buffer used to splat samples into \ref getBlock() in batches
+    SampleBuffer &getSampleBuffer() { return m_sampleBuffer; }
+
+    /// Return the scratch memory arena of this thread
+    MemoryArena &getArena() { return m_arena; }
+
+    /// Return the film for samples at arbitrary pixels (or \c nullptr)
+    SplatFilm *getSplatFilm() { return m_splatFilm; }
+
+    /// Return the statistics counters of this thread
+    RenderStatistics &getStatistics() { return m_statistics; }
+
+    /// Return the statistics counters of this thread (const version)
+    const RenderStatistics &getStatistics() const { return m_statistics; }
+
+    /**
+     * \brief Return the context that is bound to the calling thread
+     *
+     * \return \c nullptr when the calling thread is not rendering
+     */
+    static RenderContext *get();
+
+    /// Bind a context to the calling thread for the lifetime of this object
+    class Scope {
+    public:
+        Scope(RenderContext &context);
+        ~Scope();
+    private:
+        RenderContext *m_previous;
+    };
+private:
+    RenderContext(const RenderContext &) = delete;
+    RenderContext &operator=(const RenderContext &) = delete;
+
+    ImageBlock m_block;
+    std::unique_ptr<Sampler> m_sampler;
+    SampleBuffer m_sampleBuffer;
+    MemoryArena m_arena;
+    SplatFilm *m_splatFilm;
+    RenderStatistics m_statistics;
+};
+
+/**
+ * \brief Generate the camera ray of the current pixel sample
+ *
+ * The sampler must have been positioned using \ref Sampler::startSample().
+ * When the reconstruction filter is importance sampled, the ray passes
+ * through a position drawn from the filter and the sample is recorded at
+ * the pixel center with the returned filter weight.
+ *
+ * \param pixel
+ *     Integer coordinates of the pixel on the film
+ * \param ray
+ *     Generated camera ray
+ * \param position
+ *     Film position to splat the sample at
+ * \param weight
+ *     Filter weight of the sample
+ * \return
+ *     Importance weight of the ray (see \ref Camera::sampleRay())
+ */
+extern Color3f sampleCameraRay(const Scene *scene, Sampler *sampler, const Point2i &pixel,
+                               Ray3f &ray, Point2f &position, float &weight);
+
+/**
+ * \brief Follow a ray through specular surfaces until it reaches a diffuse one
+ *
+ * At every specular surface, the path is continued by sampling the BSDF
+ * and terminated using Russian roulette.
+ *
+ * \param ray
+ *     Ray to follow; on return, the ray that hit the last surface
+ * \param its
+ *     Last surface that was hit
+ * \param throughput
+ *     Throughput of the path, which is updated at every bounce
+ * \param emitted
+ *     Radiance of the emitters hit along the way (weighted by the throughput)
+ *     is added to this value
+ * \param maxBounces
+ *     Largest number of specular surfaces to follow (or -1 for no limit)
+ * \return
+ *     \c true if a diffuse surface was reached
+ */
+extern bool traceToDiffuse(const Scene *scene, Sampler *sampler, Ray3f &ray, Intersection &its,
+                           Color3f &throughput, Color3f &emitted, int maxBounces = -1);
+
+/**
+ * \brief Estimate the direct illumination at a surface using one emitter
+ * sample drawn from the scene's light hierarchy
+ *
+ * \param wi
+ *     Direction towards the viewer (in the local frame of \c its)
+ * \return
+ *     Radiance reflected towards \c wi
+ */
+extern Color3f sampleDirectLight(const Scene *scene, Sampler *sampler, const Intersection &its,
+                                 const BSDF *bsdf, const Vector3f &wi);
+
+/**
+ * \brief Render the pixels of the context's image block
+ *
+ * The offset and size of \ref RenderContext::getBlock() must be set,
+ * and the sampler must have been prepared for it. The block is cleared
+ * before rendering. Unless the integrator renders the block by itself
+ * (see \ref Integrator::renderBlock()), every pixel sample is computed
+ * using \ref Integrator::Li().
+ */
+extern void renderBlock(const Scene *scene, RenderContext &context);
+
+/**
+ * \brief Write a machine-readable (JSON) summary of a render
+ *
+ * The report contains the merged counters, derived throughput figures
+ * (rays per second, per core, traversal cost per ray) and statistics on how
+ * evenly the work was distributed among the threads. When rendering with
+ * NUMA-aware scheduling, the throughput of every node is reported as well.
+ *
+ * \param filename
+ *     Name of the JSON file
+ * \param threads
+ *     Counters of each thread that took part in the render
+ * \param elapsed
+ *     Wall-clock time of the render in seconds
+ * \param nodes
+ *     Merged counters of each NUMA node (optional)
+ */
+extern void writeStatisticsReport(const std::string &filename,
+                                  const std::vector<RenderStatistics> &threads,
+                                  double elapsed,
+                                  const std::vector<RenderStatistics> &nodes =
+                                      std::vector<RenderStatistics>());
+
+NORI_NAMESPACE_END
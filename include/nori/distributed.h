@@ -0,0 +1,59 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/block.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Render a frame by distributing its tiles over worker processes
+ *
+ * The coordinator listens on the given TCP port for workers started with
+ * \ref renderWorker(). The image is split into the same tiles that a local
+ * render would use; each worker is kept busy with a small window of tiles
+ * (proportional to its core count) and sends back the finished image
+ * blocks, which are merged into \c result. Only the region of the image
+ * covered by \c result (see \ref ImageBlock::setOffset()) is rendered.
+ *
+ * Workers may connect and disconnect at any time. When a worker drops its
+ * connection or does not deliver a tile within \c timeout seconds, all of
+ * its outstanding tiles are handed out to the remaining workers again. The
+ * function returns once every tile has been merged.
+ *
+ * Since all tiles are sampled exactly like in a local render, the merged
+ * image is identical to what a single process would have produced.
+ * Coordinator and workers must run on machines with the same byte order
+ * and floating point format, since image data is exchanged verbatim.
+ */
+extern void renderCoordinator(const Scene *scene, int port, float timeout,
+                              ImageBlock &result);
+
+/**
+ * \brief Render tiles on behalf of a coordinator
+ *
+ * Connects to the coordinator at \c host:port and renders the tiles it
+ * hands out (using all cores of the machine) until it reports that the
+ * frame is complete. The scene must have been loaded and preprocessed
+ * already; it is reused for all tiles. Its active camera must be the one
+ * rendered by the coordinator, otherwise the coordinator rejects the worker.
+ */
+extern void renderWorker(const Scene *scene, const std::string &host, int port);
+
+NORI_NAMESPACE_END
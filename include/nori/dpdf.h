@@ -19,6 +19,7 @@
 #pragma once
 
 #include <nori/common.h>
+#include <limits>
 
 NORI_NAMESPACE_BEGIN
 
@@ -27,6 +28,13 @@ NORI_NAMESPACE_BEGIN
  * 
  * This data structure can be used to transform uniformly distributed
  * samples to a stored discrete probability distribution.
+ *
+ * Two sampling methods are provided: \ref sample() inverts the cumulative
+ * distribution function using a binary search, which takes O(log n) time
+ * but maps neighboring sample values to neighboring entries (and hence
+ * preserves stratification). \ref sampleAlias() uses an alias table
+ * (Walker's method, constructed using Vose's algorithm) instead, which
+ * takes constant time regardless of the number of entries.
  * 
  * \ingroup libcore
  */
@@ -42,6 +50,7 @@ public:
     void clear() {
         m_cdf.clear();
         m_cdf.push_back(0.0f);
+        m_alias.clear();
         m_normalized = false;
     }
 
@@ -89,23 +98,13 @@ public:
     }
 
     /**
-     * \brief Normalize the distribution
+     * \brief Normalize the distribution and build its alias table
+     *
+     * Distributions with many entries are processed in parallel.
      *
      * \return Sum of the (previously unnormalized) entries
      */
-    float normalize() {
-        m_sum = m_cdf[m_cdf.size()-1];
-        if (m_sum > 0) {
-            m_normalization = 1.0f / m_sum;
-            for (size_t i=1; i<m_cdf.size(); ++i) 
-                m_cdf[i] *= m_normalization;
-            m_cdf[m_cdf.size()-1] = 1.0f;
-            m_normalized = true;
-        } else {
-            m_normalization = 0.0f;
-        }
-        return m_sum;
-    }
+    float normalize();
 
     /**
      * \brief %Transform a uniformly distributed sample to the stored distribution
@@ -174,6 +173,82 @@ public:
         return index;
     }
 
+    /**
+     * \brief %Transform a uniformly distributed sample using the alias table
+     *
+     * This takes constant time, but (unlike \ref sample()) does not map
+     * neighboring sample values to neighboring entries.
+     *
+     * \param[in] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \return
+     *     The discrete index associated with the sample
+     */
+    size_t sampleAlias(float sampleValue) const {
+        float fraction;
+        size_t index = lookupAlias(sampleValue, fraction);
+        const AliasEntry &entry = m_alias[index];
+        return fraction < entry.prob ? index : entry.alias;
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample using the alias table
+     *
+     * \param[in] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \param[out] pdf
+     *     Probability value of the sample
+     * \return
+     *     The discrete index associated with the sample
+     */
+    size_t sampleAlias(float sampleValue, float &pdf) const {
+        size_t index = sampleAlias(sampleValue);
+        pdf = operator[](index);
+        return index;
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample using the alias table
+     *
+     * The original sample is value adjusted so that it can be "reused".
+     *
+     * \param[in,out] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \return
+     *     The discrete index associated with the sample
+     */
+    size_t sampleAliasReuse(float &sampleValue) const {
+        float fraction;
+        size_t index = lookupAlias(sampleValue, fraction);
+        const AliasEntry &entry = m_alias[index];
+        if (fraction < entry.prob) {
+            sampleValue = fraction / entry.prob;
+            return index;
+        } else {
+            sampleValue = std::min((fraction - entry.prob) / (1.0f - entry.prob),
+                                   1.0f - std::numeric_limits<float>::epsilon());
+            return entry.alias;
+        }
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample using the alias table
+     *
+     * The original sample is value adjusted so that it can be "reused".
+     *
+     * \param[in,out] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \param[out] pdf
+     *     Probability value of the sample
+     * \return
+     *     The discrete index associated with the sample
+     */
+    size_t sampleAliasReuse(float &sampleValue, float &pdf) const {
+        size_t index = sampleAliasReuse(sampleValue);
+        pdf = operator[](index);
+        return index;
+    }
+
     /**
      * \brief Turn the underlying distribution into a
      * human-readable string format
@@ -190,7 +265,26 @@ public:
         return result + "}]";
     }
 private:
+    /// Alias table entry: keep the entry with probability \c prob, otherwise use \c alias
+    struct AliasEntry {
+        float prob;
+        uint32_t alias;
+    };
+
+    /// Build the alias table from the (unnormalized) CDF
+    void buildAliasTable();
+
+    /// Find the alias table column of a sample and the position within it
+    size_t lookupAlias(float sampleValue, float &fraction) const {
+        double scaled = (double) sampleValue * (double) m_alias.size();
+        size_t index = std::min((size_t) scaled, m_alias.size() - 1);
+        fraction = std::min((float) (scaled - (double) index),
+                            1.0f - std::numeric_limits<float>::epsilon());
+        return index;
+    }
+
     std::vector<float> m_cdf;
+    std::vector<AliasEntry> m_alias;
     float m_sum, m_normalization;
     bool m_normalized;
 };
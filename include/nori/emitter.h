@@ -34,22 +34,90 @@ NORI_NAMESPACE_BEGIN
     /// Normal direction 
     Vector3f m_np;
 
-    /// Relative refractive index in the sampled direction
+    /// Direction into which radiance is emitted (pointing away from \c m_p)
+    Vector3f m_wo;
+
+    /// Probability density of the sampled position (per unit area)
     float m_probDensity;
 
     /// Measure associated with the sample
     EMeasure m_measure;
 
-    EmitQueryRecord() : m_probDensity(1.0f), m_measure(EUnknownMeasure) {};
+    /// Emitter that the position lies on
+    const Emitter *m_emitter;
+
+    /// Index of the triangle (of the emitter's mesh) that the position lies on
+    uint32_t m_triangle;
+
+    /// Position that the emitter is sampled for (e.g. a shading point)
+    Point3f m_ref;
+
+    /// Is \c m_ref valid? Only then can positions be sampled by solid angle
+    bool m_hasRef;
+
+    EmitQueryRecord() : m_probDensity(1.0f), m_measure(EUnknownMeasure), m_emitter(nullptr),
+        m_triangle(0), m_hasRef(false) {};
 
     /// Create a new record for sampling the BSDF
     EmitQueryRecord(const Vector3f& wi)
-        : m_p(wi), m_probDensity(1.f), m_measure(EUnknownMeasure) { };
+        : m_p(wi), m_probDensity(1.f), m_measure(EUnknownMeasure), m_emitter(nullptr),
+          m_triangle(0), m_hasRef(false) { };
 
     /// Create a new record for querying the BSDF
     EmitQueryRecord(const Vector3f& wi,
         const Vector3f& wo, EMeasure measure)
-        : m_p(wi), m_np(wo), m_measure(measure) { };
+        : m_p(wi), m_np(wo), m_measure(measure), m_emitter(nullptr),
+          m_triangle(0), m_hasRef(false) { };
+};
+
+/**
+ * \brief Per-triangle data of an emissive mesh, precomputed once when its
+ * emitter is activated
+ *
+ * The table is stored as a structure of arrays: every component lives in
+ * its own contiguous array, so that loops over many triangles (or over a
+ * batch of samples) only stream through the data they need and can be
+ * vectorized by the compiler.
+ */
+struct EmitterTriangles {
+    /// First vertex of each triangle
+    std::vector<float> p0x, p0y, p0z;
+
+    /// Edges from the first to the second vertex
+    std::vector<float> e1x, e1y, e1z;
+
+    /// Edges from the first to the third vertex
+    std::vector<float> e2x, e2y, e2z;
+
+    /// Unit face normal
+    std::vector<float> nx, ny, nz;
+
+    /// Surface area
+    std::vector<float> area;
+
+    /// Total power emitted by the triangles (in units of luminance)
+    float power = 0.0f;
+
+    /// Fill the table with the triangles of a mesh emitting the given (uniform) luminance
+    void build(const Mesh *mesh, float luminance);
+
+    /// Return the number of triangles
+    size_t size() const { return area.size(); }
+
+    /// Return the total emitted power (in units of luminance)
+    float getPower() const { return power; }
+
+    /// Return the first vertex of a triangle
+    Point3f getP0(size_t i) const { return Point3f(p0x[i], p0y[i], p0z[i]); }
+
+    /// Return the edge from the first to the second vertex of a triangle
+    Vector3f getEdge1(size_t i) const { return Vector3f(e1x[i], e1y[i], e1z[i]); }
+
+    /// Return the edge from the first to the third vertex of a triangle
+    Vector3f getEdge2(size_t i) const { return Vector3f(e2x[i], e2y[i], e2z[i]); }
+
+    /// Return the face normal of a triangle
+    Normal3f getNormal(size_t i) const { return Normal3f(nx[i], ny[i], nz[i]); }
 };
 
 /**
@@ -59,11 +127,44 @@ class Emitter : public NoriObject {
 public:
 
     virtual void activate(Mesh *m)  = 0;
-    virtual void sample(EmitQueryRecord& bRec, const Point2f& sample)  = 0;
-    //virtual Color3f eval(const EmitQueryRecord& bRec)  = 0;
-    //virtual float pdf(const EmitQueryRecord& bRec)  = 0;
+    /**
+     * \brief Sample a point on the emitter
+     *
+     * \param sample
+     *     A uniformly distributed sample on \f$[0,1]^2\f$. All random
+     *     decisions (e.g. which triangle to sample) are derived from it.
+     */
+    virtual void sample(EmitQueryRecord& bRec, const Point2f& sample) const = 0;
+
+    /**
+     * \brief Sample a point on the triangle \c bRec.m_triangle of the emitter
+     *
+     * When a reference position \c bRec.m_ref is given, the point may be
+     * distributed according to the solid angle that the triangle subtends
+     * there. In any case, \c bRec.m_probDensity is set to the density of
+     * the sampled position per unit area.
+     */
+    virtual void sampleTriangle(EmitQueryRecord& bRec, const Point2f& sample) const = 0;
+
+    /**
+     * \brief Return the radiance emitted from the position \c bRec.m_p
+     * (with normal \c bRec.m_np) into the direction \c bRec.m_wo
+     */
+    virtual Color3f eval(const EmitQueryRecord& bRec) const = 0;
+
+    /**
+     * \brief Return the density of \ref sample() generating the position
+     * \c bRec.m_p on the triangle \c bRec.m_triangle (per unit area)
+     */
+    virtual float pdf(const EmitQueryRecord& bRec) const = 0;
+
+    /// Return the density of \ref sampleTriangle() generating the position \c bRec.m_p (per unit area)
+    virtual float pdfTriangle(const EmitQueryRecord& bRec) const = 0;
     Color3f getEmission() const { return m_radiance; }
-    DiscretePDF getDPDF() const { return m_dpdf; }
+    const DiscretePDF &getDPDF() const { return m_dpdf; }
+
+    /// Return the precomputed data of the emissive triangles (available once activated)
+    const EmitterTriangles &getTriangles() const { return m_triangles; }
     /**
      * \brief Return the type of object (i.e. Mesh/Emitter/etc.) 
      * provided by this instance
@@ -72,6 +173,7 @@ public:
 protected: 
     Color3f m_radiance;
     DiscretePDF m_dpdf;
+    EmitterTriangles m_triangles;
 };
 
 NORI_NAMESPACE_END
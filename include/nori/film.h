@@ -0,0 +1,221 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/block.h>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+NORI_NAMESPACE_BEGIN
+
+class TiledEXRWriter;
+
+/**
+ * \brief Accumulates rendered image blocks and streams finished tiles to disk
+ *
+ * This is an alternative to merging all blocks into one full-frame
+ * \ref ImageBlock, whose memory usage only depends on the number of
+ * blocks that are in flight. The image is split into tiles that coincide
+ * with the blocks handed out by a \ref BlockGenerator (with the same
+ * offset and block size). Because of the reconstruction filter, a block
+ * also contributes to the pixels of its neighbors. A tile is therefore
+ * final once the block at its position and all adjacent blocks have been
+ * merged; at that point, it is normalized, written to a tiled OpenEXR
+ * file and its storage is released.
+ *
+ * Blocks can be merged in any order. Since floating point addition is not
+ * associative, a tile keeps the contribution of each of the (up to nine)
+ * blocks overlapping it separately, and sums them in a fixed order when it
+ * is written. The result hence does not depend on the order in which the
+ * blocks were finished, and a block that takes long to render only keeps
+ * the tiles in its immediate neighborhood in memory.
+ */
+class StreamingFilm {
+public:
+    /**
+     * \brief Create a streaming film
+     * \param filename
+     *      Name of the OpenEXR file that will be created
+     * \param offset
+     *      Offset of the streamed region within the image
+     * \param size
+     *      Size of the streamed region (and of the resulting file)
+     * \param blockSize
+     *      Tile size, which must match the size of the rendered blocks
+     * \param borderSize
+     *      Border size of the rendered blocks (see \ref ImageBlock)
+     */
+    StreamingFilm(const std::string &filename, const Point2i &offset,
+                  const Vector2i &size, int blockSize, int borderSize);
+
+    /// Write any remaining tiles and close the file
+    ~StreamingFilm();
+
+    /**
+     * \brief Merge a rendered block and write all tiles that became final
+     *
+     * This function is thread-safe
+     */
+    void put(const ImageBlock &block);
+
+    /// Return the largest number of tiles that were held in memory at once
+    size_t getPeakTileCount() const { return m_peakTiles; }
+private:
+    /// Weighted pixel sums of a tile (or of a part of it)
+    typedef Eigen::Array<Color4f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> TileStorage;
+
+    /// Contribution of one block to a tile
+    struct TilePart {
+        /// Position of the contribution within the tile
+        Point2i offset;
+        TileStorage data;
+    };
+
+    /// Tile that is still receiving samples
+    struct Tile {
+        /// Contributions of the blocks at relative positions (-1..1, -1..1), row by row
+        TilePart parts[9];
+    };
+
+    /// Return the given tile, creating it if necessary
+    Tile &getTile(int tileX, int tileY);
+
+    /// Has the block at this tile position (or outside the image) been merged?
+    bool isMerged(int tileX, int tileY) const;
+
+    /// Normalize the given tile, write it to disk and release its storage
+    void writeTile(int tileX, int tileY);
+
+    Point2i m_offset;
+    Vector2i m_size;
+    Vector2i m_numTiles;
+    int m_blockSize;
+    int m_borderSize;
+    std::vector<bool> m_merged;
+    std::unordered_map<int, Tile> m_tiles;
+    size_t m_peakTiles = 0;
+    std::unique_ptr<TiledEXRWriter> m_writer;
+    std::mutex m_mutex;
+};
+
+/**
+ * \brief Merges rendered image blocks in a fixed order
+ *
+ * With reconstruction filters that spill into neighboring pixels, the
+ * pixels along block boundaries receive contributions from several
+ * blocks. Floating point addition is not associative, hence the value of
+ * these pixels would depend on the order in which the threads happen to
+ * finish their blocks. This class hands blocks to a merge function
+ * strictly in the order of their indices (e.g. as returned by
+ * \ref BlockGenerator::next()), and keeps a copy of blocks that finish
+ * early until it is their turn. Blocks without a border region never
+ * overlap and are merged right away.
+ */
+class OrderedBlockMerger {
+public:
+    /// Function that merges a block into the image
+    typedef std::function<void(ImageBlock &)> MergeFunction;
+
+    /**
+     * \brief Create a merger for blocks rendered with the given filter
+     * \param merge
+     *     Called (one block at a time) to merge a block into the image
+     */
+    OrderedBlockMerger(const ReconstructionFilter *filter, const MergeFunction &merge);
+
+    /// Merge the block with the given index once all earlier blocks have been merged
+    void put(int index, ImageBlock &block);
+
+    /// Mark a block that will not be rendered (e.g. since it is complete already)
+    void skip(int index);
+
+    /// Start a new sequence of blocks, beginning with index zero
+    void reset();
+
+    /// Return the largest number of blocks that had to be held back at once
+    size_t getPeakPendingCount() const { return m_peakPending; }
+private:
+    /// Merge the pending blocks that are next in line
+    void flush();
+
+    const ReconstructionFilter *m_filter;
+    MergeFunction m_merge;
+    bool m_ordered;
+    int m_next = 0;
+    std::map<int, std::unique_ptr<ImageBlock>> m_pending;
+    std::vector<std::unique_ptr<ImageBlock>> m_pool;
+    size_t m_peakPending = 0;
+    std::mutex m_mutex;
+};
+
+/**
+ * \brief Image that receives samples at arbitrary pixels from many threads
+ *
+ * Strategies that connect paths to the camera (e.g. light tracing) produce
+ * contributions anywhere on the image rather than in the block that is
+ * being rendered. They are added to per-pixel atomic sums (each sample
+ * only affects the pixel containing it) without taking a lock, and are
+ * added to the rendered image once all passes are complete.
+ *
+ * The sums are accumulated in whatever order the threads deliver their
+ * samples, so unlike the blocks merged by \ref OrderedBlockMerger, their
+ * rounding differs between runs and thread counts.
+ */
+class SplatFilm {
+public:
+    /**
+     * \brief Create an empty film
+     * \param offset
+     *      Offset of the covered region within the image
+     * \param size
+     *      Size of the covered region
+     */
+    SplatFilm(const Point2i &offset, const Vector2i &size);
+
+    /**
+     * \brief Add a sample at the given position (in fractional pixel
+     * coordinates of the image)
+     *
+     * Samples outside of the covered region are ignored. This function
+     * is thread-safe.
+     */
+    void put(const Point2f &position, const Color3f &value);
+
+    /// Reset all pixels to zero
+    void clear();
+
+    /**
+     * \brief Add the splatted values (multiplied by \c scale) to the
+     * pixels of an image block covering the same region
+     *
+     * Since the block stores filter-weighted sums, every value is
+     * multiplied with the pixel's filter weight before it is added.
+     */
+    void develop(ImageBlock &block, float scale) const;
+private:
+    Point2i m_offset;
+    Vector2i m_size;
+    std::unique_ptr<std::atomic<float>[]> m_pixels;
+};
+
+NORI_NAMESPACE_END
@@ -22,6 +22,27 @@
 
 NORI_NAMESPACE_BEGIN
 
+class RenderContext;
+
+/**
+ * \brief Path tracing strategies that are implemented by the
+ * wavefront renderer (see \ref WavefrontRenderer)
+ */
+enum EWavefrontStrategy {
+    /// The integrator can only be evaluated one ray at a time
+    EWavefrontUnsupported = 0,
+
+    /// Unidirectional path tracing using BSDF sampling only
+    EWavefrontMaterialSampling,
+
+    /**
+     * Path tracing with next event estimation from the light hierarchy on
+     * diffuse surfaces, combined with BSDF sampling using the power
+     * heuristic (the estimator of \c path_mis)
+     */
+    EWavefrontEmitterSampling
+};
+
 /**
  * \brief Abstract integrator (i.e. a rendering technique)
  *
@@ -39,6 +60,25 @@ public:
     /// Perform an (optional) preprocess step
     virtual void preprocess(const Scene *scene) { }
 
+    /**
+     * \brief Prepare a rendering pass (optional)
+     *
+     * This is called before the blocks of each pass are rendered, after
+     * all blocks of the previous pass have been completed. Progressive
+     * integrators can use it to do work that involves the whole image,
+     * e.g. tracing a batch of photons.
+     */
+    virtual void preparePass(const Scene *scene, uint32_t pass) { }
+
+    /**
+     * \brief Does the integrator rely on \ref preparePass()?
+     *
+     * Integrators that compute state for the whole image in between
+     * passes return \c true. They cannot be rendered by distributed
+     * workers, which only see the individual blocks.
+     */
+    virtual bool requiresPasses() const { return false; }
+
     /**
      * \brief Sample the incident radiance along a ray
      *
@@ -53,6 +93,40 @@ public:
      */
     virtual Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const = 0;
 
+    /**
+     * \brief Render all pixel samples of an image block at once (optional)
+     *
+     * Integrators that share information between the pixels of a block
+     * can override this. It is called by \ref nori::renderBlock() after
+     * the context's block has been cleared, and must splat the samples of
+     * all pixels of the block. The sampler has to be positioned using
+     * \ref Sampler::startSample() before drawing the random numbers of a
+     * pixel sample, so that renders remain deterministic.
+     *
+     * \return \c false if the block should be rendered using \ref Li()
+     */
+    virtual bool renderBlock(const Scene *scene, RenderContext &context) const { return false; }
+
+    /**
+     * \brief Does the integrator add samples to arbitrary pixels?
+     *
+     * Integrators that connect paths to the camera (e.g. light tracing)
+     * return \c true. They are then rendered with a \ref SplatFilm
+     * (available through \ref RenderContext::getSplatFilm()), which is
+     * added to the image after the last pass, normalized by the total
+     * number of pixel samples.
+     */
+    virtual bool usesSplatFilm() const { return false; }
+
+    /**
+     * \brief Return the strategy that the wavefront renderer should use
+     * to reproduce this integrator
+     *
+     * Integrators returning \ref EWavefrontUnsupported (the default) can
+     * only be rendered using \ref Li().
+     */
+    virtual EWavefrontStrategy getWavefrontStrategy() const { return EWavefrontUnsupported; }
+
     /**
      * \brief Return the type of object (i.e. Mesh/BSDF/etc.) 
      * provided by this instance
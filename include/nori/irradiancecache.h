@@ -0,0 +1,127 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/color.h>
+#include <nori/bbox.h>
+#include <atomic>
+
+NORI_NAMESPACE_BEGIN
+
+/// Maximum depth of the octree of an irradiance cache
+#define NORI_IRRCACHE_MAX_DEPTH 24
+
+/// Irradiance computed at a surface point, with its first-order derivatives
+struct IrradianceRecord {
+    /// Position of the record
+    Point3f p;
+
+    /// Surface normal at the record
+    Normal3f n;
+
+    /// Irradiance arriving at \c p
+    Color3f E;
+
+    /// Rotational gradient of each color channel (change under rotations of \c n)
+    Vector3f rotGrad[3];
+
+    /// Translational gradient of each color channel (change under translations of \c p)
+    Vector3f transGrad[3];
+
+    /// Harmonic mean distance to the surrounding geometry (validity radius)
+    float R;
+};
+
+/**
+ * \brief Irradiance cache (Ward et al. 1988, Ward and Heckbert 1992)
+ *
+ * Stores irradiance records in a loose octree: a node's region is its cube
+ * enlarged by half its size on every side, and a record is stored in the
+ * deepest node whose region contains its entire sphere of influence. A
+ * lookup then only has to visit the (few) nodes whose region contains the
+ * query point.
+ *
+ * Records are inserted while rendering, concurrently with lookups by other
+ * threads. The tree only ever grows: new nodes and records are published
+ * using a compare-and-swap on an atomic pointer, so that lookups never
+ * have to take a lock. Memory is released when the cache is destroyed.
+ */
+class IrradianceCache {
+public:
+    /**
+     * \brief Create an empty cache
+     *
+     * \param bounds
+     *     Region containing all records (e.g. the scene's bounding box)
+     * \param accuracy
+     *     Maximum error allowed when interpolating (\a a in Ward's paper);
+     *     a record is used up to a distance of <tt>accuracy * R</tt>
+     */
+    IrradianceCache(const BoundingBox3f &bounds, float accuracy);
+
+    /// Release all nodes and records
+    ~IrradianceCache();
+
+    /// Insert a record (thread-safe)
+    void insert(const IrradianceRecord &record);
+
+    /**
+     * \brief Interpolate the irradiance at \c p from the records nearby,
+     * extrapolated using their gradients (thread-safe)
+     *
+     * \return \c false if none of the records is accurate enough
+     */
+    bool interpolate(const Point3f &p, const Normal3f &n, Color3f &E) const;
+
+    /// Return the number of records
+    size_t size() const { return m_size.load(std::memory_order_relaxed); }
+
+    /// Return the accuracy parameter
+    float getAccuracy() const { return m_accuracy; }
+
+    /// Return a human-readable summary
+    std::string toString() const;
+private:
+    struct Entry {
+        IrradianceRecord record;
+        Entry *next;
+    };
+
+    struct Node {
+        std::atomic<Node *> children[8];
+        std::atomic<Entry *> entries;
+
+        Node() : entries(nullptr) {
+            for (int i = 0; i < 8; ++i)
+                children[i] = nullptr;
+        }
+    };
+
+    /// Recursively release a subtree
+    static void release(Node *node);
+
+    Node *m_root;
+    /// Minimum corner and size of the root cube
+    Point3f m_origin;
+    float m_extent;
+    float m_accuracy;
+    std::atomic<size_t> m_size;
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,170 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/emitter.h>
+#include <nori/mesh.h>
+#include <unordered_map>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Conservative bounds of the emission of a set of emissive triangles
+ *
+ * The bounds consist of an axis-aligned box containing the triangles, a
+ * cone containing their surface normals and their total emitted power.
+ */
+struct LightBounds {
+    /// Bounding box of the triangles
+    BoundingBox3f bbox;
+
+    /// Axis of the cone containing all surface normals
+    Vector3f axis;
+
+    /// Cosine of the half-angle of the normal cone
+    float cosTheta;
+
+    /// Total emitted power (in units of luminance)
+    float power;
+
+    /// Create empty bounds
+    LightBounds() : axis(0.0f, 0.0f, 1.0f), cosTheta(1.0f), power(0.0f) { }
+
+    /// Is the normal cone empty (i.e. are these bounds empty)?
+    bool isEmpty() const { return !bbox.isValid(); }
+
+    /// Enlarge the bounds to contain another set of bounds
+    void expandBy(const LightBounds &bounds);
+
+    /**
+     * \brief Estimate how much the emitters contribute to a shading point
+     *
+     * The estimate is an upper bound of the power arriving at \c p from
+     * the emitters, given their distance and orientation relative to the
+     * point. It is zero when no emitter can illuminate \c p.
+     *
+     * \param p
+     *     Position of the shading point
+     * \param n
+     *     Surface normal at the shading point, or zero to ignore the
+     *     orientation of the receiver (e.g. for volumes)
+     */
+    float importance(const Point3f &p, const Normal3f &n) const;
+};
+
+/**
+ * \brief Bounding volume hierarchy over all emissive triangles of a scene
+ *
+ * Every node stores \ref LightBounds for the triangles below it. To sample
+ * an emitter for a shading point, the hierarchy is traversed from the root,
+ * choosing a child proportional to its estimated contribution to the point
+ * at each step. Emitters that are far away or face away from the shading
+ * point are thereby picked rarely (or never), which makes this much more
+ * effective than choosing emitters by power alone when a scene contains
+ * many small emitters.
+ *
+ * The tree is built using a binned surface area orientation heuristic
+ * (SAOH), which accounts for both the spatial and the directional extent
+ * of the emission of the child nodes.
+ *
+ * Emitters are assumed to emit on the side their surface normal points
+ * to, just like \ref Scene::sampleEmitter() users such as the Whitted
+ * integrator do.
+ */
+class LightBVH {
+public:
+    /// Create an empty hierarchy
+    LightBVH() { }
+
+    /// Build the hierarchy over all emissive triangles of the given meshes
+    void build(const std::vector<Mesh *> &meshes);
+
+    /// Release all memory
+    void clear();
+
+    /// Return the number of emissive triangles
+    size_t getLightCount() const { return m_lights.size(); }
+
+    /// Return the number of nodes of the hierarchy
+    size_t getNodeCount() const { return m_nodes.size(); }
+
+    /**
+     * \brief Sample a position on an emitter for a shading point
+     *
+     * The first component of \c sample is used to traverse the hierarchy
+     * and is then reused to sample a position on the chosen triangle (see
+     * \ref Emitter::sampleTriangle(), which receives \c p as the reference
+     * position). Upon return, \c rec.m_probDensity contains the density of
+     * the sampled position with respect to surface area.
+     *
+     * \return \c false if no emitter can illuminate the shading point
+     */
+    bool sample(const Point3f &p, const Normal3f &n, EmitQueryRecord &rec,
+                const Point2f &sample) const;
+
+    /**
+     * \brief Return the density of \ref sample() generating the position
+     * \c rec.m_p (with normal \c rec.m_np) on the triangle \c rec.m_triangle
+     * of the emitter \c rec.m_emitter (with respect to surface area)
+     *
+     * This is needed when combining emitter sampling with other sampling
+     * strategies using multiple importance sampling.
+     */
+    float pdf(const Point3f &p, const Normal3f &n, const EmitQueryRecord &rec) const;
+
+    /// Return a human-readable summary of the hierarchy
+    std::string toString() const;
+private:
+    /// Emissive triangle
+    struct LightTriangle {
+        const Emitter *emitter;
+        uint32_t index;
+    };
+
+    /// Node of the hierarchy (stored in depth-first order)
+    struct Node {
+        LightBounds bounds;
+        /// Light index for leaves, index of the right child otherwise
+        uint32_t index;
+        bool leaf;
+    };
+
+    /// Element of the list of lights while building
+    struct BuildItem {
+        LightBounds bounds;
+        Point3f centroid;
+        uint32_t light;
+    };
+
+    /// Recursively build the subtree over items [start, end) and return its index
+    uint32_t build(std::vector<BuildItem> &items, uint32_t start, uint32_t end,
+                   uint64_t trail, int depth);
+
+    /// Probability of descending into the left child of a node
+    float leftProbability(const Node &node, const Point3f &p, const Normal3f &n) const;
+
+    std::vector<LightTriangle> m_lights;
+    std::vector<Node> m_nodes;
+    /// Path from the root to each light (bit i set: right child at depth i)
+    std::vector<uint64_t> m_trails;
+    /// Index of the first light of each emitter
+    std::unordered_map<const Emitter *, uint32_t> m_emitterOffset;
+};
+
+NORI_NAMESPACE_END
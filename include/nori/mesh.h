@@ -45,9 +45,11 @@ struct Intersection {
     Frame geoFrame;
     /// Pointer to the associated mesh
     const Mesh *mesh;
+    /// Index of the intersected triangle within the mesh
+    uint32_t triangle;
 
     /// Create an uninitialized intersection record
-    Intersection() : mesh(nullptr) { }
+    Intersection() : mesh(nullptr), triangle(0) { }
 
     /// Transform a direction vector into the local shading frame
     Vector3f toLocal(const Vector3f &d) const {
@@ -122,7 +124,16 @@ public:
      * \return
      *   \c true if an intersection has been detected
      */
-    bool rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const;
+    bool rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const {
+        return rayIntersect(m_V, m_F, index, ray, u, v, t);
+    }
+
+    /**
+     * \brief Ray-triangle intersection test against a copy of the
+     * vertex positions \c V and triangle indices \c F of a mesh
+     */
+    static bool rayIntersect(const MatrixXf &V, const MatrixXu &F, uint32_t index,
+                             const Ray3f &ray, float &u, float &v, float &t);
 
     /// Return a pointer to the vertex positions
     const MatrixXf &getVertexPositions() const { return m_V; }
@@ -0,0 +1,92 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Minimal blocking TCP socket
+ *
+ * This is a thin wrapper around BSD sockets (or Winsock), which provides
+ * just enough functionality to exchange fixed-size messages between the
+ * processes taking part in a distributed render. All functions throw a
+ * \ref NoriException when the underlying system call fails.
+ */
+class Socket {
+public:
+    /// Create an invalid socket
+    Socket() { }
+
+    /// Take ownership of another socket
+    Socket(Socket &&other) : m_fd(other.m_fd), m_peerName(std::move(other.m_peerName)) {
+        other.m_fd = -1;
+    }
+
+    /// Take ownership of another socket
+    Socket &operator=(Socket &&other);
+
+    /// Close the connection
+    ~Socket() { close(); }
+
+    /// Create a socket listening for connections on the given TCP port
+    static Socket listen(int port);
+
+    /// Connect to a listening socket at the given host name and TCP port
+    static Socket connect(const std::string &host, int port);
+
+    /// Wait for and accept an incoming connection (listening sockets only)
+    Socket accept();
+
+    /**
+     * \brief Wait until data (or a connection) can be read without blocking
+     *
+     * \return \c false if nothing arrived within \c timeout seconds
+     */
+    bool waitReadable(double timeout);
+
+    /// Send exactly \c size bytes
+    void send(const void *data, size_t size);
+
+    /**
+     * \brief Receive exactly \c size bytes
+     *
+     * \return \c false if the peer closed the connection before any
+     *     data arrived
+     */
+    bool receive(void *data, size_t size);
+
+    /// Close the connection
+    void close();
+
+    /// Is this a valid (open) socket?
+    bool isValid() const { return m_fd != -1; }
+
+    /// Return a human-readable description of the peer (e.g. "10.0.0.2:4711")
+    const std::string &getPeerName() const { return m_peerName; }
+private:
+    Socket(const Socket &) = delete;
+    Socket &operator=(const Socket &) = delete;
+
+    int64_t m_fd = -1;
+    std::string m_peerName;
+};
+
+NORI_NAMESPACE_END
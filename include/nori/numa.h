@@ -0,0 +1,113 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+#include <functional>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/// Set of processors that share a memory controller
+struct NumaNode {
+    /// Operating system identifier of the node
+    int id;
+
+    /// Logical processors belonging to the node
+    std::vector<int> cpus;
+};
+
+/**
+ * \brief Return the NUMA nodes of the machine
+ *
+ * On Linux, the topology is read from <tt>/sys/devices/system/node</tt>.
+ * On other platforms (or when that information is unavailable), the
+ * machine is reported as one node containing all processors.
+ */
+extern std::vector<NumaNode> getNumaNodes();
+
+/**
+ * \brief Restrict the calling thread to the given processors
+ *
+ * \return \c false if the operating system does not support this
+ */
+extern bool pinCurrentThread(const std::vector<int> &cpus);
+
+/**
+ * \brief Return the index of the NUMA node that the calling thread works for
+ *
+ * This is an index into the list returned by \ref getNumaNodes(), which
+ * is set for threads run by a \ref NumaScheduler, and -1 otherwise.
+ */
+extern int getCurrentNumaNode();
+
+/**
+ * \brief Distributes work over the NUMA nodes of the machine
+ *
+ * Every node gets its own TBB task arena with as many threads as it has
+ * processors. All threads that execute work on behalf of a node are
+ * pinned to the node's processors, hence memory they allocate and touch
+ * first is placed in the node's local memory.
+ *
+ * \ref parallelFor() deals out short runs of consecutive work items to the
+ * nodes in turn (proportional to their number of processors), so that all
+ * nodes advance through the items at a similar pace and consumers that
+ * process the results in order only have to hold back a few of them.
+ * Once a node is done with its share, it helps out with the remaining
+ * items of the other nodes.
+ */
+class NumaScheduler {
+public:
+    /// Create a scheduler for the given nodes
+    NumaScheduler(const std::vector<NumaNode> &nodes);
+
+    /// Release all resources
+    ~NumaScheduler();
+
+    /// Return the number of nodes
+    size_t getNodeCount() const { return m_nodes.size(); }
+
+    /// Return the processors of a node
+    const NumaNode &getNode(size_t index) const { return m_nodes[index]; }
+
+    /**
+     * \brief Run a function once on each node (one node at a time)
+     *
+     * The function receives the index of the node and is executed by a
+     * thread pinned to it. This is useful for creating node-local copies
+     * of data structures.
+     */
+    void forEachNode(const std::function<void(uint32_t)> &func);
+
+    /**
+     * \brief Process the work items <tt>0, .., count-1</tt> on all nodes
+     *
+     * \param func
+     *     Function called with the item index and the index of the node
+     *     whose thread processes it. It is called concurrently.
+     */
+    void parallelFor(uint32_t count, const std::function<void(uint32_t, uint32_t)> &func);
+private:
+    struct NodeState;
+
+    std::vector<NumaNode> m_nodes;
+    std::vector<std::unique_ptr<NodeState>> m_state;
+};
+
+NORI_NAMESPACE_END
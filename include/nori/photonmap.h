@@ -0,0 +1,190 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/scene.h>
+#include <nori/bsdf.h>
+#include <pcg32.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Photon stored on a diffuse surface
+struct Photon {
+    /// Position of the photon
+    Point3f p;
+
+    /// Direction that the photon arrived from (pointing away from the surface)
+    Vector3f wi;
+
+    /// Power carried by the photon
+    Color3f power;
+
+    Photon() { }
+
+    Photon(const Point3f &p, const Vector3f &wi, const Color3f &power)
+        : p(p), wi(wi), power(power) { }
+};
+
+/**
+ * \brief Emit a photon from the emitters of a scene
+ *
+ * An emitter is chosen proportional to its power (see \ref Scene::sampleEmitter()),
+ * and the photon leaves a position on it into a cosine-weighted direction.
+ *
+ * \param positionSample
+ *     Uniformly distributed sample used to choose the position
+ * \param directionSample
+ *     Uniformly distributed sample used to choose the direction
+ * \param ray
+ *     Ray along which the photon leaves the emitter
+ * \param power
+ *     Power carried by the photon (when emitting a single photon)
+ * \return
+ *     \c false if the scene does not contain any (non-black) emitters
+ */
+extern bool sampleEmittedPhoton(const Scene *scene, const Point2f &positionSample,
+                                const Point2f &directionSample, Ray3f &ray, Color3f &power);
+
+/**
+ * \brief Emit a photon and follow it through the scene
+ *
+ * The photon is emitted using \ref sampleEmittedPhoton(). At every surface
+ * it hits, the path is continued by sampling the BSDF and terminated using
+ * Russian roulette.
+ *
+ * <tt>f(its, wi, power, depth)</tt> is invoked for every diffuse surface
+ * that is hit, where \c wi is the (world space) direction the photon
+ * arrived from, \c power is the power it carries, and \c depth is the
+ * number of surfaces it has bounced off before (0 for direct illumination).
+ */
+template <typename Functor> void tracePhoton(const Scene *scene, pcg32 &random, Functor f) {
+    Ray3f ray;
+    Color3f power;
+    float u1 = random.nextFloat(), u2 = random.nextFloat();
+    float u3 = random.nextFloat(), u4 = random.nextFloat();
+    if (!sampleEmittedPhoton(scene, Point2f(u1, u2), Point2f(u3, u4), ray, power))
+        return;
+
+    Intersection its;
+    for (int depth = 0; scene->rayIntersect(ray, its); ++depth) {
+        const BSDF *bsdf = its.mesh->getBSDF();
+        if (bsdf->isDiffuse())
+            f(its, Vector3f(-ray.d), power, depth);
+
+        BSDFQueryRecord bRec(its.toLocal(-ray.d));
+        float u5 = random.nextFloat(), u6 = random.nextFloat();
+        Color3f bsdfValue = bsdf->sample(bRec, Point2f(u5, u6));
+        float prob = std::min(bsdfValue.maxCoeff(), 0.99f);
+        if (bsdfValue.isZero() || random.nextFloat() >= prob)
+            break;
+        power *= bsdfValue / prob;
+        ray = Ray3f(its.p, its.toWorld(bRec.wo));
+    }
+}
+
+/**
+ * \brief Balanced kd-tree over a set of photons
+ *
+ * The tree is stored implicitly: after building, the photons of every
+ * subtree occupy a contiguous range of the photon array, and the median
+ * of a range [begin, end) (at position (begin + end) / 2) is the node
+ * splitting it. No child pointers are needed, the tree is perfectly
+ * balanced, and the photons of nearby subtrees lie close together in
+ * memory, which keeps range queries cache friendly.
+ */
+class PhotonMap {
+public:
+    /// Create an empty photon map
+    PhotonMap() { }
+
+    /// Release all memory
+    void clear();
+
+    /// Add a photon (the tree must be rebuilt using \ref build() afterwards)
+    void push_back(const Photon &photon) { m_photons.push_back(photon); }
+
+    /// Append the contents of a photon buffer (e.g. filled by another thread)
+    void append(const std::vector<Photon> &photons);
+
+    /// Multiply the power of all photons by a constant
+    void scale(float factor);
+
+    /// Build the kd-tree over all photons that were added
+    void build();
+
+    /// Return the number of photons
+    size_t size() const { return m_photons.size(); }
+
+    /// Return a photon
+    const Photon &operator[](size_t index) const { return m_photons[index]; }
+
+    /**
+     * \brief Invoke <tt>f(photon)</tt> for every photon within distance
+     * \c radius of \c p (fixed-radius query)
+     */
+    template <typename Functor> void lookup(const Point3f &p, float radius, Functor f) const {
+        if (m_photons.empty())
+            return;
+        float radius2 = radius * radius;
+
+        /* Traverse the ranges of the subtrees depth first */
+        std::pair<uint32_t, uint32_t> stack[64];
+        int stackSize = 0;
+        uint32_t begin = 0, end = (uint32_t) m_photons.size();
+        while (true) {
+            if (begin < end) {
+                uint32_t mid = (begin + end) / 2;
+                const Photon &photon = m_photons[mid];
+                if ((photon.p - p).squaredNorm() <= radius2)
+                    f(photon);
+
+                /* Visit the child on the side of 'p' first; the other
+                   one only when the sphere overlaps the split plane */
+                int axis = m_axis[mid];
+                float d = p[axis] - photon.p[axis];
+                uint32_t nearBegin = begin, nearEnd = mid, farBegin = mid + 1, farEnd = end;
+                if (d > 0) {
+                    std::swap(nearBegin, farBegin);
+                    std::swap(nearEnd, farEnd);
+                }
+                if (d * d <= radius2 && farBegin < farEnd)
+                    stack[stackSize++] = std::make_pair(farBegin, farEnd);
+                begin = nearBegin;
+                end = nearEnd;
+            } else if (stackSize > 0) {
+                begin = stack[--stackSize].first;
+                end = stack[stackSize].second;
+            } else {
+                break;
+            }
+        }
+    }
+
+    /// Return a human-readable summary
+    std::string toString() const;
+private:
+    /// Recursively turn the photons in [begin, end) into a subtree
+    void build(uint32_t begin, uint32_t end);
+
+    std::vector<Photon> m_photons;
+    /// Split axis of the node stored at each position
+    std::vector<uint8_t> m_axis;
+};
+
+NORI_NAMESPACE_END
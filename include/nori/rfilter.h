@@ -19,6 +19,7 @@
 #pragma once
 
 #include <nori/object.h>
+#include <nori/dpdf.h>
 
 /// Reconstruction filters will be tabulated at this resolution
 #define NORI_FILTER_RESOLUTION 32
@@ -36,6 +37,13 @@ NORI_NAMESPACE_BEGIN
  * which is freely available at:
  *
  * http://graphics.stanford.edu/~mmp/chapters/pbrt_chapter7.pdf
+ *
+ * Alternatively, the filter can be importance sampled (set the boolean
+ * property \c importanceSample): the camera sample offset is then drawn
+ * proportionally to the filter and every sample contributes to exactly
+ * one pixel, weighted by the ratio of filter value and sampling density.
+ * This removes the border regions of image blocks, so that blocks
+ * rendered in parallel never overlap.
  */
 class ReconstructionFilter : public NoriObject {
 public:
@@ -45,13 +53,46 @@ public:
     /// Evaluate the filter function
     virtual float eval(float x) const = 0;
 
+    /// Should the filter be importance sampled instead of being splatted?
+    bool isImportanceSampled() const { return m_importanceSample; }
+
+    /**
+     * \brief Importance sample a film position according to the filter
+     *
+     * The filter is treated as separable, i.e. as <tt>eval(x)*eval(y)</tt>,
+     * which matches how \ref ImageBlock splats samples.
+     *
+     * \param sample
+     *     A uniformly distributed sample on \f$[0,1]^2\f$
+     * \param offset
+     *     Will be set to the sampled position relative to the pixel center
+     * \return
+     *     The filter value divided by the sampling density, scaled such
+     *     that it is exactly 1 wherever the tabulated density matches the
+     *     filter. Negative filter lobes produce negative weights.
+     */
+    float sample(const Point2f &sample, Point2f &offset) const;
+
+    /// Tabulate the filter for importance sampling (if requested)
+    void activate();
+
     /**
      * \brief Return the type of object (i.e. Mesh/Camera/etc.) 
      * provided by this instance
      * */
     EClassType getClassType() const { return EReconstructionFilter; }
+protected:
+    /// Initialize settings that are shared by all filters
+    ReconstructionFilter(const PropertyList &propList);
+
+    /// Importance sample the filter along one axis
+    float sample1D(float sample, float &weight) const;
+
 protected:
     float m_radius;
+    bool m_importanceSample;
+    std::vector<float> m_table; ///< Filter values at the bin centers (for sampling)
+    DiscretePDF m_pdf;          ///< Distribution proportional to the absolute table values
 };
 
 NORI_NAMESPACE_END
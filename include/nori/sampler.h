@@ -19,12 +19,20 @@
 #pragma once
 
 #include <nori/object.h>
+#include <pcg32.h>
 #include <memory>
 
 NORI_NAMESPACE_BEGIN
 
 class ImageBlock;
 
+/// Scramble the bits of a 64-bit integer (the finalizer of SplitMix64)
+inline uint64_t mix64(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
 /**
  * \brief Abstract sample generator
  *
@@ -74,8 +82,32 @@ public:
      * a new image block. This can be used to deterministically
      * initialize the sampler so that repeated program runs
      * always create the same image.
+     *
+     * Renders that accumulate several passes over the image call this
+     * once per block and pass. Implementations must produce uncorrelated
+     * samples for different values of \c pass, so that the passes can
+     * be averaged (e.g. after resuming from a checkpoint). The pass must
+     * be stored in \c m_pass, which \ref seedStream() depends on.
+     */
+    virtual void prepare(const ImageBlock &block, uint32_t pass) = 0;
+
+    /**
+     * \brief Prepare to generate the dimensions of one pixel sample
+     *
+     * This function is called before the camera ray of every pixel sample
+     * is generated. The values returned by \ref next1D() and \ref next2D()
+     * afterwards must only depend on the pixel, the sample index, the pass
+     * (see \ref prepare()) and the number of dimensions drawn so far, but
+     * not on the block or the thread that renders the pixel. This makes
+     * renders reproducible regardless of the thread count and allows
+     * re-rendering individual blocks.
+     *
+     * \param pixel
+     *     Integer coordinates of the pixel within the image
+     * \param index
+     *     Index of the sample within the current pass
      */
-    virtual void prepare(const ImageBlock &block) = 0;
+    virtual void startSample(const Point2i &pixel, uint32_t index) = 0;
 
     /**
      * \brief Prepare to generate new samples
@@ -97,6 +129,22 @@ public:
     /// Return the number of configured pixel samples
     virtual size_t getSampleCount() const { return m_sampleCount; }
 
+    /**
+     * \brief Seed a random number generator for a pixel sample
+     *
+     * The pixel selects one of the generator's streams, and the global index
+     * of the sample (counting over all passes since \ref prepare()) selects
+     * the starting position within it. Integrators that draw random numbers
+     * outside of the sampler use this to obtain a generator that, like the
+     * sampler, does not depend on the block or thread rendering the pixel.
+     * Different values of \c salt yield unrelated generators.
+     */
+    void seedStream(pcg32 &random, const Point2i &pixel, uint32_t index, uint64_t salt) const {
+        uint64_t pixelKey = ((uint64_t) (uint32_t) pixel.y() << 32) | (uint32_t) pixel.x();
+        uint64_t sampleIndex = (uint64_t) m_pass * m_sampleCount + index;
+        random.seed(mix64(sampleIndex ^ mix64(pixelKey ^ mix64(salt))), pixelKey);
+    }
+
     /**
      * \brief Return the type of object (i.e. Mesh/Sampler/etc.) 
      * provided by this instance
@@ -104,6 +152,8 @@ public:
     EClassType getClassType() const { return ESampler; }
 protected:
     size_t m_sampleCount;
+    /// Pass that the sampler was last prepared for
+    uint32_t m_pass = 0;
 };
 
 NORI_NAMESPACE_END
@@ -19,6 +19,9 @@
 #pragma once
 
 #include <nori/accel.h>
+#include <nori/emitter.h>
+#include <nori/lightbvh.h>
+#include <unordered_map>
 
 NORI_NAMESPACE_BEGIN
 
@@ -40,14 +43,32 @@ public:
     /// Return a pointer to the scene's kd-tree
     const Accel *getAccel() const { return m_accel; }
 
+    /// Return a pointer to the scene's kd-tree
+    Accel *getAccel() { return m_accel; }
+
     /// Return a pointer to the scene's integrator
     const Integrator *getIntegrator() const { return m_integrator; }
 
     /// Return a pointer to the scene's integrator
     Integrator *getIntegrator() { return m_integrator; }
 
-    /// Return a pointer to the scene's camera
-    const Camera *getCamera() const { return m_camera; }
+    /// Return a pointer to the scene's (active) camera
+    const Camera *getCamera() const { return m_cameras[m_activeCamera]; }
+
+    /**
+     * \brief Return the number of cameras
+     *
+     * A scene may contain several cameras (e.g. the frames of a camera
+     * flythrough or the two views of a stereo pair), which are rendered
+     * one after the other while sharing all other scene data.
+     */
+    size_t getCameraCount() const { return m_cameras.size(); }
+
+    /// Return the index of the camera returned by \ref getCamera()
+    size_t getActiveCamera() const { return m_activeCamera; }
+
+    /// Select the camera returned by \ref getCamera()
+    void setActiveCamera(size_t index);
 
     /// Return a pointer to the scene's sample generator (const version)
     const Sampler *getSampler() const { return m_sampler; }
@@ -58,6 +79,45 @@ public:
     /// Return a reference to an array containing all meshes
     const std::vector<Mesh *> &getMeshes() const { return m_meshes; }
 
+    /// Return a reference to an array containing all emissive meshes
+    const std::vector<Mesh *> &getEmitterMeshes() const { return m_emitterMeshes; }
+
+    /**
+     * \brief Sample a position on one of the scene's emitters
+     *
+     * The emitter is chosen proportional to its emitted power (luminance
+     * of its radiance times its surface area) using a distribution that is
+     * built once in \ref activate(). The first component of \c sample
+     * selects the emitter and is then reused to sample a position on it.
+     *
+     * Upon return, \c rec.m_emitter refers to the chosen emitter and
+     * \c rec.m_probDensity contains the density of the sampled position
+     * with respect to surface area, including the probability of choosing
+     * the emitter.
+     *
+     * \return \c false if the scene contains no emitters
+     */
+    bool sampleEmitter(EmitQueryRecord &rec, const Point2f &sample) const;
+
+    /**
+     * \brief Return the density of \ref sampleEmitter() generating the
+     * position \c rec.m_p on the emitter \c rec.m_emitter (with respect
+     * to surface area)
+     */
+    float pdfEmitter(const EmitQueryRecord &rec) const;
+
+    /// Return the probability of \ref sampleEmitter() choosing the given emitter
+    float pdfEmitterSelection(const Emitter *emitter) const;
+
+    /**
+     * \brief Return the light hierarchy over all emissive triangles
+     *
+     * Unlike \ref sampleEmitter(), this chooses emitters based on their
+     * estimated contribution to a given shading point, which is much more
+     * effective in scenes with many emitters.
+     */
+    const LightBVH &getLightBVH() const { return m_lightBVH; }
+
     /**
      * \brief Intersect a ray against all triangles stored in the scene
      * and return detailed intersection information
@@ -118,9 +178,14 @@ public:
     EClassType getClassType() const { return EScene; }
 private:
     std::vector<Mesh *> m_meshes;
+    std::vector<Mesh *> m_emitterMeshes;
+    std::unordered_map<const Emitter *, uint32_t> m_emitterIndex;
+    DiscretePDF m_emitterPDF;
+    LightBVH m_lightBVH;
     Integrator *m_integrator = nullptr;
     Sampler *m_sampler = nullptr;
-    Camera *m_camera = nullptr;
+    std::vector<Camera *> m_cameras;
+    size_t m_activeCamera = 0;
     Accel *m_accel = nullptr;
     //OctTree* m_octTree = nullptr;
 };
@@ -0,0 +1,203 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/bbox.h>
+#include <atomic>
+
+NORI_NAMESPACE_BEGIN
+
+/// Maximum depth of a directional quadtree
+#define NORI_QUADTREE_MAX_DEPTH 20
+
+/**
+ * \brief Distribution over the sphere of directions, stored as a quadtree
+ *
+ * Directions are mapped to the unit square using the equal-area cylindrical
+ * mapping <tt>(cos(theta), phi)</tt>, which is subdivided adaptively: every
+ * node stores the energy recorded in each of its four quadrants, and only
+ * quadrants with a large share of the energy are refined. Sampling and
+ * density evaluation descend the tree, choosing quadrants proportional to
+ * their energy.
+ *
+ * The energies can be recorded concurrently by multiple threads, while
+ * the structure of the tree only changes in \ref refine(). Since they are
+ * summed in the order the threads arrive, the recorded energies (and thus
+ * the refined trees) are only reproducible up to rounding.
+ */
+class DirectionalQuadTree {
+public:
+    /// Create a tree with a single node and no energy
+    DirectionalQuadTree();
+
+    DirectionalQuadTree(const DirectionalQuadTree &other) : m_nodes(other.m_nodes) { }
+
+    DirectionalQuadTree &operator=(const DirectionalQuadTree &other) {
+        m_nodes = other.m_nodes;
+        return *this;
+    }
+
+    /// Add energy to the leaf containing a direction (thread-safe)
+    void record(const Vector3f &d, float value);
+
+    /// Return the total recorded energy
+    float getEnergy() const;
+
+    /// Return the number of nodes
+    size_t getNodeCount() const { return m_nodes.size(); }
+
+    /**
+     * \brief Sample a direction proportional to the recorded energy
+     *
+     * \param sample
+     *     A uniformly distributed sample on \f$[0,1]^2\f$
+     */
+    Vector3f sample(const Point2f &sample) const;
+
+    /// Return the solid angle density of \ref sample() (zero if the tree has no energy)
+    float pdf(const Vector3f &d) const;
+
+    /**
+     * \brief Replace this tree by an empty one whose structure adapts
+     * to the energy distribution of \c source
+     *
+     * Quadrants holding more than \c threshold times the total energy
+     * are subdivided; all others become leaves.
+     */
+    void refine(const DirectionalQuadTree &source, float threshold);
+
+    /// Return a human-readable summary
+    std::string toString() const;
+private:
+    struct Node {
+        std::atomic<float> sum[4];
+        /// Index of the node refining each quadrant (0: the quadrant is a leaf)
+        uint32_t children[4];
+
+        Node() {
+            for (int i = 0; i < 4; ++i) {
+                sum[i].store(0.0f, std::memory_order_relaxed);
+                children[i] = 0;
+            }
+        }
+
+        Node(const Node &other) {
+            for (int i = 0; i < 4; ++i) {
+                sum[i].store(other.sum[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                children[i] = other.children[i];
+            }
+        }
+
+        Node &operator=(const Node &other) {
+            for (int i = 0; i < 4; ++i) {
+                sum[i].store(other.sum[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                children[i] = other.children[i];
+            }
+            return *this;
+        }
+
+        float getEnergy() const {
+            return sum[0].load(std::memory_order_relaxed) + sum[1].load(std::memory_order_relaxed)
+                 + sum[2].load(std::memory_order_relaxed) + sum[3].load(std::memory_order_relaxed);
+        }
+    };
+
+    std::vector<Node> m_nodes;
+};
+
+/**
+ * \brief Spatio-directional tree ("SD-tree", Mueller et al. 2017)
+ *
+ * A binary tree subdivides the scene's bounding box, cycling through the
+ * three axes. Every leaf holds two directional quadtrees approximating the
+ * radiance arriving in its region: one that is used for sampling and one
+ * in which the radiance estimates of the current training pass are
+ * recorded. Between passes, \ref refine() subdivides the leaves that
+ * received many samples, and adapts the quadtrees to what was learned.
+ */
+class SDTree {
+public:
+    /// Spatial leaf of the tree
+    struct Leaf {
+        /// Distribution used for sampling
+        DirectionalQuadTree sampling;
+        /// Distribution being recorded
+        DirectionalQuadTree building;
+        /// Number of radiance estimates recorded into \ref building
+        std::atomic<uint32_t> sampleCount;
+
+        Leaf() : sampleCount(0) { }
+
+        Leaf(const Leaf &other) : sampling(other.sampling), building(other.building),
+            sampleCount(other.sampleCount.load(std::memory_order_relaxed)) { }
+
+        /// Record a radiance estimate (thread-safe)
+        void record(const Vector3f &d, float value) {
+            building.record(d, value);
+            sampleCount.fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+
+    /// Create a tree with a single leaf covering \c bounds
+    SDTree(const BoundingBox3f &bounds);
+
+    /// Return the leaf containing a position
+    Leaf &lookup(const Point3f &p);
+
+    /// Return the leaf containing a position
+    const Leaf &lookup(const Point3f &p) const;
+
+    /**
+     * \brief Start sampling from what was recorded, and prepare the
+     * next training pass
+     *
+     * The recorded distributions become the sampling distributions.
+     * Leaves with more than \c spatialThreshold samples are split in
+     * half (repeatedly), and the recording quadtrees are rebuilt with a
+     * structure that follows the sampling ones (see \ref
+     * DirectionalQuadTree::refine()). The quadtrees are processed in
+     * parallel.
+     */
+    void refine(uint32_t spatialThreshold, float directionalThreshold);
+
+    /// Return the number of leaves
+    size_t getLeafCount() const { return m_leaves.size(); }
+
+    /// Return a human-readable summary
+    std::string toString() const;
+private:
+    struct Node {
+        /// Index of the two children (if not a leaf)
+        uint32_t children[2];
+        /// Index of the leaf data (if a leaf)
+        uint32_t leaf;
+        /// Axis along which the node is (or would be) split
+        uint8_t axis;
+        bool isLeaf;
+    };
+
+    /// Return the index of the node that is a leaf containing a position
+    uint32_t lookupNode(const Point3f &p) const;
+
+    BoundingBox3f m_bounds;
+    std::vector<Node> m_nodes;
+    std::vector<Leaf> m_leaves;
+};
+
+NORI_NAMESPACE_END
@@ -69,6 +69,24 @@ public:
 
     /// Probability density of \ref squareToBeckmann()
     static float squareToBeckmannPdf(const Vector3f &m, float alpha);
+
+    /**
+     * \brief Uniformly sample a direction within a spherical triangle with respect to solid angles
+     *
+     * Uses the method by Arvo ("Stratified sampling of spherical triangles", 1995).
+     * The triangle is given by the unit vectors \c a, \c b and \c c pointing to its
+     * corners, and the density of the sampled directions is one over
+     * \ref sphericalTriangleArea().
+     */
+    static Vector3f squareToSphericalTriangle(const Point2f &sample, const Vector3f &a,
+                                              const Vector3f &b, const Vector3f &c);
+
+    /// Probability density of \ref squareToSphericalTriangle()
+    static float squareToSphericalTrianglePdf(const Vector3f &v, const Vector3f &a,
+                                              const Vector3f &b, const Vector3f &c);
+
+    /// Solid angle covered by the spherical triangle with the (unit) corner directions \c a, \c b and \c c
+    static float sphericalTriangleArea(const Vector3f &a, const Vector3f &b, const Vector3f &c);
 };
 
 NORI_NAMESPACE_END
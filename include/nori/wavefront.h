@@ -0,0 +1,211 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/context.h>
+#include <nori/integrator.h>
+#include <nori/mesh.h>
+#include <pcg32.h>
+#include <unordered_map>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Queue of rays stored as a structure of arrays
+ *
+ * Every component lives in its own contiguous array, so that the stages
+ * of the \ref WavefrontRenderer stream through exactly the data they need
+ * and could process several rays at once using SIMD instructions.
+ */
+struct RayQueue {
+    /// Ray origins
+    std::vector<float> ox, oy, oz;
+
+    /// Ray directions
+    std::vector<float> dx, dy, dz;
+
+    /// Maximum extent of each ray (only used by shadow rays)
+    std::vector<float> maxt;
+
+    /// Path throughput (or the unoccluded contribution of a shadow ray)
+    std::vector<float> r, g, b;
+
+    /// Shading normal at the ray origin (only used by paths)
+    std::vector<float> nx, ny, nz;
+
+    /// Solid angle density of the BSDF sampling the direction (only used by paths)
+    std::vector<float> pdf;
+
+    /// Product of the relative indices of refraction along the path (only used by paths)
+    std::vector<float> eta;
+
+    /// Index of the camera sample that each ray belongs to
+    std::vector<uint32_t> sample;
+
+    /// Was the ray generated by the camera or by a non-diffuse BSDF?
+    std::vector<uint8_t> specular;
+
+    /// Number of rays in the queue
+    size_t size = 0;
+
+    /// Reserve space for the given number of rays
+    void reserve(size_t capacity);
+
+    /// Remove all rays (without releasing memory)
+    void clear() { size = 0; }
+
+    /// Append a ray and return its index
+    size_t push(const Ray3f &ray, const Color3f &value, uint32_t sampleIndex, bool isSpecular);
+
+    /// Set the state of the vertex that generated the path with the given index
+    void setVertex(size_t i, const Normal3f &n, float bsdfPdf, float relativeEta) {
+        nx[i] = n.x(); ny[i] = n.y(); nz[i] = n.z();
+        pdf[i] = bsdfPdf;
+        eta[i] = relativeEta;
+    }
+
+    /// Replace the contents by the rays <tt>source[order[0]], .., source[order[count-1]]</tt>
+    void gather(const RayQueue &source, const uint32_t *order, size_t count);
+
+    /// Reconstruct the ray with the given index
+    Ray3f getRay(size_t i) const {
+        return Ray3f(Point3f(ox[i], oy[i], oz[i]), Vector3f(dx[i], dy[i], dz[i]),
+                     Epsilon, maxt[i]);
+    }
+
+    /// Return the throughput of the ray with the given index
+    Color3f getValue(size_t i) const { return Color3f(r[i], g[i], b[i]); }
+
+    /// Return the shading normal at the origin of the ray with the given index
+    Normal3f getNormal(size_t i) const { return Normal3f(nx[i], ny[i], nz[i]); }
+
+    /// Set the throughput of the ray with the given index
+    void setValue(size_t i, const Color3f &value) { r[i] = value.r(); g[i] = value.g(); b[i] = value.b(); }
+};
+
+/**
+ * \brief Wavefront path tracer
+ *
+ * Instead of following one path at a time through \ref Integrator::Li(),
+ * this engine generates a large batch of camera rays for an image block
+ * and advances all of them one bounce at a time. Each bounce is split into
+ * stages that each run a tight loop over a \ref RayQueue: closest-hit
+ * intersection, emission, emitter sampling, occlusion testing and BSDF
+ * sampling. The latter processes the surviving paths sorted by material,
+ * so that each BSDF implementation runs over a contiguous range of rays.
+ *
+ * The engine implements the path tracing strategies described by
+ * \ref EWavefrontStrategy; the integrator of the scene selects one of them
+ * via \ref Integrator::getWavefrontStrategy(). With emitter sampling, the
+ * estimator is the one of \c path_mis: next event estimation from the
+ * scene's light hierarchy, combined with BSDF sampling using the power
+ * heuristic. Each path draws its random
+ * numbers from its own PCG32 stream, which is seeded by the sampler for
+ * the path's pixel sample (see \ref Sampler::seedStream()). The results
+ * hence converge to the same image as the scalar integrator, but are not
+ * bit-identical to it.
+ *
+ * Optionally, the secondary and shadow rays of each bounce are reordered
+ * before they are traced, so that rays starting in the same region of the
+ * scene and heading in similar directions are traced one after another.
+ * The sort key combines the Morton code of the ray origin (quantized to a
+ * grid over the scene's bounding box) with the octant of the direction.
+ * Consecutive rays then visit mostly the same BVH nodes, which improves
+ * the cache hit rate once the paths have scattered after the first
+ * bounce. The number of nodes visited per ray does not change (it does
+ * not depend on the order), so the effect only shows in the ray
+ * throughput. It only pays off when the BVH does not fit into the caches;
+ * for small scenes, the cost of sorting dominates.
+ *
+ * One instance should be created per rendering thread. All queues are
+ * reused across blocks, so that rendering does not allocate memory once
+ * the first batch has been processed.
+ */
+class WavefrontRenderer {
+public:
+    /**
+     * \brief Create a wavefront renderer for the given scene
+     * \param reorder
+     *     Sort secondary and shadow rays for coherence before tracing them
+     */
+    WavefrontRenderer(const Scene *scene, bool reorder = false);
+
+    /**
+     * \brief Render the pixels of the context's image block
+     *
+     * This is the wavefront counterpart of \ref nori::renderBlock() and
+     * has the same requirements: the offset and size of the context's
+     * block must be set, and its sampler must have been prepared for it.
+     */
+    void renderBlock(const Scene *scene, RenderContext &context);
+
+    /// Return the largest number of paths that are traced at once
+    size_t getBatchSize() const { return m_batchSize; }
+private:
+    /// Fill the path queue with the camera rays of the samples [start, end)
+    void generateCameraRays(const Scene *scene, Sampler *sampler, const Point2i &offset,
+                            const Vector2i &size, uint32_t sampleCount,
+                            uint64_t start, uint64_t end);
+
+    /// Find the closest intersection of every ray in the path queue
+    void intersectPaths(const Scene *scene);
+
+    /// Accumulate the radiance of emitters that were hit by the path queue
+    void accumulateEmission(const Scene *scene);
+
+    /// Sample a point on an emitter for every path from the light hierarchy and queue a shadow ray
+    void sampleEmitters(const Scene *scene);
+
+    /// Test the shadow rays and accumulate the unoccluded contributions
+    void traceShadowRays(const Scene *scene);
+
+    /// Sort the surviving paths by material and sample their next direction
+    void sampleBSDFs();
+
+    /// Sort the rays of a queue by origin cell and direction octant
+    void reorder(RayQueue &queue);
+
+    EWavefrontStrategy m_strategy;
+    size_t m_batchSize;
+    bool m_reorder;
+
+    /* Per-sample state of the current batch */
+    std::vector<Point2f> m_positions;
+    std::vector<float> m_weights;
+    std::vector<Color3f> m_radiance;
+    std::vector<pcg32> m_random;
+
+    /* Ray queues and the intersections of the current path queue */
+    RayQueue m_paths, m_nextPaths, m_shadowRays;
+    std::vector<Intersection> m_hits;
+    std::vector<uint8_t> m_hit;
+
+    /* Material sorting */
+    std::unordered_map<const BSDF *, uint32_t> m_materialIndex;
+    std::vector<uint32_t> m_materialCount;
+    std::vector<uint32_t> m_order;
+
+    /* Ray reordering */
+    BoundingBox3f m_sceneBounds;
+    std::vector<uint32_t> m_sortKeys, m_sortKeysTemp;
+    std::vector<uint32_t> m_sortOrder, m_sortOrderTemp;
+    RayQueue m_sortedRays;
+};
+
+NORI_NAMESPACE_END
@@ -6,10 +6,10 @@ import sys
 TEST_SCENES = [
     "pa4/tests/test-mesh.xml",
     "pa4/tests/test-mesh-furnace.xml",
-    "pa5/tests/chi2test-microfacet.xml",
-    "pa5/tests/ttest-microfacet.xml",
-    "pa5/tests/test-direct.xml",
-    "pa5/tests/test-furnace.xml",
+    "pa4/tests/chi2test-microfacet.xml",
+    "pa4/tests/ttest-microfacet.xml",
+    "pa4/tests/test-direct.xml",
+    "pa4/tests/test-furnace.xml",
 ]
 
 TEST_WARPS = [
@@ -28,6 +28,7 @@ TEST_WARPS = [
     ("microfacet_brdf", (0.05, 0.5)),
     ("microfacet_brdf", (0.10, 0.5)),
     ("microfacet_brdf", (0.30, 0.5)),
+    ("spherical_triangle", None),
 ]
 
 def find_build_directory():
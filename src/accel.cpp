@@ -18,6 +18,8 @@
 
 #include <nori/accel.h>
 #include <nori/timer.h>
+#include <nori/context.h>
+#include <nori/numa.h>
 #include <tbb/tbb.h>
 #include <Eigen/Geometry>
 #include <atomic>
@@ -319,6 +321,7 @@ void Accel::clear() {
     m_meshOffset.push_back(0u);
     m_nodes.clear();
     m_indices.clear();
+    m_replicas.clear();
     m_bbox.reset();
     m_nodes.shrink_to_fit();
     m_meshes.shrink_to_fit();
@@ -381,6 +384,19 @@ void Accel::build() {
     m_nodes = std::move(compactified);
 }
 
+void Accel::addReplica(uint32_t node) {
+    std::unique_ptr<Replica> replica(new Replica());
+    replica->nodes = m_nodes;
+    replica->indices = m_indices;
+    for (const Mesh *mesh : m_meshes) {
+        replica->positions.push_back(mesh->getVertexPositions());
+        replica->triangles.push_back(mesh->getIndices());
+    }
+    if (m_replicas.size() <= node)
+        m_replicas.resize(node + 1);
+    m_replicas[node] = std::move(replica);
+}
+
 std::pair<float, uint32_t> Accel::statistics(uint32_t node_idx) const {
     const BVHNode &node = m_nodes[node_idx];
     if (node.isLeaf()) {
@@ -401,8 +417,30 @@ std::pair<float, uint32_t> Accel::statistics(uint32_t node_idx) const {
     }
 }
 
+/* Adds the traversal cost of one ray to the counters of the rendering thread */
+struct TraversalCounter {
+    uint32_t nodes = 0, triangles = 0;
+    bool shadowRay;
+
+    TraversalCounter(bool shadowRay) : shadowRay(shadowRay) { }
+
+    ~TraversalCounter() {
+        RenderContext *context = RenderContext::get();
+        if (!context)
+            return;
+        RenderStatistics &stats = context->getStatistics();
+        if (shadowRay)
+            stats.shadowRays++;
+        else
+            stats.closestHitRays++;
+        stats.nodesVisited += nodes;
+        stats.trianglesTested += triangles;
+    }
+};
+
 bool Accel::rayIntersect(const Ray3f &_ray, Intersection &its, bool shadowRay) const {
     uint32_t node_idx = 0, stack_idx = 0, stack[64];
+    TraversalCounter counter(shadowRay);
 
     its.t = std::numeric_limits<float>::infinity();
 
@@ -414,11 +452,23 @@ bool Accel::rayIntersect(const Ray3f &_ray, Intersection &its, bool shadowRay) c
     if (m_nodes.empty() || ray.maxt < ray.mint)
         return false;
 
+    /* Use the copy of the traversal data local to this thread's NUMA node */
+    const BVHNode *nodes = m_nodes.data();
+    const uint32_t *indices = m_indices.data();
+    const Replica *replica = nullptr;
+    int numaNode = getCurrentNumaNode();
+    if (numaNode >= 0 && numaNode < (int) m_replicas.size() && m_replicas[numaNode]) {
+        replica = m_replicas[numaNode].get();
+        nodes = replica->nodes.data();
+        indices = replica->indices.data();
+    }
+
     bool foundIntersection = false;
     uint32_t f = 0;
 
     while (true) {
-        const BVHNode &node = m_nodes[node_idx];
+        const BVHNode &node = nodes[node_idx];
+        counter.nodes++;
 
         if (!node.bbox.rayIntersect(ray)) {
             if (stack_idx == 0)
@@ -433,11 +483,16 @@ bool Accel::rayIntersect(const Ray3f &_ray, Intersection &its, bool shadowRay) c
             assert(stack_idx<64);
         } else {
             for (uint32_t i = node.start(), end = node.end(); i < end; ++i) {
-                uint32_t idx = m_indices[i];
-                const Mesh *mesh = m_meshes[findMesh(idx)];
+                uint32_t idx = indices[i];
+                uint32_t meshIdx = findMesh(idx);
+                const Mesh *mesh = m_meshes[meshIdx];
+                counter.triangles++;
 
                 float u, v, t;
-                if (mesh->rayIntersect(idx, ray, u, v, t)) {
+                bool hit = replica ?
+                    Mesh::rayIntersect(replica->positions[meshIdx], replica->triangles[meshIdx], idx, ray, u, v, t) :
+                    mesh->rayIntersect(idx, ray, u, v, t);
+                if (hit) {
                     if (shadowRay)
                         return true;
                     foundIntersection = true;
@@ -466,6 +521,8 @@ bool Accel::rayIntersect(const Ray3f &_ray, Intersection &its, bool shadowRay) c
         const MatrixXf &UV = mesh->getVertexTexCoords();
         const MatrixXu &F  = mesh->getIndices();
 
+        its.triangle = f;
+
         /* Vertex indices of the triangle */
         uint32_t idx0 = F(0, f), idx1 = F(1, f), idx2 = F(2, f);
 
@@ -2,10 +2,17 @@
 #include <nori/scene.h>
 #include <nori/mesh.h>
 #include <nori/dpdf.h>
+#include <nori/warp.h>
 #include <Eigen/Geometry>
 
 NORI_NAMESPACE_BEGIN
 
+/// Smallest solid angle of a triangle that is sampled by solid angle rather than by area
+#define NORI_AREA_MIN_SPHERICAL_ANGLE 3e-4f
+
+/// Largest solid angle of a triangle that is sampled by solid angle rather than by area
+#define NORI_AREA_MAX_SPHERICAL_ANGLE 6.22f
+
 class AreaLight : public Emitter {
 public:
     Mesh *m_mesh;
@@ -15,72 +22,126 @@ public:
         //cout << "\tAREA LIGHT CONSTRUCTOR\n";
     }
 
-    void AreaLight::activate(Mesh *m) {
+    void activate(Mesh *m) {
         m_mesh = m;
-        m_dpdf = DiscretePDF(m_mesh->getTriangleCount());
 
-        for (int i = 0; i < m->getTriangleCount(); i++) {
-            m_dpdf.append(m_mesh->surfaceArea(i));
-        }
+        // Precompute everything that sampling needs to know about the triangles
+        m_triangles.build(m_mesh, m_radiance.getLuminance());
+        m_dpdf = DiscretePDF(m_triangles.size());
+        for (size_t i = 0; i < m_triangles.size(); i++)
+            m_dpdf.append(m_triangles.area[i]);
         m_dpdf.normalize();
         //cout << "\tAREALIGHT activate\n";
     }
 
-    void AreaLight::sample(EmitQueryRecord& bRec, const Point2f& sample) {
-
-        //cout << "\tAsking AreaLight For a sample\n";
-        // Sampling proportional to the surface area
-        float triIndexSample = ((float)rand()) / RAND_MAX;
-        float triIndex = m_dpdf.sampleReuse(triIndexSample);
-        //cout << "Using index " << triIndex << " & "<< triIndexSample<<"\n";
-        // Barycentric stuff
-        float alpha = 1 - sqrt(1 - sample[0]);
-        float beta = sample[1] * sqrt(1 - sample[0]);
-
-        Vector3f baryCoord;
-        baryCoord[0] = alpha;
-        baryCoord[1] = beta;
-        baryCoord[2] = 1 - alpha - beta;
-        
-        /*
-        bRec.m_p = m_mesh->getCentroid(triIndex);
-        
-        // No idea if this works
-        for (int i = 0; i < 3; i++) {
-            bRec.m_p[i] *= baryCoord[i];
-        }*/
-
-        // POSSIBLE SOLUTION
-        bRec.m_p = Point3f();
-        for (int i = 0; i < 3; i++) {
-            bRec.m_p += baryCoord[i] * m_mesh->getVertexPositions().col(m_mesh->getIndices()(i, triIndex));
-        }
+    void sample(EmitQueryRecord& bRec, const Point2f& _sample) const {
+        // Pick a triangle proportional to its surface area. The first
+        // component is then rescaled so that it can be reused
+        Point2f sample(_sample);
+        float triPdf;
+        bRec.m_triangle = (uint32_t) m_dpdf.sampleAliasReuse(sample[0], triPdf);
+        sampleTriangle(bRec, sample);
+        bRec.m_probDensity *= triPdf;
+    }
 
-        // Adding the normal 
-        // Per vertex case
-        if (m_mesh->getVertexNormals().size() > 0) {
-            bRec.m_np = Vector3f(0, 0, 0);
-            for (int i = 0; i < 3; i++) {
-                bRec.m_np += baryCoord[i] * m_mesh->getVertexNormals().col(m_mesh->getIndices()(i, triIndex));
-            }
-        }
-        else {
-            Vector3f a = m_mesh->getVertexPositions().col(m_mesh->getIndices()(1, triIndex)) - m_mesh->getVertexPositions().col(m_mesh->getIndices()(0, triIndex));
-            Vector3f b = m_mesh->getVertexPositions().col(m_mesh->getIndices()(2, triIndex)) - m_mesh->getVertexPositions().col(m_mesh->getIndices()(1, triIndex));
-            bRec.m_np = a.cross(b);
-            for (int i = 0; i < 3; i++) {
-                bRec.m_np[i] *= baryCoord[i];
-            }
+    void sampleTriangle(EmitQueryRecord& bRec, const Point2f& sample) const {
+        uint32_t i = bRec.m_triangle;
+        Point3f p0 = m_triangles.getP0(i);
+        bRec.m_emitter = this;
+
+        Vector3f a, b, c;
+        float solidAngle = bRec.m_hasRef ? sphericalSolidAngle(i, bRec.m_ref, a, b, c) : 0.0f;
+        if (solidAngle > 0.0f) {
+            // Uniformly sample the directions towards the triangle and find
+            // the corresponding position on it
+            Vector3f w = Warp::squareToSphericalTriangle(sample, a, b, c);
+            Normal3f n = m_triangles.getNormal(i);
+            float t = n.dot(p0 - bRec.m_ref) / n.dot(w);
+            bRec.m_p = bRec.m_ref + t * w;
+            bRec.m_np = shadingNormal(i, bRec.m_p);
+            bRec.m_probDensity = std::abs(bRec.m_np.dot(w)) / (t * t * solidAngle);
+            return;
         }
 
-        bRec.m_np /= bRec.m_np.norm();
-        //cout << "\t\tGot the Sample!\n";
-        
+        // Uniform sampling by area using barycentric coordinates
+        float su = std::sqrt(1 - sample[0]);
+        float beta = sample[1] * su, gamma = su - beta;
+        bRec.m_p = Point3f(
+            p0.x() + beta * m_triangles.e1x[i] + gamma * m_triangles.e2x[i],
+            p0.y() + beta * m_triangles.e1y[i] + gamma * m_triangles.e2y[i],
+            p0.z() + beta * m_triangles.e1z[i] + gamma * m_triangles.e2z[i]);
+        bRec.m_np = shadingNormal(i, bRec.m_p);
+        bRec.m_probDensity = 1.0f / m_triangles.area[i];
+    }
+
+    Color3f eval(const EmitQueryRecord& bRec) const {
+        // Only the side that the normal points to emits light
+        if (bRec.m_np.dot(bRec.m_wo) <= 0.0f)
+            return Color3f(0.0f);
+        return m_radiance;
+    }
+
+    float pdf(const EmitQueryRecord& bRec) const {
+        return m_dpdf[bRec.m_triangle] * pdfTriangle(bRec);
+    }
+
+    float pdfTriangle(const EmitQueryRecord& bRec) const {
+        Vector3f a, b, c;
+        float solidAngle = bRec.m_hasRef ? sphericalSolidAngle(bRec.m_triangle, bRec.m_ref, a, b, c) : 0.0f;
+        if (solidAngle > 0.0f) {
+            Vector3f d = bRec.m_p - bRec.m_ref;
+            float dist2 = d.squaredNorm();
+            return std::abs(bRec.m_np.dot(d)) / (dist2 * std::sqrt(dist2) * solidAngle);
+        }
+        return 1.0f / m_triangles.area[bRec.m_triangle];
     }
 
     std::string toString() const {
         return "AreaLight[]";
     }
+
+private:
+    /**
+     * \brief Return the solid angle that a triangle subtends at \c ref, and
+     * the directions towards its corners
+     *
+     * Returns zero when the triangle should rather be sampled by area:
+     * spherical sampling is numerically unreliable for tiny (i.e. far away)
+     * triangles, where it also does not improve upon area sampling, and for
+     * triangles covering almost the whole hemisphere.
+     */
+    float sphericalSolidAngle(uint32_t i, const Point3f &ref,
+                              Vector3f &a, Vector3f &b, Vector3f &c) const {
+        Vector3f d = m_triangles.getP0(i) - ref;
+        a = d.normalized();
+        b = (d + m_triangles.getEdge1(i)).normalized();
+        c = (d + m_triangles.getEdge2(i)).normalized();
+        float solidAngle = Warp::sphericalTriangleArea(a, b, c);
+        if (!(solidAngle >= NORI_AREA_MIN_SPHERICAL_ANGLE && solidAngle <= NORI_AREA_MAX_SPHERICAL_ANGLE))
+            return 0.0f;
+        return solidAngle;
+    }
+
+    /// Return the (interpolated) surface normal at a position on a triangle
+    Normal3f shadingNormal(uint32_t index, const Point3f &p) const {
+        const MatrixXf &N = m_mesh->getVertexNormals();
+        if (N.size() == 0)
+            return m_triangles.getNormal(index);
+
+        // Barycentric coordinates of the position
+        Vector3f e1 = m_triangles.getEdge1(index), e2 = m_triangles.getEdge2(index);
+        Vector3f v = p - m_triangles.getP0(index);
+        float d00 = e1.dot(e1), d01 = e1.dot(e2), d11 = e2.dot(e2);
+        float d20 = v.dot(e1), d21 = v.dot(e2);
+        float denom = d00 * d11 - d01 * d01;
+        float beta = denom != 0.0f ? (d11 * d20 - d01 * d21) / denom : 0.0f;
+        float gamma = denom != 0.0f ? (d00 * d21 - d01 * d20) / denom : 0.0f;
+
+        const MatrixXu &F = m_mesh->getIndices();
+        Vector3f n = (1 - beta - gamma) * N.col(F(0, index)) + beta * N.col(F(1, index))
+                   + gamma * N.col(F(2, index));
+        return n.squaredNorm() > 0.0f ? Normal3f(n.normalized()) : m_triangles.getNormal(index);
+    }
 };
 NORI_REGISTER_CLASS(AreaLight, "area");
 NORI_NAMESPACE_END
\ No newline at end of file
@@ -0,0 +1,468 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/mesh.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/sampler.h>
+#include <nori/context.h>
+#include <nori/film.h>
+#include <nori/warp.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Bidirectional path tracer (Veach 1997)
+ *
+ * For every pixel sample, a camera subpath and a light subpath are traced.
+ * The light subpath starts at a position on an emitter (chosen proportional
+ * to its power) and leaves it into a cosine-weighted direction. Each pair of
+ * vertices of the two subpaths is then joined by a shadow ray, so that a
+ * path with \c k segments can be generated by several strategies, which use
+ * \c s vertices of the light subpath and \c t vertices of the camera subpath
+ * (<tt>s + t = k + 1</tt>):
+ *
+ * - <tt>s = 0</tt>: the camera subpath hits an emitter
+ * - <tt>s = 1</tt>: next event estimation using the scene's light hierarchy
+ * - <tt>t = 1</tt>: a vertex of the light subpath is connected to the camera
+ *   (light tracing). These contributions can land anywhere on the image and
+ *   are splatted into the film of the rendering context.
+ *
+ * All strategies are weighted using the power heuristic. This lets light
+ * tracing and connections from light subpaths handle caustics (e.g. light
+ * focused by glass onto a diffuse surface), which unidirectional path
+ * tracing can only find by chance.
+ *
+ * Both subpaths are terminated using Russian roulette, and paths have at
+ * most \c maxDepth segments. The path vertices are allocated in the memory
+ * arena of the rendering thread, hence tracing paths does not allocate any
+ * memory once the arena has warmed up.
+ *
+ * Light tracing contributions are summed into the shared \ref SplatFilm as
+ * the threads produce them, so the image is only reproducible up to
+ * floating point rounding.
+ */
+class BDPTIntegrator : public Integrator {
+public:
+    BDPTIntegrator(const PropertyList &props) {
+        /* Maximum number of segments of a path */
+        m_maxDepth = props.getInteger("maxDepth", 64);
+
+        if (m_maxDepth < 1)
+            throw NoriException("BDPTIntegrator: 'maxDepth' must be positive!");
+    }
+
+    bool usesSplatFilm() const { return true; }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
+        RenderContext *context = RenderContext::get();
+        if (!context || !context->getSplatFilm())
+            throw NoriException("BDPTIntegrator: light tracing requires the splat film "
+                                "of a rendering context!");
+        MemoryArena &arena = context->getArena();
+        SplatFilm *film = context->getSplatFilm();
+        const Camera *camera = scene->getCamera();
+        const LightBVH &lights = scene->getLightBVH();
+
+        PathVertex *cameraPath = arena.alloc<PathVertex>(m_maxDepth + 1);
+        PathVertex *lightPath = arena.alloc<PathVertex>(m_maxDepth);
+        int cameraCount = traceCameraPath(scene, sampler, ray, cameraPath);
+        int lightCount = traceLightPath(scene, sampler, lightPath);
+
+        Color3f result(0.0f);
+        for (int t = 2; t <= cameraCount; ++t) {
+            const PathVertex &z = cameraPath[t - 1], &zPrev = cameraPath[t - 2];
+
+            /* s = 0: emission found by the camera subpath */
+            if (z.emitter) {
+                EmitQueryRecord eRec = emitterRecord(z, zPrev.p);
+                Color3f Le = z.emitter->eval(eRec);
+                if (!Le.isZero())
+                    result += z.throughput * Le
+                        * misWeight(scene, arena, lightPath, 0, cameraPath, t, 0.0f);
+            }
+
+            if (z.delta)
+                continue;
+
+            /* s = 1: next event estimation */
+            EmitQueryRecord lRec;
+            if (t <= m_maxDepth && lights.sample(z.p, z.frame.n, lRec, sampler->next2D())) {
+                PathVertex light;
+                light.type = ELightVertex;
+                light.p = lRec.m_p;
+                light.frame = Frame(lRec.m_np);
+                light.bsdf = nullptr;
+                light.emitter = lRec.m_emitter;
+                light.triangle = lRec.m_triangle;
+                light.delta = false;
+                light.pdfFwd = scene->pdfEmitter(emitterRecord(light, z.p));
+                light.pdfRev = 0.0f;
+
+                Vector3f d = light.p - z.p;
+                float dist2 = d.squaredNorm(), dist = std::sqrt(dist2);
+                d /= dist;
+                lRec.m_wo = -d;
+                float cosLight = lRec.m_np.dot(-d);
+                Color3f Le = lRec.m_emitter->eval(lRec);
+
+                if (cosLight > 0.0f && !Le.isZero()) {
+                    Color3f f = evalBSDF(z, zPrev.p, light.p);
+                    if (!f.isZero() && visible(scene, z.p, d, dist)) {
+                        light.throughput = Le / lRec.m_probDensity;
+                        Color3f contribution = z.throughput * f * light.throughput
+                            * std::abs(z.frame.n.dot(d)) * cosLight / dist2;
+                        result += contribution * misWeight(scene, arena, &light, 1,
+                                                           cameraPath, t, lRec.m_probDensity);
+                    }
+                }
+            }
+
+            /* s >= 2: connect to a vertex of the light subpath */
+            for (int s = 2; s <= std::min(lightCount, m_maxDepth + 1 - t); ++s) {
+                const PathVertex &y = lightPath[s - 1];
+                if (y.delta)
+                    continue;
+
+                Vector3f d = y.p - z.p;
+                float dist2 = d.squaredNorm(), dist = std::sqrt(dist2);
+                d /= dist;
+                Color3f f = evalBSDF(z, zPrev.p, y.p) * evalBSDF(y, lightPath[s - 2].p, z.p);
+                if (f.isZero() || !visible(scene, z.p, d, dist))
+                    continue;
+
+                Color3f contribution = z.throughput * f * y.throughput
+                    * std::abs(z.frame.n.dot(d)) * std::abs(y.frame.n.dot(d)) / dist2;
+                result += contribution * misWeight(scene, arena, lightPath, s, cameraPath, t, 0.0f);
+            }
+        }
+
+        /* t = 1: connect the vertices of the light subpath to the camera */
+        const PathVertex &eye = cameraPath[0];
+        for (int s = 2; s <= lightCount; ++s) {
+            const PathVertex &y = lightPath[s - 1];
+            if (y.delta)
+                continue;
+
+            Vector3f d = y.p - eye.p;
+            float dist2 = d.squaredNorm(), dist = std::sqrt(dist2);
+            d /= dist;
+            Point2f position;
+            float pdf;
+            float importance = camera->evalImportance(d, position, pdf);
+            if (importance == 0.0f)
+                continue;
+
+            Color3f f = evalBSDF(y, lightPath[s - 2].p, eye.p);
+            if (f.isZero() || !visible(scene, eye.p, d, dist))
+                continue;
+
+            Color3f contribution = y.throughput * f * importance
+                * std::abs(y.frame.n.dot(d)) / dist2;
+            film->put(position, contribution * misWeight(scene, arena, lightPath, s,
+                                                         cameraPath, 1, 0.0f));
+        }
+
+        return result;
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "BDPTIntegrator[\n"
+            "  maxDepth = %i\n"
+            "]",
+            m_maxDepth
+        );
+    }
+
+private:
+    enum EVertexType {
+        ECameraVertex,
+        ELightVertex,
+        ESurfaceVertex
+    };
+
+    /// Vertex of a camera or light subpath
+    struct PathVertex {
+        EVertexType type;
+        Point3f p;
+        /// Shading frame (only the normal is used for camera and light vertices)
+        Frame frame;
+        /// BSDF of surface vertices
+        const BSDF *bsdf;
+        /// Emitter that the vertex lies on (or \c nullptr)
+        const Emitter *emitter;
+        uint32_t triangle;
+        /// Product of the sampling weights up to (and including) this vertex
+        Color3f throughput;
+        /// Density of this vertex (per unit area) when sampled by its own subpath
+        float pdfFwd;
+        /// Density of this vertex (per unit area) when sampled from the other end
+        float pdfRev;
+        /// Was the next vertex sampled from a specular BSDF?
+        bool delta;
+    };
+
+    /// Trace a camera subpath, starting with the camera itself (returns the number of vertices)
+    int traceCameraPath(const Scene *scene, Sampler *sampler, const Ray3f &ray,
+                        PathVertex *path) const {
+        PathVertex &eye = *new (&path[0]) PathVertex();
+        eye.type = ECameraVertex;
+        eye.p = ray.o;
+        eye.emitter = nullptr;
+        eye.bsdf = nullptr;
+        eye.throughput = Color3f(1.0f);
+        eye.pdfFwd = 1.0f;
+        eye.pdfRev = 0.0f;
+        eye.delta = false;
+
+        Point2f position;
+        float pdf = 0.0f;
+        scene->getCamera()->evalImportance(ray.d, position, pdf);
+        return randomWalk(scene, sampler, ray, Color3f(1.0f), pdf, path, m_maxDepth + 1, false);
+    }
+
+    /// Trace a light subpath, starting on an emitter (returns the number of vertices)
+    int traceLightPath(const Scene *scene, Sampler *sampler, PathVertex *path) const {
+        EmitQueryRecord eRec;
+        if (!scene->sampleEmitter(eRec, sampler->next2D()))
+            return 0;
+        Point2f directionSample = sampler->next2D();
+
+        PathVertex &light = *new (&path[0]) PathVertex();
+        light.type = ELightVertex;
+        light.p = eRec.m_p;
+        light.frame = Frame(eRec.m_np);
+        light.bsdf = nullptr;
+        light.emitter = eRec.m_emitter;
+        light.triangle = eRec.m_triangle;
+        light.pdfFwd = eRec.m_probDensity;
+        light.pdfRev = 0.0f;
+        light.delta = false;
+
+        /* Leave into a cosine-weighted direction */
+        Vector3f local = Warp::squareToCosineHemisphere(directionSample);
+        eRec.m_wo = light.frame.toWorld(local);
+        Color3f Le = eRec.m_emitter->eval(eRec);
+        if (Le.isZero() || eRec.m_probDensity <= 0.0f)
+            return 1;
+        light.throughput = Le / eRec.m_probDensity;
+
+        return randomWalk(scene, sampler, Ray3f(light.p, eRec.m_wo), light.throughput * M_PI,
+                          Frame::cosTheta(local) * INV_PI, path, m_maxDepth, true);
+    }
+
+    /**
+     * \brief Extend a subpath whose first vertex has been initialized
+     *
+     * \param pdf
+     *     Solid angle density of \c ray's direction
+     * \param adjoint
+     *     Is importance (rather than radiance) transported, i.e. is this a light subpath?
+     */
+    int randomWalk(const Scene *scene, Sampler *sampler, const Ray3f &_ray, Color3f throughput,
+                   float pdf, PathVertex *path, int maxCount, bool adjoint) const {
+        Ray3f ray(_ray);
+        int count = 1;
+        Intersection its;
+
+        while (count < maxCount && scene->rayIntersect(ray, its)) {
+            PathVertex &prev = path[count - 1];
+            PathVertex &vertex = *new (&path[count++]) PathVertex();
+            vertex.type = ESurfaceVertex;
+            vertex.p = its.p;
+            vertex.frame = its.shFrame;
+            vertex.bsdf = its.mesh->getBSDF();
+            vertex.emitter = its.mesh->getEmitter();
+            vertex.triangle = its.triangle;
+            vertex.throughput = throughput;
+            vertex.pdfFwd = pdf * std::abs(its.shFrame.n.dot(ray.d)) / (its.t * its.t);
+            vertex.pdfRev = 0.0f;
+            vertex.delta = !vertex.bsdf->isDiffuse();
+
+            /* Sample the next direction */
+            BSDFQueryRecord bRec(its.toLocal(-ray.d));
+            Color3f weight = vertex.bsdf->sample(bRec, sampler->next2D());
+            if (weight.isZero())
+                break;
+
+            if (vertex.delta) {
+                /* The BSDF's weight scales radiance, but not importance, by eta^2 */
+                if (adjoint)
+                    weight /= bRec.eta * bRec.eta;
+                pdf = 0.0f;
+            } else {
+                pdf = vertex.bsdf->pdf(bRec);
+
+                /* Density of sampling the previous vertex from this one */
+                BSDFQueryRecord rev(bRec.wo, bRec.wi, ESolidAngle);
+                float cosPrev = prev.type == ECameraVertex ? 1.0f
+                    : std::abs(prev.frame.n.dot(ray.d));
+                prev.pdfRev = vertex.bsdf->pdf(rev) * cosPrev / (its.t * its.t);
+            }
+
+            /* Russian roulette */
+            float prob = std::min(weight.maxCoeff(), 0.99f);
+            if (sampler->next1D() >= prob)
+                break;
+            throughput *= weight / prob;
+
+            ray = Ray3f(its.p, its.toWorld(bRec.wo));
+        }
+        return count;
+    }
+
+    /**
+     * \brief Power heuristic weight of the strategy that generated a path
+     * from \c s light and \c t camera subpath vertices
+     *
+     * The weight only depends on the ratios between the densities of the
+     * path under the different strategies, which follow from the per-vertex
+     * densities of sampling each vertex from either end. The light vertex of
+     * <tt>s = 1</tt> is sampled from the light hierarchy rather than the
+     * emission distribution; \c lightPdf is its density (if known already).
+     */
+    float misWeight(const Scene *scene, MemoryArena &arena, const PathVertex *lightPath, int s,
+                    const PathVertex *cameraPath, int t, float lightPdf) const {
+        int k = s + t - 1;
+        if (k == 1)
+            return 1.0f;
+
+        auto vertex = [&](int i) -> const PathVertex & {
+            return i < s ? lightPath[i] : cameraPath[k - i];
+        };
+
+        /* Densities of sampling each vertex from the light (pL) and camera (pE) ends */
+        float *pL = arena.alloc<float>(k + 1), *pE = arena.alloc<float>(k + 1);
+        bool *delta = arena.alloc<bool>(k + 1);
+        for (int i = 0; i <= k; ++i) {
+            const PathVertex &v = vertex(i);
+            pL[i] = i < s ? v.pdfFwd : v.pdfRev;
+            pE[i] = i < s ? v.pdfRev : v.pdfFwd;
+            delta[i] = v.delta;
+        }
+
+        /* Update the densities around the connection */
+        if (s == 0) {
+            pL[0] = scene->pdfEmitter(emitterRecord(vertex(0), vertex(1).p));
+            pL[1] = pdfEmission(vertex(0), vertex(1));
+        } else {
+            const PathVertex &a = vertex(s - 1), &b = vertex(s);
+            pE[s - 1] = pdfArea(scene, b, t >= 2 ? &vertex(s + 1) : nullptr, a);
+            if (s >= 2)
+                pE[s - 2] = pdfArea(scene, a, &b, vertex(s - 2));
+            pL[s] = s == 1 ? pdfEmission(a, b) : pdfArea(scene, a, &vertex(s - 2), b);
+            if (t >= 2)
+                pL[s + 1] = pdfArea(scene, b, &a, vertex(s + 1));
+        }
+
+        /* The ratios below assume that the light vertex is always sampled
+           by emission; 'ratio' corrects the density of strategy s = 1 */
+        if (s != 1) {
+            EmitQueryRecord eRec = emitterRecord(vertex(0), vertex(1).p);
+            lightPdf = scene->getLightBVH().pdf(vertex(1).p, vertex(1).frame.n, eRec);
+        }
+        float ratio = pL[0] > 0.0f ? lightPdf / pL[0] : 0.0f;
+        if (s == 1 && ratio == 0.0f)
+            return 1.0f;
+
+        /* Strategies connecting at specular vertices are impossible; light
+           tracing is impossible for camera rays that miss the film, and it
+           only handles paths with at least two segments */
+        auto isValid = [&](int strategy) {
+            if (strategy == 0)
+                return true;
+            if (strategy == k && pE[k - 1] == 0.0f)
+                return false;
+            return !delta[strategy - 1] && !delta[strategy];
+        };
+        auto remap = [](float pdf) { return pdf != 0.0f ? pdf : 1.0f; };
+        float sum = 0.0f;
+        auto add = [&](int strategy, float r) {
+            if (strategy == 1)
+                r *= ratio;
+            if (s == 1)
+                r /= ratio;
+            sum += r * r;
+        };
+
+        /* Strategies with more light subpath vertices */
+        float r = 1.0f;
+        for (int i = s; i < k; ++i) {
+            r *= remap(pL[i]) / remap(pE[i]);
+            if (isValid(i + 1))
+                add(i + 1, r);
+        }
+
+        /* Strategies with fewer light subpath vertices */
+        r = 1.0f;
+        for (int i = s - 1; i >= 0; --i) {
+            r *= remap(pE[i]) / remap(pL[i]);
+            if (isValid(i))
+                add(i, r);
+        }
+
+        return 1.0f / (1.0f + sum);
+    }
+
+    /// Density (per unit area) of sampling \c next from \c v, which was reached from \c prev
+    static float pdfArea(const Scene *scene, const PathVertex &v, const PathVertex *prev,
+                         const PathVertex &next) {
+        Vector3f d = next.p - v.p;
+        float dist2 = d.squaredNorm();
+        d /= std::sqrt(dist2);
+        float cosNext = next.type == ECameraVertex ? 1.0f : std::abs(next.frame.n.dot(d));
+
+        float pdf = 0.0f;
+        if (v.type == ECameraVertex) {
+            Point2f position;
+            if (scene->getCamera()->evalImportance(d, position, pdf) == 0.0f)
+                return 0.0f;
+        } else if (v.type == ESurfaceVertex && !v.delta && prev) {
+            BSDFQueryRecord bRec(v.frame.toLocal((prev->p - v.p).normalized()),
+                                 v.frame.toLocal(d), ESolidAngle);
+            pdf = v.bsdf->pdf(bRec);
+        }
+        return pdf * cosNext / dist2;
+    }
+
+    /// Density (per unit area) of the light subpath's first segment reaching \c next
+    static float pdfEmission(const PathVertex &light, const PathVertex &next) {
+        Vector3f d = next.p - light.p;
+        float dist2 = d.squaredNorm();
+        d /= std::sqrt(dist2);
+        float cosLight = light.frame.n.dot(d);
+        if (cosLight <= 0.0f)
+            return 0.0f;
+        float cosNext = next.type == ECameraVertex ? 1.0f : std::abs(next.frame.n.dot(d));
+        return cosLight * INV_PI * cosNext / dist2;
+    }
+
+    /// Return a record for evaluating the emission of a vertex toward a position
+    static EmitQueryRecord emitterRecord(const PathVertex &v, const Point3f &target) {
+        EmitQueryRecord eRec;
+        eRec.m_p = v.p;
+        eRec.m_np = v.frame.n;
+        eRec.m_wo = (target - v.p).normalized();
+        eRec.m_emitter = v.emitter;
+        eRec.m_triangle = v.triangle;
+        return eRec;
+    }
+
+    /// Evaluate the BSDF of a surface vertex for the directions toward \c a (wi) and \c b (wo)
+    static Color3f evalBSDF(const PathVertex &v, const Point3f &a, const Point3f &b) {
+        BSDFQueryRecord bRec(v.frame.toLocal((a - v.p).normalized()),
+                             v.frame.toLocal((b - v.p).normalized()), ESolidAngle);
+        return v.bsdf->eval(bRec);
+    }
+
+    /// Is the segment of length \c dist from \c p along \c d unoccluded?
+    static bool visible(const Scene *scene, const Point3f &p, const Vector3f &d, float dist) {
+        return !scene->rayIntersect(Ray3f(p, d, Epsilon, dist * (1.0f - Epsilon)));
+    }
+
+    int m_maxDepth;
+};
+
+NORI_REGISTER_CLASS(BDPTIntegrator, "bdpt");
+NORI_NAMESPACE_END
@@ -19,6 +19,7 @@
 #include <nori/bitmap.h>
 #include <ImfInputFile.h>
 #include <ImfOutputFile.h>
+#include <ImfTiledOutputFile.h>
 #include <ImfChannelList.h>
 #include <ImfStringAttribute.h>
 #include <ImfVersion.h>
@@ -133,4 +134,52 @@ void Bitmap::savePNG(const std::string &filename) {
     delete[] rgb8;
 }
 
+struct TiledEXRWriter::TiledEXRWriterPrivate {
+    std::unique_ptr<Imf::TiledOutputFile> file;
+};
+
+TiledEXRWriter::TiledEXRWriter(const std::string &filename, const Vector2i &size, int tileSize)
+        : d(new TiledEXRWriterPrivate()) {
+    cout << "Streaming a " << size.x() << "x" << size.y()
+         << " tiled OpenEXR file to \"" << filename << "\"" << endl;
+
+    Imf::Header header(size.x(), size.y());
+    header.insert("comments", Imf::StringAttribute("Generated by Nori"));
+
+    /* Tiles are written in the order in which they finish rendering */
+    header.lineOrder() = Imf::RANDOM_Y;
+    header.setTileDescription(Imf::TileDescription(tileSize, tileSize, Imf::ONE_LEVEL));
+
+    Imf::ChannelList &channels = header.channels();
+    channels.insert("R", Imf::Channel(Imf::FLOAT));
+    channels.insert("G", Imf::Channel(Imf::FLOAT));
+    channels.insert("B", Imf::Channel(Imf::FLOAT));
+
+    d->file.reset(new Imf::TiledOutputFile(filename.c_str(), header));
+}
+
+TiledEXRWriter::~TiledEXRWriter() { }
+
+void TiledEXRWriter::writeTile(int tileX, int tileY, const Bitmap &tile) {
+    Imath::Box2i range = d->file->dataWindowForTile(tileX, tileY);
+    if (range.max.x - range.min.x + 1 != tile.cols() || range.max.y - range.min.y + 1 != tile.rows())
+        throw NoriException("TiledEXRWriter::writeTile(): invalid tile size!");
+
+    size_t compStride = sizeof(float),
+           pixelStride = 3 * compStride,
+           rowStride = pixelStride * tile.cols();
+
+    /* OpenEXR addresses the frame buffer using absolute pixel coordinates */
+    char *ptr = const_cast<char *>(reinterpret_cast<const char *>(tile.data()))
+        - range.min.x * pixelStride - range.min.y * rowStride;
+
+    Imf::FrameBuffer frameBuffer;
+    frameBuffer.insert("R", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
+    frameBuffer.insert("G", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
+    frameBuffer.insert("B", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride));
+
+    d->file->setFrameBuffer(frameBuffer);
+    d->file->writeTile(tileX, tileY);
+}
+
 NORI_NAMESPACE_END
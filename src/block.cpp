@@ -20,28 +20,46 @@
 #include <nori/bitmap.h>
 #include <nori/rfilter.h>
 #include <nori/bbox.h>
+#include <nori/context.h>
 #include <tbb/tbb.h>
 
 NORI_NAMESPACE_BEGIN
 
 ImageBlock::ImageBlock(const Vector2i &size, const ReconstructionFilter *filter) 
         : m_offset(0, 0), m_size(size) {
-    if (filter) {
+    if (filter && filter->isImportanceSampled()) {
+        /* Samples are weighted by the filter when they are generated,
+           hence there is nothing to splat and no border region */
+        m_singlePixel = true;
+    } else if (filter) {
         /* Tabulate the image reconstruction filter for performance reasons */
         m_filterRadius = filter->getRadius();
         m_borderSize = (int) std::ceil(m_filterRadius - 0.5f);
-        m_filter = new float[NORI_FILTER_RESOLUTION + 1];
+        int weightSize = (int) std::ceil(2*m_filterRadius) + 1;
+
+        /* The table and the two weight arrays are only a few hundred bytes
+           in total -- keep them in one contiguous allocation so that they
+           occupy a handful of adjacent cache lines while splatting */
+        m_filterStorage = new float[NORI_FILTER_RESOLUTION + 1 + 2*weightSize];
+        m_filter = m_filterStorage;
+        m_weightsX = m_filter + NORI_FILTER_RESOLUTION + 1;
+        m_weightsY = m_weightsX + weightSize;
+
         for (int i=0; i<NORI_FILTER_RESOLUTION; ++i) {
             float pos = (m_filterRadius * i) / NORI_FILTER_RESOLUTION;
             m_filter[i] = filter->eval(pos);
         }
         m_filter[NORI_FILTER_RESOLUTION] = 0.0f;
         m_lookupFactor = NORI_FILTER_RESOLUTION / m_filterRadius;
-        int weightSize = (int) std::ceil(2*m_filterRadius) + 1;
-        m_weightsX = new float[weightSize];
-        m_weightsY = new float[weightSize];
         memset(m_weightsX, 0, sizeof(float) * weightSize);
         memset(m_weightsY, 0, sizeof(float) * weightSize);
+
+        /* A constant filter with a radius of half a pixel assigns every
+           sample to exactly the pixel containing it. The weight is the
+           same for all samples and cancels out during normalization. */
+        m_singlePixel = m_filterRadius == 0.5f && m_filter[0] > 0;
+        for (int i=1; i<NORI_FILTER_RESOLUTION; ++i)
+            m_singlePixel &= m_filter[i] == m_filter[0];
     }
 
     /* Allocate space for pixels and border regions */
@@ -49,9 +67,7 @@ ImageBlock::ImageBlock(const Vector2i &size, const ReconstructionFilter *filter)
 }
 
 ImageBlock::~ImageBlock() {
-    delete[] m_filter;
-    delete[] m_weightsX;
-    delete[] m_weightsY;
+    delete[] m_filterStorage;
 }
 
 Bitmap *ImageBlock::toBitmap() const {
@@ -71,10 +87,33 @@ void ImageBlock::fromBitmap(const Bitmap &bitmap) {
             coeffRef(y, x) << bitmap.coeff(y, x), 1;
 }
 
-void ImageBlock::put(const Point2f &_pos, const Color3f &value) {
+bool ImageBlock::prepareSample(const Color3f &value, float weight, Color4f &weighted) const {
     if (!value.isValid()) {
-        /* If this happens, go fix your code instead of removing this warning ;) */
-        cerr << "Integrator: computed an invalid radiance value: " << value.toString() << endl;
+        /* If this happens, go fix your code instead of removing this warning ;)
+           The samples are counted (and reported at the end of the render)
+           rather than printed, which would serialize all threads. */
+        if (RenderContext *context = RenderContext::get())
+            context->getStatistics().invalidSamples++;
+        return false;
+    }
+    weighted = Color4f(value) * weight;
+    return true;
+}
+
+Eigen::Index ImageBlock::pixelIndex(const Point2f &pos) const {
+    /* There is no border region in single-pixel mode */
+    int x = clamp((int) std::floor(pos.x()) - m_offset.x(), 0, (int) cols() - 1);
+    int y = clamp((int) std::floor(pos.y()) - m_offset.y(), 0, (int) rows() - 1);
+    return (Eigen::Index) y * cols() + x;
+}
+
+void ImageBlock::put(const Point2f &_pos, const Color3f &value, float weight) {
+    Color4f weighted;
+    if (!prepareSample(value, weight, weighted))
+        return;
+
+    if (m_singlePixel) {
+        data()[pixelIndex(_pos)] += weighted;
         return;
     }
 
@@ -85,21 +124,58 @@ void ImageBlock::put(const Point2f &_pos, const Color3f &value) {
     );
 
     /* Compute the rectangle of pixels that will need to be updated */
-    BoundingBox2i bbox(
-        Point2i((int)  std::ceil(pos.x() - m_filterRadius), (int)  std::ceil(pos.y() - m_filterRadius)),
-        Point2i((int) std::floor(pos.x() + m_filterRadius), (int) std::floor(pos.y() + m_filterRadius))
-    );
-    bbox.clip(BoundingBox2i(Point2i(0, 0), Point2i((int) cols() - 1, (int) rows() - 1)));
+    int xStart = std::max((int) std::ceil(pos.x() - m_filterRadius), 0),
+        yStart = std::max((int) std::ceil(pos.y() - m_filterRadius), 0),
+        xEnd   = std::min((int) std::floor(pos.x() + m_filterRadius), (int) cols() - 1),
+        yEnd   = std::min((int) std::floor(pos.y() + m_filterRadius), (int) rows() - 1);
 
     /* Lookup values from the pre-rasterized filter */
-    for (int x=bbox.min.x(), idx = 0; x<=bbox.max.x(); ++x)
+    for (int x=xStart, idx = 0; x<=xEnd; ++x)
         m_weightsX[idx++] = m_filter[(int) (std::abs(x-pos.x()) * m_lookupFactor)];
-    for (int y=bbox.min.y(), idx = 0; y<=bbox.max.y(); ++y)
+    for (int y=yStart, idx = 0; y<=yEnd; ++y)
         m_weightsY[idx++] = m_filter[(int) (std::abs(y-pos.y()) * m_lookupFactor)];
 
-    for (int y=bbox.min.y(), yr=0; y<=bbox.max.y(); ++y, ++yr) 
-        for (int x=bbox.min.x(), xr=0; x<=bbox.max.x(); ++x, ++xr) 
-            coeffRef(y, x) += Color4f(value) * m_weightsX[xr] * m_weightsY[yr];
+    /* The filter is separable: scale the sample by the row weight once,
+       then each pixel only needs a single 4-wide multiply-add */
+    Eigen::Index stride = cols();
+    Color4f *row = data() + yStart * stride + xStart;
+    for (int yr=0; yr<=yEnd-yStart; ++yr, row += stride) {
+        Color4f rowValue = weighted * m_weightsY[yr];
+        for (int xr=0; xr<=xEnd-xStart; ++xr)
+            row[xr] += rowValue * m_weightsX[xr];
+    }
+}
+
+void ImageBlock::put(const Point2f *pos, const Color3f *values,
+                     const float *weights, size_t count) {
+    if (!m_singlePixel) {
+        for (size_t i=0; i<count; ++i)
+            put(pos[i], values[i], weights[i]);
+        return;
+    }
+
+    /* Sum up runs of samples that land in the same pixel. The sum starts
+       from the pixel's current value, so that the result is bit-identical
+       to adding the samples one at a time -- no matter where a batch ends */
+    Eigen::Index current = -1;
+    Color4f sum;
+    for (size_t i=0; i<count; ++i) {
+        Color4f weighted;
+        if (!prepareSample(values[i], weights[i], weighted))
+            continue;
+
+        Eigen::Index index = pixelIndex(pos[i]);
+        if (index == current) {
+            sum += weighted;
+            continue;
+        }
+        if (current >= 0)
+            data()[current] = sum;
+        current = index;
+        sum = data()[index] + weighted;
+    }
+    if (current >= 0)
+        data()[current] = sum;
 }
     
 void ImageBlock::put(ImageBlock &b) {
@@ -118,8 +194,8 @@ std::string ImageBlock::toString() const {
         m_offset.toString(), m_size.toString());
 }
 
-BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize)
-        : m_size(size), m_blockSize(blockSize) {
+BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize, const Point2i &offset)
+        : m_offset(offset), m_size(size), m_blockSize(blockSize) {
     m_numBlocks = Vector2i(
         (int) std::ceil(size.x() / (float) blockSize),
         (int) std::ceil(size.y() / (float) blockSize));
@@ -130,14 +206,17 @@ BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize)
     m_numSteps = 1;
 }
 
-bool BlockGenerator::next(ImageBlock &block) {
+bool BlockGenerator::next(ImageBlock &block, int *index) {
     tbb::mutex::scoped_lock lock(m_mutex);
 
     if (m_blocksLeft == 0)
         return false;
 
+    if (index)
+        *index = m_numBlocks.x() * m_numBlocks.y() - m_blocksLeft;
+
     Point2i pos = m_block * m_blockSize;
-    block.setOffset(pos);
+    block.setOffset(m_offset + pos);
     block.setSize((m_size - pos).cwiseMin(Vector2i::Constant(m_blockSize)));
 
     if (--m_blocksLeft == 0)
@@ -0,0 +1,124 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/checkpoint.h>
+#include <cstdio>
+#include <fstream>
+
+NORI_NAMESPACE_BEGIN
+
+#define NORI_CHECKPOINT_MAGIC    0x4B434E4E /* "NNCK" */
+#define NORI_CHECKPOINT_VERSION  2
+
+/* File header, followed by the film (rows x cols Color4f values) and the
+   per-pixel sample counts (height x width uint32_t values) */
+struct CheckpointHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t offsetX, offsetY;
+    int32_t width, height;
+    int32_t filmCols, filmRows;
+    uint32_t samplesPerPass;
+    uint32_t pass;
+};
+
+RenderCheckpoint::RenderCheckpoint(const Point2i &offset, const Vector2i &size,
+                                   uint32_t samplesPerPass)
+    : m_offset(offset), m_size(size), m_samplesPerPass(samplesPerPass),
+      m_counts((size_t) size.x() * size.y(), 0) { }
+
+void RenderCheckpoint::addBlock(const ImageBlock &block) {
+    Point2i offset = block.getOffset() - m_offset;
+    const Vector2i &size = block.getSize();
+    for (int y = offset.y(); y < offset.y() + size.y(); ++y)
+        for (int x = offset.x(); x < offset.x() + size.x(); ++x)
+            m_counts[y * m_size.x() + x] += m_samplesPerPass;
+}
+
+bool RenderCheckpoint::isComplete(const ImageBlock &block) const {
+    Point2i offset = block.getOffset() - m_offset;
+    const Vector2i &size = block.getSize();
+    uint32_t target = (m_pass + 1) * m_samplesPerPass;
+    for (int y = offset.y(); y < offset.y() + size.y(); ++y)
+        for (int x = offset.x(); x < offset.x() + size.x(); ++x)
+            if (m_counts[y * m_size.x() + x] < target)
+                return false;
+    return true;
+}
+
+void RenderCheckpoint::save(const std::string &filename, const ImageBlock &film) const {
+    CheckpointHeader header;
+    header.magic = NORI_CHECKPOINT_MAGIC;
+    header.version = NORI_CHECKPOINT_VERSION;
+    header.offsetX = m_offset.x();
+    header.offsetY = m_offset.y();
+    header.width = m_size.x();
+    header.height = m_size.y();
+    header.filmCols = (int32_t) film.cols();
+    header.filmRows = (int32_t) film.rows();
+    header.samplesPerPass = m_samplesPerPass;
+    header.pass = m_pass;
+
+    std::string tempName = filename + ".tmp";
+    {
+        std::ofstream os(tempName, std::ios::binary);
+        os.write((const char *) &header, sizeof(header));
+        os.write((const char *) film.data(), sizeof(Color4f) * film.size());
+        os.write((const char *) m_counts.data(), sizeof(uint32_t) * m_counts.size());
+        if (!os)
+            throw NoriException("RenderCheckpoint::save(): unable to write \"%s\"", tempName);
+    }
+
+#if defined(_WIN32)
+    /* rename() does not replace existing files on Windows */
+    std::remove(filename.c_str());
+#endif
+    if (std::rename(tempName.c_str(), filename.c_str()) != 0)
+        throw NoriException("RenderCheckpoint::save(): unable to rename \"%s\"", tempName);
+}
+
+void RenderCheckpoint::load(const std::string &filename, ImageBlock &film) {
+    std::ifstream is(filename, std::ios::binary);
+    if (!is)
+        throw NoriException("RenderCheckpoint::load(): unable to open \"%s\"", filename);
+
+    CheckpointHeader header;
+    is.read((char *) &header, sizeof(header));
+    if (!is || header.magic != NORI_CHECKPOINT_MAGIC || header.version != NORI_CHECKPOINT_VERSION)
+        throw NoriException("RenderCheckpoint::load(): \"%s\" is not a valid checkpoint", filename);
+
+    if (header.offsetX != m_offset.x() || header.offsetY != m_offset.y() ||
+        header.width != m_size.x() || header.height != m_size.y() ||
+        header.filmCols != film.cols() || header.filmRows != film.rows())
+        throw NoriException("RenderCheckpoint::load(): \"%s\" was created for a different "
+                            "image size, crop window or reconstruction filter", filename);
+
+    if (header.samplesPerPass != m_samplesPerPass)
+        throw NoriException("RenderCheckpoint::load(): \"%s\" was rendered with %i samples "
+                            "per pass, but the sampler is configured to take %i",
+                            filename, header.samplesPerPass, m_samplesPerPass);
+
+    is.read((char *) film.data(), sizeof(Color4f) * film.size());
+    is.read((char *) m_counts.data(), sizeof(uint32_t) * m_counts.size());
+    if (!is)
+        throw NoriException("RenderCheckpoint::load(): \"%s\" is truncated", filename);
+
+    m_pass = header.pass;
+}
+
+NORI_NAMESPACE_END
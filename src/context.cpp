@@ -0,0 +1,296 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/context.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/integrator.h>
+#include <nori/rfilter.h>
+#include <nori/timer.h>
+#include <nori/bsdf.h>
+#include <fstream>
+
+NORI_NAMESPACE_BEGIN
+
+/* Context of the calling thread (if it is currently rendering) */
+static thread_local RenderContext *t_context = nullptr;
+
+MemoryArena::~MemoryArena() {
+    for (auto &chunk : m_chunks)
+        delete[] chunk.data;
+}
+
+void *MemoryArena::alloc(size_t size) {
+    /* Round up to a multiple of 16 bytes to keep subsequent allocations aligned */
+    size = (size + 15) & ~((size_t) 15);
+
+    while (m_chunk < m_chunks.size()) {
+        Chunk &chunk = m_chunks[m_chunk];
+        if (m_offset + size <= chunk.size) {
+            void *ptr = chunk.data + m_offset;
+            m_offset += size;
+            return ptr;
+        }
+        /* Does not fit -- continue with the next chunk */
+        ++m_chunk;
+        m_offset = 0;
+    }
+
+    /* Out of memory: allocate a new chunk (only happens while warming up) */
+    Chunk chunk;
+    chunk.size = std::max(size, m_chunkSize);
+    chunk.data = new uint8_t[chunk.size];
+    m_chunks.push_back(chunk);
+    m_chunk = m_chunks.size() - 1;
+    m_offset = size;
+    return chunk.data;
+}
+
+size_t MemoryArena::getCapacity() const {
+    size_t result = 0;
+    for (auto &chunk : m_chunks)
+        result += chunk.size;
+    return result;
+}
+
+RenderContext::RenderContext(const Scene *scene, SplatFilm *splatFilm)
+    : m_block(Vector2i(NORI_BLOCK_SIZE), scene->getCamera()->getReconstructionFilter()),
+      m_sampler(scene->getSampler()->clone()), m_splatFilm(splatFilm) { }
+
+RenderContext *RenderContext::get() {
+    return t_context;
+}
+
+RenderContext::Scope::Scope(RenderContext &context) : m_previous(t_context) {
+    t_context = &context;
+}
+
+RenderContext::Scope::~Scope() {
+    t_context = m_previous;
+}
+
+Color3f sampleCameraRay(const Scene *scene, Sampler *sampler, const Point2i &pixel,
+                        Ray3f &ray, Point2f &position, float &weight) {
+    const Camera *camera = scene->getCamera();
+
+    /* Importance sample the reconstruction filter instead of splatting? */
+    const ReconstructionFilter *filter = camera->getReconstructionFilter();
+    Point2f pixelCenter((float) pixel.x() + 0.5f, (float) pixel.y() + 0.5f);
+    Point2f pixelSample, filterOffset;
+    weight = 1.0f;
+    if (filter->isImportanceSampled()) {
+        weight = filter->sample(sampler->next2D(), filterOffset);
+        pixelSample = pixelCenter + filterOffset;
+        /* Importance sampled filters record the sample in the current pixel only */
+        position = pixelCenter;
+    } else {
+        pixelSample = Point2f((float) pixel.x(), (float) pixel.y()) + sampler->next2D();
+        position = pixelSample;
+    }
+    Point2f apertureSample = sampler->next2D();
+
+    /* Sample a ray from the camera */
+    return camera->sampleRay(ray, pixelSample, apertureSample);
+}
+
+bool traceToDiffuse(const Scene *scene, Sampler *sampler, Ray3f &ray, Intersection &its,
+                    Color3f &throughput, Color3f &emitted, int maxBounces) {
+    for (int bounces = 0; scene->rayIntersect(ray, its); ++bounces) {
+        /* Emission seen directly or through specular surfaces */
+        if (const Emitter *emitter = its.mesh->getEmitter()) {
+            EmitQueryRecord eRec;
+            eRec.m_p = its.p;
+            eRec.m_np = its.shFrame.n;
+            eRec.m_wo = -ray.d;
+            eRec.m_emitter = emitter;
+            eRec.m_triangle = its.triangle;
+            emitted += throughput * emitter->eval(eRec);
+        }
+
+        const BSDF *bsdf = its.mesh->getBSDF();
+        if (bsdf->isDiffuse())
+            return true;
+        if (bounces == maxBounces)
+            break;
+
+        /* Follow the specular surface (with Russian roulette) */
+        BSDFQueryRecord bRec(its.toLocal(-ray.d));
+        Color3f f = bsdf->sample(bRec, sampler->next2D());
+        float prob = std::min(f.maxCoeff(), 0.99f);
+        if (f.isZero() || sampler->next1D() >= prob)
+            break;
+        throughput *= f / prob;
+        ray = Ray3f(its.p, its.toWorld(bRec.wo));
+    }
+    return false;
+}
+
+Color3f sampleDirectLight(const Scene *scene, Sampler *sampler, const Intersection &its,
+                          const BSDF *bsdf, const Vector3f &wi) {
+    EmitQueryRecord lRec;
+    if (!scene->getLightBVH().sample(its.p, its.shFrame.n, lRec, sampler->next2D()))
+        return Color3f(0.0f);
+
+    Vector3f d = lRec.m_p - its.p;
+    float dist2 = d.squaredNorm(), dist = std::sqrt(dist2);
+    d /= dist;
+    lRec.m_wo = -d;
+    float cosLight = lRec.m_np.dot(-d);
+    Color3f Le = lRec.m_emitter->eval(lRec);
+    if (cosLight <= 0.0f || Le.isZero())
+        return Color3f(0.0f);
+
+    BSDFQueryRecord bRec(wi, its.toLocal(d), ESolidAngle);
+    Color3f f = bsdf->eval(bRec);
+    if (f.isZero() || scene->rayIntersect(Ray3f(its.p, d, Epsilon, dist * (1.0f - Epsilon))))
+        return Color3f(0.0f);
+
+    return f * Le * std::abs(Frame::cosTheta(bRec.wo)) * cosLight
+        / (lRec.m_probDensity * dist2);
+}
+
+void renderBlock(const Scene *scene, RenderContext &context) {
+    const Integrator *integrator = scene->getIntegrator();
+    ImageBlock &block = context.getBlock();
+    Timer timer;
+    Sampler *sampler = context.getSampler();
+    SampleBuffer &samples = context.getSampleBuffer();
+    MemoryArena &arena = context.getArena();
+
+    Point2i offset = block.getOffset();
+    Vector2i size  = block.getSize();
+
+    /* Clear the block contents */
+    block.clear();
+
+    /* For each pixel and pixel sample sample (unless the integrator
+       renders the whole block at once) */
+    if (!integrator->renderBlock(scene, context)) {
+        for (int y=0; y<size.y(); ++y) {
+            for (int x=0; x<size.x(); ++x) {
+                for (uint32_t i=0; i<sampler->getSampleCount(); ++i) {
+                    Point2i pixel(x + offset.x(), y + offset.y());
+                    sampler->startSample(pixel, i);
+
+                    /* Sample a ray from the camera */
+                    Ray3f ray;
+                    Point2f position;
+                    float weight;
+                    Color3f value = sampleCameraRay(scene, sampler, pixel, ray, position, weight);
+
+                    /* Compute the incident radiance */
+                    value *= integrator->Li(scene, sampler, ray);
+
+                    /* Stage for storage in the image block */
+                    samples.put(block, position, value, weight);
+
+                    /* Scratch memory only lives for the duration of one sample */
+                    arena.reset();
+                }
+            }
+
+            /* Splat the samples of this row */
+            samples.flush(block);
+        }
+    }
+
+    RenderStatistics &stats = context.getStatistics();
+    stats.blocks++;
+    stats.samples += (uint64_t) size.x() * size.y() * sampler->getSampleCount();
+    stats.renderTime += timer.elapsed() * 1e-3;
+}
+
+void writeStatisticsReport(const std::string &filename,
+                           const std::vector<RenderStatistics> &threads,
+                           double elapsed,
+                           const std::vector<RenderStatistics> &nodes) {
+    RenderStatistics total;
+    double minTime = std::numeric_limits<double>::infinity(), maxTime = 0;
+    uint64_t minBlocks = std::numeric_limits<uint64_t>::max(), maxBlocks = 0;
+    for (const RenderStatistics &stats : threads) {
+        total += stats;
+        minTime = std::min(minTime, stats.renderTime);
+        maxTime = std::max(maxTime, stats.renderTime);
+        minBlocks = std::min(minBlocks, stats.blocks);
+        maxBlocks = std::max(maxBlocks, stats.blocks);
+    }
+    if (threads.empty()) {
+        minTime = 0;
+        minBlocks = 0;
+    }
+
+    /* Avoid divisions by zero (JSON has no representation for inf/NaN) */
+    auto ratio = [](double a, double b) { return b > 0 ? a / b : 0.0; };
+    size_t threadCount = threads.size();
+    double meanTime = ratio(total.renderTime, (double) threadCount);
+    double raysPerSecond = ratio((double) total.getRayCount(), elapsed);
+
+    std::ofstream os(filename);
+    os << "{" << endl
+       << "  \"elapsedSeconds\": " << elapsed << "," << endl
+       << "  \"threads\": " << threadCount << "," << endl
+       << "  \"blocks\": " << total.blocks << "," << endl
+       << "  \"cameraRays\": " << total.samples << "," << endl
+       << "  \"closestHitRays\": " << total.closestHitRays << "," << endl
+       << "  \"shadowRays\": " << total.shadowRays << "," << endl
+       << "  \"bvhNodesVisited\": " << total.nodesVisited << "," << endl
+       << "  \"trianglesTested\": " << total.trianglesTested << "," << endl
+       << "  \"invalidSamples\": " << total.invalidSamples << "," << endl
+       << "  \"raysPerSecond\": " << raysPerSecond << "," << endl
+       << "  \"mraysPerSecondPerCore\": " << ratio(raysPerSecond * 1e-6, (double) threadCount) << "," << endl
+       << "  \"samplesPerSecond\": " << ratio((double) total.samples, elapsed) << "," << endl
+       << "  \"nodesPerRay\": " << ratio((double) total.nodesVisited, (double) total.getRayCount()) << "," << endl
+       << "  \"trianglesPerRay\": " << ratio((double) total.trianglesTested, (double) total.getRayCount()) << "," << endl
+       << "  \"loadBalance\": {" << endl
+       << "    \"minBusySeconds\": " << minTime << "," << endl
+       << "    \"meanBusySeconds\": " << meanTime << "," << endl
+       << "    \"maxBusySeconds\": " << maxTime << "," << endl
+       << "    \"efficiency\": " << ratio(meanTime, maxTime) << "," << endl
+       << "    \"utilization\": " << ratio(total.renderTime, elapsed * (double) threadCount) << "," << endl
+       << "    \"minBlocks\": " << minBlocks << "," << endl
+       << "    \"maxBlocks\": " << maxBlocks << endl
+       << "  }," << endl
+       << "  \"perThread\": [" << endl;
+    for (size_t i = 0; i < threadCount; ++i) {
+        const RenderStatistics &stats = threads[i];
+        os << "    { \"blocks\": " << stats.blocks
+           << ", \"cameraRays\": " << stats.samples
+           << ", \"rays\": " << stats.getRayCount()
+           << ", \"busySeconds\": " << stats.renderTime << " }"
+           << (i + 1 < threadCount ? "," : "") << endl;
+    }
+    os << "  ]";
+    if (!nodes.empty()) {
+        os << "," << endl << "  \"numaNodes\": [" << endl;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const RenderStatistics &stats = nodes[i];
+            os << "    { \"blocks\": " << stats.blocks
+               << ", \"rays\": " << stats.getRayCount()
+               << ", \"raysPerSecond\": " << ratio((double) stats.getRayCount(), elapsed)
+               << ", \"busySeconds\": " << stats.renderTime << " }"
+               << (i + 1 < nodes.size() ? "," : "") << endl;
+        }
+        os << "  ]";
+    }
+    os << endl << "}" << endl;
+
+    if (!os)
+        throw NoriException("writeStatisticsReport(): unable to write \"%s\"", filename);
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,290 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/distributed.h>
+#include <nori/network.h>
+#include <nori/context.h>
+#include <nori/film.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/timer.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/task_group.h>
+#include <algorithm>
+#include <cstring>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+NORI_NAMESPACE_BEGIN
+
+/* Protocol version -- bump whenever one of the messages below changes */
+#define NORI_PROTOCOL_MAGIC    0x49524F4E /* "NORI" */
+#define NORI_PROTOCOL_VERSION  2
+
+/// Sent by a worker after connecting
+struct HelloMessage {
+    uint32_t magic;
+    uint32_t version;
+    /// Number of cores available to the worker
+    uint32_t threads;
+    /// Output size of the worker's scene (must match the coordinator's)
+    int32_t width, height;
+    /// Index of the camera rendered by the worker (must match the coordinator's)
+    uint32_t camera;
+};
+
+/// Sent by the coordinator to assign a tile (or to end the session)
+struct TileMessage {
+    /// Tile index, or -1 to tell the worker that the frame is done
+    int32_t index;
+    int32_t offsetX, offsetY;
+    int32_t sizeX, sizeY;
+};
+
+/// Sent by a worker, followed by width*height Color4f values (row-major)
+struct ResultMessage {
+    int32_t index;
+    /// Dimensions of the transmitted block including its border
+    int32_t width, height;
+};
+
+void renderCoordinator(const Scene *scene, int port, float timeout,
+                       ImageBlock &result) {
+    const ReconstructionFilter *filter = scene->getCamera()->getReconstructionFilter();
+    Vector2i outputSize = scene->getCamera()->getOutputSize();
+    uint32_t camera = (uint32_t) scene->getActiveCamera();
+
+    /* Enumerate all tiles of the region covered by 'result' up front (in the
+       usual spiral order), so that tiles of failed workers can be handed out again */
+    std::vector<TileMessage> tiles;
+    {
+        BlockGenerator generator(result.getSize(), NORI_BLOCK_SIZE, result.getOffset());
+        ImageBlock block(Vector2i(NORI_BLOCK_SIZE), nullptr);
+        while (generator.next(block)) {
+            TileMessage tile;
+            tile.index = (int32_t) tiles.size();
+            tile.offsetX = block.getOffset().x(); tile.offsetY = block.getOffset().y();
+            tile.sizeX = block.getSize().x(); tile.sizeY = block.getSize().y();
+            tiles.push_back(tile);
+        }
+    }
+
+    std::mutex mutex;
+    std::deque<int32_t> pending;
+    for (const TileMessage &tile : tiles)
+        pending.push_back(tile.index);
+    std::atomic<int> remaining((int) tiles.size());
+
+    /* Merge tiles in their original order, exactly like a local render */
+    OrderedBlockMerger merger(filter, [&](ImageBlock &block) { result.put(block); });
+
+    /* Serves a single worker connection until the frame is done or the
+       worker fails (in which case its tiles are put back into the queue) */
+    auto serve = [&](Socket socket) {
+        std::vector<int32_t> assigned;
+        ImageBlock block(Vector2i(NORI_BLOCK_SIZE), filter);
+        int border = block.getBorderSize(), rendered = 0;
+
+        try {
+            HelloMessage hello;
+            if (!socket.receive(&hello, sizeof(hello)))
+                throw NoriException("connection closed during handshake");
+            if (hello.magic != NORI_PROTOCOL_MAGIC || hello.version != NORI_PROTOCOL_VERSION)
+                throw NoriException("incompatible protocol version");
+            if (hello.width != outputSize.x() || hello.height != outputSize.y())
+                throw NoriException("worker renders a different scene (output size %ix%i)",
+                                    hello.width, hello.height);
+            if (hello.camera != camera)
+                throw NoriException("worker renders camera %i instead of camera %i "
+                                    "(select it using --camera)", hello.camera, camera);
+
+            /* Keep enough tiles in flight to saturate all of the worker's cores */
+            size_t window = 2 * (size_t) std::max(hello.threads, 1u);
+
+            while (true) {
+                size_t first = assigned.size();
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    while (assigned.size() < window && !pending.empty()) {
+                        assigned.push_back(pending.front());
+                        pending.pop_front();
+                    }
+                }
+                for (size_t i = first; i < assigned.size(); ++i)
+                    socket.send(&tiles[assigned[i]], sizeof(TileMessage));
+
+                if (assigned.empty()) {
+                    if (remaining == 0)
+                        break;
+                    /* Nothing to do right now, but tiles of another
+                       worker might still be reassigned to this one */
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    continue;
+                }
+
+                if (!socket.waitReadable(timeout))
+                    throw NoriException("no tile received within %f seconds", timeout);
+
+                ResultMessage header;
+                if (!socket.receive(&header, sizeof(header)))
+                    throw NoriException("connection closed");
+
+                auto it = std::find(assigned.begin(), assigned.end(), header.index);
+                if (it == assigned.end())
+                    throw NoriException("received tile %i, which was not assigned", header.index);
+                const TileMessage &tile = tiles[header.index];
+                if (header.width != tile.sizeX + 2 * border || header.height != tile.sizeY + 2 * border)
+                    throw NoriException("received tile %i with unexpected size", header.index);
+
+                /* Receive the block contents directly into its storage */
+                block.setOffset(Point2i(tile.offsetX, tile.offsetY));
+                block.setSize(Vector2i(tile.sizeX, tile.sizeY));
+                for (int y = 0; y < header.height; ++y)
+                    if (!socket.receive(block.data() + y * block.cols(), sizeof(Color4f) * header.width))
+                        throw NoriException("connection closed");
+
+                merger.put(header.index, block);
+                assigned.erase(it);
+                --remaining;
+                ++rendered;
+            }
+
+            /* Release the worker */
+            TileMessage done;
+            memset(&done, 0, sizeof(done));
+            done.index = -1;
+            socket.send(&done, sizeof(done));
+            cout << "Worker " << socket.getPeerName() << " finished (rendered "
+                 << rendered << " tiles)" << endl;
+        } catch (const std::exception &e) {
+            std::lock_guard<std::mutex> lock(mutex);
+            cerr << "Worker " << socket.getPeerName() << " failed: " << e.what()
+                 << " -- reassigning " << assigned.size() << " tiles" << endl;
+            pending.insert(pending.begin(), assigned.begin(), assigned.end());
+        }
+    };
+
+    Socket listener = Socket::listen(port);
+    cout << "Waiting for workers on port " << port << " (" << tiles.size()
+         << " tiles) .. " << endl;
+    Timer timer;
+
+    std::vector<std::thread> threads;
+    while (remaining > 0) {
+        /* Poll, so that the loop notices when the frame is complete */
+        if (!listener.waitReadable(0.25))
+            continue;
+        Socket socket = listener.accept();
+        cout << "Worker " << socket.getPeerName() << " connected" << endl;
+        threads.emplace_back(serve, std::move(socket));
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    cout << "Distributed rendering done. (took " << timer.elapsedString() << ", "
+         << threads.size() << " workers)" << endl;
+}
+
+void renderWorker(const Scene *scene, const std::string &host, int port) {
+    Socket socket = Socket::connect(host, port);
+
+    HelloMessage hello;
+    hello.magic = NORI_PROTOCOL_MAGIC;
+    hello.version = NORI_PROTOCOL_VERSION;
+    hello.threads = std::max(std::thread::hardware_concurrency(), 1u);
+    hello.width = scene->getCamera()->getOutputSize().x();
+    hello.height = scene->getCamera()->getOutputSize().y();
+    hello.camera = (uint32_t) scene->getActiveCamera();
+    socket.send(&hello, sizeof(hello));
+
+    cout << "Connected to coordinator " << socket.getPeerName() << endl;
+    Timer timer;
+
+    /* Per-thread rendering state, shared by all tiles of the session */
+    tbb::enumerable_thread_specific<RenderContext> contexts(scene);
+    tbb::task_group group;
+    std::mutex sendMutex;
+    std::atomic<int> rendered(0);
+
+    try {
+        while (true) {
+            TileMessage tile;
+            if (!socket.receive(&tile, sizeof(tile)))
+                throw NoriException("renderWorker(): the coordinator closed the connection");
+            if (tile.index < 0)
+                break;
+
+            group.run([&, tile] {
+                RenderContext &context = contexts.local();
+                RenderContext::Scope scope(context);
+                ImageBlock &block = context.getBlock();
+
+                block.setOffset(Point2i(tile.offsetX, tile.offsetY));
+                block.setSize(Vector2i(tile.sizeX, tile.sizeY));
+                context.getSampler()->prepare(block, 0);
+                renderBlock(scene, context);
+
+                /* Pack the block (including its border) into one buffer */
+                ResultMessage header;
+                header.index = tile.index;
+                header.width = tile.sizeX + 2 * block.getBorderSize();
+                header.height = tile.sizeY + 2 * block.getBorderSize();
+
+                MemoryArena &arena = context.getArena();
+                Color4f *data = arena.alloc<Color4f>((size_t) header.width * header.height);
+                for (int y = 0; y < header.height; ++y) {
+                    const Color4f *row = block.data() + y * block.cols();
+                    std::copy(row, row + header.width, data + y * header.width);
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(sendMutex);
+                    socket.send(&header, sizeof(header));
+                    socket.send(data, sizeof(Color4f) * header.width * header.height);
+                }
+                arena.reset();
+                ++rendered;
+            });
+        }
+    } catch (...) {
+        /* Don't leave tasks running that reference this stack frame */
+        group.cancel();
+        group.wait();
+        throw;
+    }
+
+    /* The coordinator only ends the session once all results have arrived */
+    group.wait();
+
+    RenderStatistics stats;
+    for (const RenderContext &context : contexts)
+        stats += context.getStatistics();
+
+    cout << "Frame complete. (rendered " << rendered << " tiles in "
+         << timer.elapsedString() << ", "
+         << tfm::format("%.2f", stats.getRayCount() / std::max(timer.elapsed() * 1e-3, 1e-3) * 1e-6)
+         << " Mrays/s)" << endl;
+    if (stats.invalidSamples > 0)
+        cerr << "Warning: the integrator computed " << stats.invalidSamples
+             << " invalid radiance values, which were discarded" << endl;
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,111 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/dpdf.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Distributions with at least this many entries are normalized in parallel
+#define NORI_DPDF_PARALLEL_SIZE 65536
+
+/// Number of entries processed by each parallel task
+#define NORI_DPDF_GRAIN_SIZE 8192
+
+/* Run func(begin, end) over the range [0, size), in parallel for large sizes */
+template <typename Func> static void forEachRange(size_t size, const Func &func) {
+    if (size < NORI_DPDF_PARALLEL_SIZE) {
+        func((size_t) 0, size);
+        return;
+    }
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, size, NORI_DPDF_GRAIN_SIZE),
+        [&](const tbb::blocked_range<size_t> &range) {
+            func(range.begin(), range.end());
+        }
+    );
+}
+
+float DiscretePDF::normalize() {
+    m_sum = m_cdf[m_cdf.size()-1];
+    if (m_sum > 0) {
+        m_normalization = 1.0f / m_sum;
+        /* The alias table needs the unnormalized entries */
+        buildAliasTable();
+        forEachRange(m_cdf.size() - 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin + 1; i <= end; ++i)
+                m_cdf[i] *= m_normalization;
+        });
+        m_cdf[m_cdf.size()-1] = 1.0f;
+        m_normalized = true;
+    } else {
+        m_normalization = 0.0f;
+        m_alias.clear();
+    }
+    return m_sum;
+}
+
+void DiscretePDF::buildAliasTable() {
+    size_t n = size();
+    m_alias.resize(n);
+
+    /* Scale the probabilities so that they average to one */
+    std::vector<double> prob(n);
+    double scale = (double) n / (double) m_sum;
+    forEachRange(n, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            prob[i] = ((double) m_cdf[i + 1] - (double) m_cdf[i]) * scale;
+            m_alias[i].alias = (uint32_t) i;
+        }
+    });
+
+    /* Vose's algorithm: every entry with probability below one ("small")
+       is topped up by an entry with probability above one ("large"), which
+       is then reclassified based on what remains of it. This pass takes
+       linear time, but is inherently sequential. */
+    std::vector<uint32_t> small, large;
+    small.reserve(n);
+    large.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        if (prob[i] < 1.0)
+            small.push_back((uint32_t) i);
+        else
+            large.push_back((uint32_t) i);
+    }
+
+    while (!small.empty() && !large.empty()) {
+        uint32_t s = small.back(), l = large.back();
+        small.pop_back();
+        m_alias[s].prob = (float) prob[s];
+        m_alias[s].alias = l;
+        prob[l] -= 1.0 - prob[s];
+        if (prob[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    /* Whatever is left has a probability of one up to round-off errors */
+    for (uint32_t i : large)
+        m_alias[i].prob = 1.0f;
+    for (uint32_t i : small)
+        m_alias[i].prob = 1.0f;
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,113 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/dpdf.h>
+#include <nori/timer.h>
+#include <pcg32.h>
+
+/*
+ * Microbenchmark comparing the two sampling methods of DiscretePDF:
+ * binary search over the CDF and the alias table. For each distribution
+ * size, it reports the construction time, the time per sample of both
+ * methods (plain and with sample reuse), and the largest relative deviation
+ * of the sampled histograms from the expected probabilities.
+ *
+ * Usage: dpdfbench [sample count]
+ */
+
+using namespace nori;
+
+/* Keep the compiler from optimizing the sampling loops away */
+static volatile size_t sink;
+
+/* Return the time per sample (in nanoseconds) of func(u) applied to 'count' random numbers */
+template <typename Func> static double benchmark(const std::vector<float> &samples, const Func &func) {
+    Timer timer;
+    size_t result = 0;
+    for (float u : samples)
+        result += func(u);
+    double elapsed = timer.elapsed();
+    sink = result;
+    return elapsed * 1e6 / (double) samples.size();
+}
+
+/* Largest relative error of the histogram of func(u) compared to the expected probabilities */
+template <typename Func> static float histogramError(const DiscretePDF &pdf,
+        const std::vector<float> &samples, const Func &func) {
+    std::vector<uint32_t> histogram(pdf.size(), 0);
+    for (float u : samples)
+        histogram[func(u)]++;
+    float error = 0.0f;
+    for (size_t i = 0; i < pdf.size(); ++i) {
+        float expected = pdf[i] * (float) samples.size();
+        error = std::max(error, std::abs((float) histogram[i] - expected) / expected);
+    }
+    return error;
+}
+
+int main(int argc, char **argv) {
+    size_t sampleCount = 1 << 24;
+    if (argc > 1) {
+        try {
+            sampleCount = (size_t) std::stoull(argv[1]);
+        } catch (const std::exception &) {
+            cerr << "Syntax: " << argv[0] << " [sample count]" << endl;
+            return -1;
+        }
+    }
+
+    pcg32 random;
+    std::vector<float> samples(sampleCount);
+    for (float &u : samples)
+        u = random.nextFloat();
+
+    cout << tfm::format("%10s %10s %9s %9s %9s %9s %10s %10s",
+        "entries", "build", "cdf", "cdf-reuse", "alias", "al-reuse",
+        "err(cdf)", "err(alias)") << endl;
+
+    for (size_t n = 16; n <= (1 << 22); n *= 16) {
+        /* Heavy-tailed weights, as found e.g. in the triangle areas of a mesh */
+        DiscretePDF pdf(n);
+        for (size_t i = 0; i < n; ++i) {
+            float x = random.nextFloat();
+            pdf.append(1.0f / (0.01f + x * x));
+        }
+        Timer timer;
+        pdf.normalize();
+        double buildTime = timer.elapsed();
+
+        double cdf = benchmark(samples, [&](float u) { return pdf.sample(u); });
+        double cdfReuse = benchmark(samples, [&](float u) { return pdf.sampleReuse(u); });
+        double alias = benchmark(samples, [&](float u) { return pdf.sampleAlias(u); });
+        double aliasReuse = benchmark(samples, [&](float u) { return pdf.sampleAliasReuse(u); });
+
+        /* Only check histograms where every entry receives enough samples */
+        std::string cdfError = "-", aliasError = "-";
+        if (n * 1000 <= sampleCount) {
+            cdfError = tfm::format("%.4f", histogramError(pdf, samples,
+                [&](float u) { return pdf.sample(u); }));
+            aliasError = tfm::format("%.4f", histogramError(pdf, samples,
+                [&](float u) { return pdf.sampleAlias(u); }));
+        }
+
+        cout << tfm::format("%10i %8.2fms %7.2fns %7.2fns %7.2fns %7.2fns %10s %10s",
+            n, buildTime, cdf, cdfReuse, alias, aliasReuse, cdfError, aliasError) << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/emitter.h>
+#include <nori/mesh.h>
+
+NORI_NAMESPACE_BEGIN
+
+void EmitterTriangles::build(const Mesh *mesh, float luminance) {
+    const MatrixXf &V = mesh->getVertexPositions();
+    const MatrixXu &F = mesh->getIndices();
+    size_t count = mesh->getTriangleCount();
+
+    for (std::vector<float> *v : { &p0x, &p0y, &p0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z,
+                                   &nx, &ny, &nz, &area })
+        v->resize(count);
+
+    /* Gather the vertices */
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t i0 = F(0, i), i1 = F(1, i), i2 = F(2, i);
+        p0x[i] = V(0, i0); p0y[i] = V(1, i0); p0z[i] = V(2, i0);
+        e1x[i] = V(0, i1) - p0x[i]; e1y[i] = V(1, i1) - p0y[i]; e1z[i] = V(2, i1) - p0z[i];
+        e2x[i] = V(0, i2) - p0x[i]; e2y[i] = V(1, i2) - p0y[i]; e2z[i] = V(2, i2) - p0z[i];
+    }
+
+    /* Normals and areas (this loop only touches the arrays and vectorizes) */
+    for (size_t i = 0; i < count; ++i) {
+        float cx = e1y[i] * e2z[i] - e1z[i] * e2y[i];
+        float cy = e1z[i] * e2x[i] - e1x[i] * e2z[i];
+        float cz = e1x[i] * e2y[i] - e1y[i] * e2x[i];
+        float length = std::sqrt(cx * cx + cy * cy + cz * cz);
+        float invLength = length > 0.0f ? 1.0f / length : 0.0f;
+        nx[i] = cx * invLength;
+        ny[i] = cy * invLength;
+        nz[i] = length > 0.0f ? cz * invLength : 1.0f;
+        area[i] = 0.5f * length;
+    }
+
+    /* Each triangle emits radiance L into a hemisphere, i.e. power pi * L * A */
+    float totalArea = 0.0f;
+    for (size_t i = 0; i < count; ++i)
+        totalArea += area[i];
+    power = (float) M_PI * luminance * totalArea;
+}
+
+NORI_NAMESPACE_END
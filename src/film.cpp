@@ -0,0 +1,238 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/film.h>
+#include <nori/bitmap.h>
+#include <nori/atomic.h>
+
+NORI_NAMESPACE_BEGIN
+
+StreamingFilm::StreamingFilm(const std::string &filename, const Point2i &offset,
+        const Vector2i &size, int blockSize, int borderSize)
+    : m_offset(offset), m_size(size), m_blockSize(blockSize), m_borderSize(borderSize) {
+    /* Blocks may only spill into their immediate neighbors */
+    if (borderSize > blockSize)
+        throw NoriException("StreamingFilm: the reconstruction filter is too wide "
+                            "for a block size of %i pixels", blockSize);
+
+    m_numTiles = Vector2i(
+        (size.x() + blockSize - 1) / blockSize,
+        (size.y() + blockSize - 1) / blockSize);
+    m_merged.resize((size_t) m_numTiles.x() * m_numTiles.y(), false);
+    m_writer.reset(new TiledEXRWriter(filename, size, blockSize));
+}
+
+StreamingFilm::~StreamingFilm() {
+    /* Normally, all tiles have been written at this point. Flush whatever
+       remains (e.g. when the render was aborted) to get a readable file. */
+    try {
+        while (!m_tiles.empty()) {
+            int index = m_tiles.begin()->first;
+            writeTile(index % m_numTiles.x(), index / m_numTiles.x());
+        }
+    } catch (const std::exception &e) {
+        cerr << "StreamingFilm: could not write the remaining tiles: " << e.what() << endl;
+    }
+}
+
+StreamingFilm::Tile &StreamingFilm::getTile(int tileX, int tileY) {
+    Tile &tile = m_tiles[tileY * m_numTiles.x() + tileX];
+    m_peakTiles = std::max(m_peakTiles, m_tiles.size());
+    return tile;
+}
+
+bool StreamingFilm::isMerged(int tileX, int tileY) const {
+    if (tileX < 0 || tileY < 0 || tileX >= m_numTiles.x() || tileY >= m_numTiles.y())
+        return true;
+    return m_merged[tileY * m_numTiles.x() + tileX];
+}
+
+void StreamingFilm::writeTile(int tileX, int tileY) {
+    auto it = m_tiles.find(tileY * m_numTiles.x() + tileX);
+    Vector2i size = (m_size - Vector2i(tileX, tileY) * m_blockSize)
+        .cwiseMin(Vector2i::Constant(m_blockSize));
+
+    /* Sum up the contributions of the blocks in a fixed order */
+    TileStorage sum(size.y(), size.x());
+    sum.setConstant(Color4f());
+    for (const TilePart &part : it->second.parts) {
+        if (part.data.size() > 0)
+            sum.block(part.offset.y(), part.offset.x(), part.data.rows(), part.data.cols())
+                += part.data;
+    }
+
+    Bitmap bitmap(size);
+    for (int y=0; y<sum.rows(); ++y)
+        for (int x=0; x<sum.cols(); ++x)
+            bitmap.coeffRef(y, x) = sum.coeff(y, x).divideByFilterWeight();
+
+    m_writer->writeTile(tileX, tileY, bitmap);
+    m_tiles.erase(it);
+}
+
+void StreamingFilm::put(const ImageBlock &block) {
+    /* Position of the block (including its border) relative to the region */
+    Point2i blockMin = block.getOffset() - m_offset - Vector2i::Constant(m_borderSize);
+    Point2i blockMax = blockMin + block.getSize() + Vector2i::Constant(2 * m_borderSize);
+    int blockX = (block.getOffset().x() - m_offset.x()) / m_blockSize,
+        blockY = (block.getOffset().y() - m_offset.y()) / m_blockSize;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    /* Store the block's contribution to all tiles that it overlaps */
+    for (int tileY = std::max(blockY - 1, 0); tileY <= std::min(blockY + 1, m_numTiles.y() - 1); ++tileY) {
+        for (int tileX = std::max(blockX - 1, 0); tileX <= std::min(blockX + 1, m_numTiles.x() - 1); ++tileX) {
+            Point2i tileMin = Point2i(tileX, tileY) * m_blockSize;
+            Point2i tileMax = (tileMin + Vector2i::Constant(m_blockSize)).cwiseMin(m_size);
+            Point2i overlapMin = blockMin.cwiseMax(tileMin), overlapMax = blockMax.cwiseMin(tileMax);
+            if ((overlapMax.array() <= overlapMin.array()).any())
+                continue;
+
+            Vector2i size = overlapMax - overlapMin;
+            TilePart &part = getTile(tileX, tileY).parts[(blockY - tileY + 1) * 3 + blockX - tileX + 1];
+            part.offset = overlapMin - tileMin;
+            part.data = block.block(overlapMin.y() - blockMin.y(), overlapMin.x() - blockMin.x(),
+                                    size.y(), size.x());
+        }
+    }
+
+    m_merged[blockY * m_numTiles.x() + blockX] = true;
+
+    /* Write the tiles that no longer receive any contributions */
+    for (int tileY = std::max(blockY - 1, 0); tileY <= std::min(blockY + 1, m_numTiles.y() - 1); ++tileY) {
+        for (int tileX = std::max(blockX - 1, 0); tileX <= std::min(blockX + 1, m_numTiles.x() - 1); ++tileX) {
+            bool done = true;
+            for (int y = tileY - 1; y <= tileY + 1; ++y)
+                for (int x = tileX - 1; x <= tileX + 1; ++x)
+                    done &= isMerged(x, y);
+            if (done && m_tiles.count(tileY * m_numTiles.x() + tileX))
+                writeTile(tileX, tileY);
+        }
+    }
+}
+
+SplatFilm::SplatFilm(const Point2i &offset, const Vector2i &size)
+    : m_offset(offset), m_size(size),
+      m_pixels(new std::atomic<float>[3 * (size_t) size.x() * size.y()]) {
+    clear();
+}
+
+void SplatFilm::put(const Point2f &position, const Color3f &value) {
+    int x = (int) std::floor(position.x()) - m_offset.x(),
+        y = (int) std::floor(position.y()) - m_offset.y();
+    if (x < 0 || y < 0 || x >= m_size.x() || y >= m_size.y() || !value.isValid())
+        return;
+
+    std::atomic<float> *pixel = &m_pixels[3 * ((size_t) y * m_size.x() + x)];
+    for (int i = 0; i < 3; ++i)
+        if (value[i] != 0.0f)
+            atomicAdd(pixel[i], value[i]);
+}
+
+void SplatFilm::clear() {
+    for (size_t i = 0; i < 3 * (size_t) m_size.x() * m_size.y(); ++i)
+        m_pixels[i].store(0.0f, std::memory_order_relaxed);
+}
+
+void SplatFilm::develop(ImageBlock &block, float scale) const {
+    int border = block.getBorderSize();
+    for (int y = 0; y < m_size.y(); ++y) {
+        for (int x = 0; x < m_size.x(); ++x) {
+            const std::atomic<float> *pixel = &m_pixels[3 * ((size_t) y * m_size.x() + x)];
+            Color3f value(pixel[0].load(std::memory_order_relaxed),
+                          pixel[1].load(std::memory_order_relaxed),
+                          pixel[2].load(std::memory_order_relaxed));
+            Color4f &target = block.coeffRef(y + border, x + border);
+
+            /* Pixels without any filter weight only contain the splats */
+            if (target.w() == 0.0f)
+                target.w() = 1.0f;
+            target.head<3>() += value * (scale * target.w());
+        }
+    }
+}
+
+OrderedBlockMerger::OrderedBlockMerger(const ReconstructionFilter *filter,
+                                       const MergeFunction &merge)
+    : m_filter(filter), m_merge(merge) {
+    m_ordered = ImageBlock(Vector2i(0, 0), filter).getBorderSize() > 0;
+}
+
+void OrderedBlockMerger::put(int index, ImageBlock &block) {
+    if (!m_ordered) {
+        m_merge(block);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (index == m_next) {
+        m_merge(block);
+        m_next++;
+        flush();
+        return;
+    }
+
+    /* Keep a copy until all preceding blocks have been merged */
+    std::unique_ptr<ImageBlock> copy;
+    if (m_pool.empty()) {
+        copy.reset(new ImageBlock(Vector2i(NORI_BLOCK_SIZE), m_filter));
+    } else {
+        copy = std::move(m_pool.back());
+        m_pool.pop_back();
+    }
+    copy->setOffset(block.getOffset());
+    copy->setSize(block.getSize());
+    copy->topLeftCorner(block.rows(), block.cols()) = block;
+    m_pending[index] = std::move(copy);
+    m_peakPending = std::max(m_peakPending, m_pending.size());
+}
+
+void OrderedBlockMerger::skip(int index) {
+    if (!m_ordered)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (index == m_next) {
+        m_next++;
+        flush();
+    } else {
+        m_pending[index] = nullptr;
+    }
+}
+
+void OrderedBlockMerger::reset() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_pending.empty())
+        throw NoriException("OrderedBlockMerger::reset(): %i blocks were never merged "
+                            "(the block indices have a gap)", m_pending.size());
+    m_next = 0;
+}
+
+void OrderedBlockMerger::flush() {
+    auto it = m_pending.begin();
+    while (it != m_pending.end() && it->first == m_next) {
+        if (it->second) {
+            m_merge(*it->second);
+            m_pool.push_back(std::move(it->second));
+        }
+        it = m_pending.erase(it);
+        m_next++;
+    }
+}
+
+NORI_NAMESPACE_END
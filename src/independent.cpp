@@ -18,7 +18,6 @@
 
 #include <nori/sampler.h>
 #include <nori/block.h>
-#include <pcg32.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -29,6 +28,11 @@ NORI_NAMESPACE_BEGIN
  * This class is essentially just a wrapper around the pcg32 pseudorandom
  * number generator. For more details on what sample generators do in
  * general, refer to the \ref Sampler class.
+ *
+ * Every pixel sample uses its own random number stream: the pixel selects
+ * one of the generator's streams, and the global index of the sample
+ * (counting over all passes) selects the starting position within it.
+ * The dimensions of the sample are consecutive values of that stream.
  */
 class Independent : public Sampler {
 public:
@@ -42,16 +46,24 @@ public:
         std::unique_ptr<Independent> cloned(new Independent());
         cloned->m_sampleCount = m_sampleCount;
         cloned->m_random = m_random;
+        cloned->m_pass = m_pass;
         return std::move(cloned);
     }
 
-    void prepare(const ImageBlock &block) {
+    void prepare(const ImageBlock &block, uint32_t pass) {
+        m_pass = pass;
+
+        /* Stream used by code that draws samples outside of startSample() */
         m_random.seed(
-            block.getOffset().x(),
+            (uint64_t) block.getOffset().x() | ((uint64_t) pass << 32),
             block.getOffset().y()
         );
     }
 
+    void startSample(const Point2i &pixel, uint32_t index) {
+        seedStream(m_random, pixel, index, 0);
+    }
+
     void generate() { /* No-op for this sampler */ }
     void advance()  { /* No-op for this sampler */ }
 
@@ -0,0 +1,161 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/irradiancecache.h>
+#include <Eigen/Geometry>
+
+NORI_NAMESPACE_BEGIN
+
+IrradianceCache::IrradianceCache(const BoundingBox3f &bounds, float accuracy)
+    : m_root(new Node()), m_accuracy(accuracy), m_size(0) {
+    /* Slightly enlarged cube around the bounds */
+    m_extent = std::max(bounds.getExtents().maxCoeff(), Epsilon) * (1.0f + 2 * Epsilon);
+    m_origin = bounds.getCenter() - Vector3f::Constant(0.5f * m_extent);
+}
+
+IrradianceCache::~IrradianceCache() {
+    release(m_root);
+}
+
+void IrradianceCache::release(Node *node) {
+    for (int i = 0; i < 8; ++i) {
+        Node *child = node->children[i].load(std::memory_order_relaxed);
+        if (child)
+            release(child);
+    }
+    Entry *entry = node->entries.load(std::memory_order_relaxed);
+    while (entry) {
+        Entry *next = entry->next;
+        delete entry;
+        entry = next;
+    }
+    delete node;
+}
+
+void IrradianceCache::insert(const IrradianceRecord &record) {
+    float radius = m_accuracy * record.R;
+
+    /* Descend while the sphere of influence still fits into the loose
+       region of the child containing the record's position */
+    Node *node = m_root;
+    Point3f origin = m_origin;
+    float size = m_extent;
+    for (int depth = 0; depth < NORI_IRRCACHE_MAX_DEPTH && 0.25f * size >= radius; ++depth) {
+        size *= 0.5f;
+        int index = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            if (record.p[axis] >= origin[axis] + size) {
+                index |= 1 << axis;
+                origin[axis] += size;
+            }
+        }
+
+        Node *child = node->children[index].load(std::memory_order_acquire);
+        if (!child) {
+            /* Another thread may create the same child concurrently */
+            Node *newChild = new Node();
+            if (node->children[index].compare_exchange_strong(child, newChild,
+                    std::memory_order_acq_rel, std::memory_order_acquire))
+                child = newChild;
+            else
+                delete newChild;
+        }
+        node = child;
+    }
+
+    /* Publish the record at the front of the node's list */
+    Entry *entry = new Entry();
+    entry->record = record;
+    entry->next = node->entries.load(std::memory_order_relaxed);
+    while (!node->entries.compare_exchange_weak(entry->next, entry,
+            std::memory_order_release, std::memory_order_relaxed))
+        ;
+    m_size.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool IrradianceCache::interpolate(const Point3f &p, const Normal3f &n, Color3f &E) const {
+    Color3f sum(0.0f);
+    float weightSum = 0.0f;
+
+    struct StackItem {
+        const Node *node;
+        Point3f origin;
+        float size;
+    };
+
+    /* Every level contributes at most 8 nodes */
+    StackItem stack[8 * NORI_IRRCACHE_MAX_DEPTH + 1];
+    int stackSize = 0;
+    stack[stackSize++] = StackItem { m_root, m_origin, m_extent };
+
+    while (stackSize > 0) {
+        StackItem item = stack[--stackSize];
+
+        for (const Entry *entry = item.node->entries.load(std::memory_order_acquire);
+             entry; entry = entry->next) {
+            const IrradianceRecord &record = entry->record;
+            Vector3f d = p - record.p;
+
+            /* Ward's error estimate (the weight is its reciprocal) */
+            float error = d.norm() / record.R
+                + std::sqrt(std::max(0.0f, 1.0f - n.dot(record.n)));
+            if (error >= m_accuracy)
+                continue;
+
+            /* Skip records in front of 'p', which may see different geometry */
+            if (d.dot(n + record.n) < -0.02f * record.R)
+                continue;
+
+            float weight = 1.0f / std::max(error, 1e-4f);
+            Vector3f rotation = record.n.cross(n);
+            for (int i = 0; i < 3; ++i)
+                sum[i] += weight * std::max(0.0f, record.E[i]
+                    + record.rotGrad[i].dot(rotation) + record.transGrad[i].dot(d));
+            weightSum += weight;
+        }
+
+        /* Visit the children whose loose region contains 'p' */
+        float childSize = 0.5f * item.size;
+        for (int i = 0; i < 8; ++i) {
+            const Node *child = item.node->children[i].load(std::memory_order_acquire);
+            if (!child)
+                continue;
+            Point3f origin = item.origin;
+            bool inside = true;
+            for (int axis = 0; axis < 3; ++axis) {
+                if (i & (1 << axis))
+                    origin[axis] += childSize;
+                float offset = p[axis] - origin[axis];
+                inside &= offset >= -0.5f * childSize && offset <= 1.5f * childSize;
+            }
+            if (inside)
+                stack[stackSize++] = StackItem { child, origin, childSize };
+        }
+    }
+
+    if (weightSum == 0.0f)
+        return false;
+    E = sum / weightSum;
+    return true;
+}
+
+std::string IrradianceCache::toString() const {
+    return tfm::format("IrradianceCache[records=%i, accuracy=%f]", size(), m_accuracy);
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,273 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/mesh.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/sampler.h>
+#include <nori/context.h>
+#include <nori/irradiancecache.h>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Irradiance caching integrator
+ *
+ * Camera rays are followed through specular surfaces until they reach a
+ * diffuse one. There, direct illumination is computed using next event
+ * estimation, while the indirect illumination is interpolated from nearby
+ * records of an irradiance cache, extrapolated using their rotational and
+ * translational gradients (Ward and Heckbert 1992).
+ *
+ * When no record is accurate enough, a new one is computed on the spot by
+ * stratified cosine-weighted sampling of the hemisphere (\c samples rays,
+ * each continued by a path tracer) and inserted into the cache, where it
+ * is immediately visible to all other threads. Since indirect illumination
+ * varies slowly on diffuse surfaces, only few shading points require a new
+ * record, which makes this much cheaper than tracing the hemisphere at
+ * every pixel.
+ *
+ * The cache assumes Lambertian reflection: the indirect illumination is
+ * multiplied by the BSDF value towards the normal. The validity radius of
+ * the records is clamped to [\c minSpacing, \c maxSpacing] times the length
+ * of the scene's diagonal.
+ */
+class IrradianceCacheIntegrator : public Integrator {
+public:
+    IrradianceCacheIntegrator(const PropertyList &props) {
+        /* Maximum interpolation error ('a' in Ward's paper) */
+        m_accuracy = props.getFloat("accuracy", 0.25f);
+
+        /* Number of hemisphere rays used to compute a record */
+        m_samples = props.getInteger("samples", 256);
+
+        /* Bounds of the record radius (relative to the scene's size) */
+        m_minSpacing = props.getFloat("minSpacing", 0.002f);
+        m_maxSpacing = props.getFloat("maxSpacing", 0.1f);
+
+        if (m_accuracy <= 0.0f)
+            throw NoriException("IrradianceCacheIntegrator: 'accuracy' must be positive!");
+        if (m_samples <= 0)
+            throw NoriException("IrradianceCacheIntegrator: 'samples' must be positive!");
+        if (m_minSpacing <= 0.0f || m_maxSpacing < m_minSpacing)
+            throw NoriException("IrradianceCacheIntegrator: invalid 'minSpacing'/'maxSpacing'!");
+
+        /* Stratify the hemisphere into M x N cells with N ~ pi * M */
+        m_thetaStrata = std::max(1, (int) std::round(std::sqrt(m_samples / M_PI)));
+        m_phiStrata = std::max(1, (int) std::round(m_samples / (float) m_thetaStrata));
+    }
+
+    void preprocess(const Scene *scene) {
+        const BoundingBox3f &bbox = scene->getBoundingBox();
+        m_sceneSize = bbox.getExtents().norm();
+        m_cache.reset(new IrradianceCache(bbox, m_accuracy));
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &_ray) const {
+        /* Radiance of emitters seen directly or through specular surfaces */
+        Color3f result(0.0f), throughput(1.0f);
+        Ray3f ray(_ray);
+        Intersection its;
+        if (!traceToDiffuse(scene, sampler, ray, its, throughput, result))
+            return result;
+
+        /* Indirect illumination from the cache (or a new record) */
+        const BSDF *bsdf = its.mesh->getBSDF();
+        Vector3f wi = its.toLocal(-ray.d);
+        Color3f E;
+        if (!m_cache->interpolate(its.p, its.shFrame.n, E))
+            E = computeRecord(scene, sampler, its);
+        BSDFQueryRecord bRec(wi, Vector3f(0.0f, 0.0f, 1.0f), ESolidAngle);
+
+        return result + throughput * (sampleDirectLight(scene, sampler, its, bsdf, wi)
+            + bsdf->eval(bRec) * E);
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "IrradianceCacheIntegrator[\n"
+            "  accuracy = %f,\n"
+            "  samples = %i,\n"
+            "  minSpacing = %f,\n"
+            "  maxSpacing = %f\n"
+            "]",
+            m_accuracy,
+            m_samples,
+            m_minSpacing,
+            m_maxSpacing
+        );
+    }
+
+private:
+    /// Radiance emitted towards the origin of \c ray by the surface it hit
+    static Color3f emitted(const Intersection &its, const Ray3f &ray) {
+        const Emitter *emitter = its.mesh->getEmitter();
+        if (!emitter)
+            return Color3f(0.0f);
+        EmitQueryRecord eRec;
+        eRec.m_p = its.p;
+        eRec.m_np = its.shFrame.n;
+        eRec.m_wo = -ray.d;
+        eRec.m_emitter = emitter;
+        eRec.m_triangle = its.triangle;
+        return emitter->eval(eRec);
+    }
+
+    /**
+     * \brief Radiance arriving along \c ray, not counting light emitted by
+     * the first surface it hits (which is part of the direct illumination)
+     *
+     * \param distance
+     *     Set to the distance to the first surface (infinity if there is none)
+     */
+    static Color3f indirectRadiance(const Scene *scene, Sampler *sampler,
+                                    Ray3f ray, float &distance) {
+        Color3f result(0.0f), throughput(1.0f);
+        Intersection its;
+        distance = std::numeric_limits<float>::infinity();
+        if (!scene->rayIntersect(ray, its))
+            return result;
+        distance = its.t;
+
+        /* Path tracer with next event estimation; emitters that are hit
+           are only counted after specular bounces */
+        bool specular = false;
+        while (true) {
+            if (specular)
+                result += throughput * emitted(its, ray);
+
+            const BSDF *bsdf = its.mesh->getBSDF();
+            Vector3f wi = its.toLocal(-ray.d);
+            if (bsdf->isDiffuse())
+                result += throughput * sampleDirectLight(scene, sampler, its, bsdf, wi);
+
+            BSDFQueryRecord bRec(wi);
+            Color3f f = bsdf->sample(bRec, sampler->next2D());
+            float prob = std::min(f.maxCoeff(), 0.99f);
+            if (f.isZero() || sampler->next1D() >= prob)
+                break;
+            throughput *= f / prob;
+            specular = !bsdf->isDiffuse();
+
+            ray = Ray3f(its.p, its.toWorld(bRec.wo));
+            if (!scene->rayIntersect(ray, its))
+                break;
+        }
+
+        return result;
+    }
+
+    /**
+     * \brief Compute the irradiance and its gradients at an intersection,
+     * insert the record into the cache and return the irradiance
+     */
+    Color3f computeRecord(const Scene *scene, Sampler *sampler, const Intersection &its) const {
+        const int M = m_thetaStrata, N = m_phiStrata;
+        const Frame &frame = its.shFrame;
+        std::vector<Color3f> L(M * N);
+        std::vector<float> r(M * N);
+
+        /* Stratified cosine-weighted sampling of the hemisphere: cell (j, k)
+           spans sin^2(theta) in [j/M, (j+1)/M) and phi in [2pi k/N, 2pi (k+1)/N) */
+        IrradianceRecord record;
+        record.p = its.p;
+        record.n = frame.n;
+        record.E = Color3f(0.0f);
+        float invDistanceSum = 0.0f;
+        for (int j = 0; j < M; ++j) {
+            for (int k = 0; k < N; ++k) {
+                Point2f sample = sampler->next2D();
+                float sinTheta2 = (j + sample.x()) / M;
+                float sinTheta = std::sqrt(sinTheta2), cosTheta = std::sqrt(1.0f - sinTheta2);
+                float phi = 2.0f * M_PI * (k + sample.y()) / N;
+                Vector3f d(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+
+                int index = j * N + k;
+                L[index] = indirectRadiance(scene, sampler,
+                    Ray3f(its.p, frame.toWorld(d)), r[index]);
+                record.E += L[index];
+                invDistanceSum += 1.0f / r[index];
+            }
+        }
+        float scale = M_PI / (M * N);
+        record.E *= scale;
+
+        /* Rotational gradient (Ward and Heckbert, 1992): rotating the normal
+           by a small angle about an axis changes E by the projection of the
+           rotation vector onto this gradient */
+        Vector3f rotGrad[3] = { Vector3f::Zero(), Vector3f::Zero(), Vector3f::Zero() };
+        for (int k = 0; k < N; ++k) {
+            float phi = 2.0f * M_PI * (k + 0.5f) / N;
+            Vector3f v(-std::sin(phi), std::cos(phi), 0.0f);
+            Color3f sum(0.0f);
+            for (int j = 0; j < M; ++j) {
+                float sinTheta2 = (j + 0.5f) / M;
+                sum += L[j * N + k] * std::sqrt(sinTheta2 / (1.0f - sinTheta2));
+            }
+            for (int i = 0; i < 3; ++i)
+                rotGrad[i] += v * (sum[i] * scale);
+        }
+
+        /* Translational gradient: when moving the point, the boundaries between
+           cells shift by an amount that depends on the distance to the nearer
+           of the two surfaces seen on either side */
+        Vector3f transGrad[3] = { Vector3f::Zero(), Vector3f::Zero(), Vector3f::Zero() };
+        for (int k = 0; k < N; ++k) {
+            float phi = 2.0f * M_PI * (k + 0.5f) / N;
+            float phiMinus = 2.0f * M_PI * k / N;
+            Vector3f u(std::cos(phi), std::sin(phi), 0.0f);
+            Vector3f vMinus(-std::sin(phiMinus), std::cos(phiMinus), 0.0f);
+            int kPrev = (k + N - 1) % N;
+
+            /* Boundaries between cells of different theta */
+            Color3f sumTheta(0.0f);
+            for (int j = 1; j < M; ++j) {
+                float sinTheta2 = (float) j / M;
+                float weight = std::sqrt(sinTheta2) * (1.0f - sinTheta2)
+                    / std::min(r[j * N + k], r[(j - 1) * N + k]);
+                sumTheta += (L[j * N + k] - L[(j - 1) * N + k]) * weight;
+            }
+            sumTheta *= 2.0f * M_PI / N;
+
+            /* Boundaries between cells of different phi */
+            Color3f sumPhi(0.0f);
+            for (int j = 0; j < M; ++j) {
+                float weight = (std::sqrt((float) (j + 1) / M) - std::sqrt((float) j / M))
+                    / std::min(r[j * N + k], r[j * N + kPrev]);
+                sumPhi += (L[j * N + k] - L[j * N + kPrev]) * weight;
+            }
+
+            for (int i = 0; i < 3; ++i)
+                transGrad[i] += u * sumTheta[i] + vMinus * sumPhi[i];
+        }
+
+        /* Harmonic mean distance, limited by the translational gradient so
+           that records do not extrapolate too far, and clamped */
+        float R = invDistanceSum > 0.0f ? (M * N) / invDistanceSum
+            : std::numeric_limits<float>::infinity();
+        for (int i = 0; i < 3; ++i) {
+            float gradNorm = transGrad[i].norm();
+            if (gradNorm > 0.0f)
+                R = std::min(R, record.E[i] / gradNorm);
+            record.rotGrad[i] = frame.toWorld(rotGrad[i]);
+            record.transGrad[i] = frame.toWorld(transGrad[i]);
+        }
+        record.R = std::min(std::max(R, m_minSpacing * m_sceneSize), m_maxSpacing * m_sceneSize);
+
+        m_cache->insert(record);
+        return record.E;
+    }
+
+    float m_accuracy;
+    int m_samples;
+    float m_minSpacing;
+    float m_maxSpacing;
+    int m_thetaStrata;
+    int m_phiStrata;
+    float m_sceneSize = 0.0f;
+    /// Records are inserted lazily while rendering (see \ref IrradianceCache)
+    std::unique_ptr<IrradianceCache> m_cache;
+};
+
+NORI_REGISTER_CLASS(IrradianceCacheIntegrator, "irrcache");
+NORI_NAMESPACE_END
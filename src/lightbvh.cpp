@@ -0,0 +1,383 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/lightbvh.h>
+#include <nori/emitter.h>
+#include <Eigen/Geometry>
+
+NORI_NAMESPACE_BEGIN
+
+/// Number of candidate split positions per axis
+#define NORI_LIGHTBVH_BUCKETS 12
+
+/// Depth below which nodes are always split at the median
+#define NORI_LIGHTBVH_MEDIAN_DEPTH 32
+
+/* Cosine of (a - b), or 1 if a < b. The angles are given by their sine and cosine */
+static float cosSubClamped(float sinA, float cosA, float sinB, float cosB) {
+    if (cosA > cosB)
+        return 1.0f;
+    return cosA * cosB + sinA * sinB;
+}
+
+/* Sine of (a - b), or 0 if a < b */
+static float sinSubClamped(float sinA, float cosA, float sinB, float cosB) {
+    if (cosA > cosB)
+        return 0.0f;
+    return sinA * cosB - cosA * sinB;
+}
+
+static float safeSqrt(float value) {
+    return std::sqrt(std::max(value, 0.0f));
+}
+
+static float safeAcos(float value) {
+    return std::acos(clamp(value, -1.0f, 1.0f));
+}
+
+void LightBounds::expandBy(const LightBounds &bounds) {
+    if (bounds.isEmpty())
+        return;
+    if (isEmpty()) {
+        *this = bounds;
+        return;
+    }
+    bbox.expandBy(bounds.bbox);
+    power += bounds.power;
+
+    /* Find the smallest cone containing both normal cones */
+    float thetaA = safeAcos(cosTheta), thetaB = safeAcos(bounds.cosTheta);
+    float thetaD = safeAcos(axis.dot(bounds.axis));
+    if (std::min(thetaD + thetaB, (float) M_PI) <= thetaA)
+        return;
+    if (std::min(thetaD + thetaA, (float) M_PI) <= thetaB) {
+        axis = bounds.axis;
+        cosTheta = bounds.cosTheta;
+        return;
+    }
+
+    float thetaO = 0.5f * (thetaA + thetaD + thetaB);
+    Vector3f rotationAxis = axis.cross(bounds.axis);
+    if (thetaO >= M_PI || rotationAxis.squaredNorm() == 0.0f) {
+        cosTheta = -1.0f;
+        return;
+    }
+
+    /* Rotate the axis towards the other one (Rodrigues' formula, the
+       rotation axis is perpendicular to the axis being rotated) */
+    float thetaR = thetaO - thetaA;
+    rotationAxis.normalize();
+    axis = (axis * std::cos(thetaR) + rotationAxis.cross(axis) * std::sin(thetaR)).normalized();
+    cosTheta = std::cos(thetaO);
+}
+
+float LightBounds::importance(const Point3f &p, const Normal3f &n) const {
+    if (power <= 0.0f || isEmpty())
+        return 0.0f;
+
+    /* Distance to the center, clamped to avoid a singularity close to the box */
+    Point3f center = bbox.getCenter();
+    Vector3f d = p - center;
+    float dist2 = d.squaredNorm();
+    float radius2 = 0.25f * bbox.getExtents().squaredNorm();
+    Vector3f wi = dist2 > 0.0f ? Vector3f(d / std::sqrt(dist2)) : axis;
+
+    /* Angle subtended by the bounding sphere of the box */
+    float cosThetaB = -1.0f, sinThetaB = 0.0f;
+    if (!bbox.contains(p) && dist2 > radius2) {
+        float sin2ThetaB = radius2 / dist2;
+        cosThetaB = safeSqrt(1.0f - sin2ThetaB);
+        sinThetaB = std::sqrt(sin2ThetaB);
+    }
+
+    /* Smallest angle between the direction towards 'p' and any emitter
+       normal, accounting for the spatial extent of the box */
+    float cosThetaW = axis.dot(wi), sinThetaW = safeSqrt(1.0f - cosThetaW * cosThetaW);
+    float sinThetaO = safeSqrt(1.0f - cosTheta * cosTheta);
+    float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosTheta);
+    float sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosTheta);
+    float cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+
+    /* The emitters only emit into the hemisphere around their normal */
+    if (cosThetaP <= 0.0f)
+        return 0.0f;
+
+    float result = power * cosThetaP / std::max(dist2, radius2);
+
+    /* Foreshortening at the receiver */
+    if (n.squaredNorm() > 0.0f) {
+        float cosThetaI = std::abs(wi.dot(n)), sinThetaI = safeSqrt(1.0f - cosThetaI * cosThetaI);
+        result *= cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+    }
+
+    return std::max(result, 0.0f);
+}
+
+/* Solid angle measure of the directions that a normal cone emits into
+   (each normal emits into the hemisphere around it) */
+static float orientationMeasure(float cosTheta) {
+    float thetaO = safeAcos(cosTheta);
+    float thetaW = std::min(thetaO + 0.5f * (float) M_PI, (float) M_PI);
+    float sinThetaO = std::sin(thetaO);
+    return 2.0f * M_PI * (1.0f - cosTheta) +
+        0.5f * M_PI * (2.0f * thetaW * sinThetaO - std::cos(thetaO - 2.0f * thetaW)
+                       - 2.0f * thetaO * sinThetaO + cosTheta);
+}
+
+/* Cost of a node according to the surface area orientation heuristic */
+static float nodeCost(const LightBounds &bounds, float axisFactor) {
+    if (bounds.isEmpty())
+        return 0.0f;
+    return axisFactor * bounds.power * orientationMeasure(bounds.cosTheta)
+        * bounds.bbox.getSurfaceArea();
+}
+
+void LightBVH::clear() {
+    m_lights.clear();
+    m_nodes.clear();
+    m_trails.clear();
+    m_emitterOffset.clear();
+}
+
+void LightBVH::build(const std::vector<Mesh *> &meshes) {
+    clear();
+
+    std::vector<BuildItem> items;
+    for (const Mesh *mesh : meshes) {
+        if (!mesh->isEmitter())
+            continue;
+        const Emitter *emitter = mesh->getEmitter();
+        const EmitterTriangles &triangles = emitter->getTriangles();
+        float luminance = emitter->getEmission().getLuminance();
+        const MatrixXf &N = mesh->getVertexNormals();
+        const MatrixXu &F = mesh->getIndices();
+
+        m_emitterOffset[emitter] = (uint32_t) m_lights.size();
+        for (uint32_t i = 0; i < triangles.size(); ++i) {
+            LightTriangle light;
+            light.emitter = emitter;
+            light.index = i;
+
+            Point3f p0 = triangles.getP0(i);
+            Point3f p1 = p0 + triangles.getEdge1(i), p2 = p0 + triangles.getEdge2(i);
+
+            BuildItem item;
+            item.bounds.bbox = BoundingBox3f(p0);
+            item.bounds.bbox.expandBy(p1);
+            item.bounds.bbox.expandBy(p2);
+            item.bounds.power = luminance * triangles.area[i] * M_PI;
+            item.centroid = (p0 + p1 + p2) / 3.0f;
+            item.light = (uint32_t) m_lights.size();
+
+            /* Normal cone: the geometric normal, or the cone around the
+               vertex normals when these are interpolated for shading */
+            item.bounds.axis = triangles.getNormal(i);
+            item.bounds.cosTheta = 1.0f;
+            if (N.size() > 0) {
+                Vector3f n0 = N.col(F(0, i)).normalized(), n1 = N.col(F(1, i)).normalized(),
+                         n2 = N.col(F(2, i)).normalized();
+                Vector3f axis = n0 + n1 + n2;
+                if (axis.squaredNorm() > 0.0f) {
+                    item.bounds.axis = axis.normalized();
+                    item.bounds.cosTheta = std::min(std::min(item.bounds.axis.dot(n0),
+                        item.bounds.axis.dot(n1)), item.bounds.axis.dot(n2));
+                } else {
+                    item.bounds.cosTheta = -1.0f;
+                }
+            }
+
+            m_lights.push_back(light);
+            items.push_back(item);
+        }
+    }
+
+    if (items.empty())
+        return;
+
+    m_trails.resize(m_lights.size());
+    m_nodes.reserve(2 * items.size() - 1);
+    build(items, 0, (uint32_t) items.size(), 0, 0);
+}
+
+uint32_t LightBVH::build(std::vector<BuildItem> &items, uint32_t start, uint32_t end,
+                         uint64_t trail, int depth) {
+    uint32_t nodeIndex = (uint32_t) m_nodes.size();
+    m_nodes.emplace_back();
+
+    if (end - start == 1) {
+        Node &node = m_nodes[nodeIndex];
+        node.bounds = items[start].bounds;
+        node.index = items[start].light;
+        node.leaf = true;
+        m_trails[node.index] = trail;
+        return nodeIndex;
+    }
+
+    LightBounds bounds;
+    BoundingBox3f centroidBounds;
+    for (uint32_t i = start; i < end; ++i) {
+        bounds.expandBy(items[i].bounds);
+        centroidBounds.expandBy(items[i].centroid);
+    }
+
+    /* Binned SAOH: evaluate the split planes between the buckets along all axes */
+    Vector3f extents = bounds.bbox.getExtents();
+    Vector3f centroidExtents = centroidBounds.getExtents();
+    float bestCost = std::numeric_limits<float>::infinity();
+    int bestAxis = -1, bestBucket = -1;
+    if (depth < NORI_LIGHTBVH_MEDIAN_DEPTH) {
+        for (int axis = 0; axis < 3; ++axis) {
+            if (centroidExtents[axis] <= 0.0f)
+                continue;
+            LightBounds buckets[NORI_LIGHTBVH_BUCKETS];
+            for (uint32_t i = start; i < end; ++i) {
+                int b = (int) (NORI_LIGHTBVH_BUCKETS * (items[i].centroid[axis] - centroidBounds.min[axis])
+                               / centroidExtents[axis]);
+                buckets[std::min(b, NORI_LIGHTBVH_BUCKETS - 1)].expandBy(items[i].bounds);
+            }
+
+            /* Penalize thin slabs */
+            float axisFactor = extents.maxCoeff() / std::max(extents[axis], Epsilon);
+            for (int split = 0; split < NORI_LIGHTBVH_BUCKETS - 1; ++split) {
+                LightBounds left, right;
+                for (int b = 0; b <= split; ++b)
+                    left.expandBy(buckets[b]);
+                for (int b = split + 1; b < NORI_LIGHTBVH_BUCKETS; ++b)
+                    right.expandBy(buckets[b]);
+                if (left.isEmpty() || right.isEmpty())
+                    continue;
+                float cost = nodeCost(left, axisFactor) + nodeCost(right, axisFactor);
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBucket = split;
+                }
+            }
+        }
+    }
+
+    uint32_t mid;
+    if (bestAxis >= 0) {
+        mid = (uint32_t) (std::partition(items.begin() + start, items.begin() + end,
+            [&](const BuildItem &item) {
+                int b = (int) (NORI_LIGHTBVH_BUCKETS * (item.centroid[bestAxis] - centroidBounds.min[bestAxis])
+                               / centroidExtents[bestAxis]);
+                return std::min(b, NORI_LIGHTBVH_BUCKETS - 1) <= bestBucket;
+            }) - items.begin());
+    } else {
+        /* No useful split plane (or the tree is getting deep): split at the median */
+        int axis = centroidBounds.getLargestAxis();
+        mid = (start + end) / 2;
+        std::nth_element(items.begin() + start, items.begin() + mid, items.begin() + end,
+            [axis](const BuildItem &a, const BuildItem &b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+    }
+
+    build(items, start, mid, trail, depth + 1);
+    uint32_t right = build(items, mid, end, trail | ((uint64_t) 1 << depth), depth + 1);
+
+    Node &node = m_nodes[nodeIndex];
+    node.bounds = bounds;
+    node.index = right;
+    node.leaf = false;
+    return nodeIndex;
+}
+
+float LightBVH::leftProbability(const Node &node, const Point3f &p, const Normal3f &n) const {
+    size_t index = &node - m_nodes.data();
+    float left = m_nodes[index + 1].bounds.importance(p, n);
+    float right = m_nodes[node.index].bounds.importance(p, n);
+    if (left == 0.0f && right == 0.0f)
+        return -1.0f;
+    return left / (left + right);
+}
+
+bool LightBVH::sample(const Point3f &p, const Normal3f &n, EmitQueryRecord &rec,
+                      const Point2f &_sample) const {
+    if (m_nodes.empty() || m_nodes[0].bounds.importance(p, n) == 0.0f)
+        return false;
+
+    Point2f sample(_sample);
+    float pmf = 1.0f;
+    uint32_t nodeIndex = 0;
+    while (!m_nodes[nodeIndex].leaf) {
+        const Node &node = m_nodes[nodeIndex];
+        float probLeft = leftProbability(node, p, n);
+        if (probLeft < 0.0f)
+            return false;
+        if (sample.x() < probLeft) {
+            sample.x() = std::min(sample.x() / probLeft, 1.0f - std::numeric_limits<float>::epsilon());
+            pmf *= probLeft;
+            nodeIndex++;
+        } else {
+            sample.x() = std::min((sample.x() - probLeft) / (1.0f - probLeft),
+                                  1.0f - std::numeric_limits<float>::epsilon());
+            pmf *= 1.0f - probLeft;
+            nodeIndex = node.index;
+        }
+    }
+
+    /* Let the emitter sample a position on the chosen triangle, possibly
+       by the solid angle that it subtends at the shading point */
+    const LightTriangle &light = m_lights[m_nodes[nodeIndex].index];
+    rec.m_ref = p;
+    rec.m_hasRef = true;
+    rec.m_triangle = light.index;
+    light.emitter->sampleTriangle(rec, sample);
+    rec.m_probDensity *= pmf;
+    return true;
+}
+
+float LightBVH::pdf(const Point3f &p, const Normal3f &n, const EmitQueryRecord &rec) const {
+    auto it = m_emitterOffset.find(rec.m_emitter);
+    if (it == m_emitterOffset.end() || m_nodes[0].bounds.importance(p, n) == 0.0f)
+        return 0.0f;
+
+    uint32_t lightIndex = it->second + rec.m_triangle;
+    uint64_t trail = m_trails[lightIndex];
+    float pmf = 1.0f;
+    uint32_t nodeIndex = 0;
+    for (int depth = 0; !m_nodes[nodeIndex].leaf; ++depth) {
+        const Node &node = m_nodes[nodeIndex];
+        float probLeft = leftProbability(node, p, n);
+        if (probLeft < 0.0f)
+            return 0.0f;
+        if ((trail >> depth) & 1) {
+            pmf *= 1.0f - probLeft;
+            nodeIndex = node.index;
+        } else {
+            pmf *= probLeft;
+            nodeIndex++;
+        }
+    }
+
+    if (pmf == 0.0f)
+        return 0.0f;
+
+    EmitQueryRecord query(rec);
+    query.m_ref = p;
+    query.m_hasRef = true;
+    return pmf * rec.m_emitter->pdfTriangle(query);
+}
+
+std::string LightBVH::toString() const {
+    return tfm::format("LightBVH[lights=%i, nodes=%i]", m_lights.size(), m_nodes.size());
+}
+
+NORI_NAMESPACE_END
@@ -24,60 +24,162 @@
 #include <nori/bitmap.h>
 #include <nori/sampler.h>
 #include <nori/integrator.h>
+#include <nori/rfilter.h>
 #include <nori/gui.h>
+#include <nori/context.h>
+#include <nori/distributed.h>
+#include <nori/checkpoint.h>
+#include <nori/film.h>
+#include <nori/numa.h>
+#include <nori/wavefront.h>
 #include <tbb/parallel_for.h>
 #include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
 #include <filesystem/resolver.h>
+#include <atomic>
+#include <mutex>
 #include <thread>
 
 using namespace nori;
 
-static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block) {
-    const Camera *camera = scene->getCamera();
-    const Integrator *integrator = scene->getIntegrator();
-
-    Point2i offset = block.getOffset();
-    Vector2i size  = block.getSize();
-
-    /* Clear the block contents */
-    block.clear();
+/// Command line options that control how a scene is rendered
+struct RenderOptions {
+    /// Number of passes over the image (each taking the sampler's sample count)
+    uint32_t passes = 1;
+    /// Seconds between two checkpoints (or 0 to disable checkpointing)
+    float checkpointInterval = 0.0f;
+    /// Continue the render stored in the checkpoint file
+    bool resume = false;
+    /// Show the partially rendered image in a window
+    bool gui = true;
+    /// Only render this region of the image (if the size is nonzero)
+    Point2i cropOffset = Point2i(0, 0);
+    Vector2i cropSize = Vector2i(0, 0);
+    /// Stream finished tiles to a tiled OpenEXR file
+    bool tiled = false;
+    /// TCP port to listen on for workers (distributed rendering)
+    int coordinatorPort = -1;
+    /// Address of the coordinator (when running as a worker)
+    std::string workerHost;
+    int workerPort = -1;
+    /// Seconds after which the tiles of a silent worker are reassigned
+    float timeout = 600.0f;
+    /// Only render the camera with this index (or all cameras if negative)
+    int camera = -1;
+    /// Use the wavefront renderer instead of calling the integrator per ray
+    bool wavefront = false;
+    /// Sort the wavefront renderer's secondary and shadow rays before tracing them
+    bool reorder = false;
+    /// Pin threads per NUMA node and replicate the scene data on each node
+    bool numa = false;
+};
+
+/// Strip the extension from the scene filename to obtain the output filename
+static std::string outputBaseName(const std::string &filename) {
+    std::string outputName = filename;
+    size_t lastdot = outputName.find_last_of(".");
+    if (lastdot != std::string::npos)
+        outputName.erase(lastdot, std::string::npos);
+    return outputName;
+}
 
-    /* For each pixel and pixel sample sample */
-    for (int y=0; y<size.y(); ++y) {
-        for (int x=0; x<size.x(); ++x) {
-            for (uint32_t i=0; i<sampler->getSampleCount(); ++i) {
-                Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
-                Point2f apertureSample = sampler->next2D();
+/// Return the region of the image that should be rendered
+static void getCropWindow(const Camera *camera, const RenderOptions &options,
+                          Point2i &offset, Vector2i &size) {
+    Vector2i outputSize = camera->getOutputSize();
+    if (options.cropSize.x() == 0 && options.cropSize.y() == 0) {
+        offset = Point2i(0, 0);
+        size = outputSize;
+        return;
+    }
+    offset = options.cropOffset;
+    size = options.cropSize;
+    if ((offset.array() < 0).any() || (size.array() <= 0).any() ||
+        (offset + size).x() > outputSize.x() || (offset + size).y() > outputSize.y())
+        throw NoriException("The crop window must lie within the %ix%i image",
+                            outputSize.x(), outputSize.y());
+}
 
-                /* Sample a ray from the camera */
-                Ray3f ray;
-                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+/// Turn the rendered image into a bitmap and save it (the extension is added automatically)
+static void saveResult(const ImageBlock &result, const std::string &outputName) {
+    /* Now turn the rendered image block into
+       a properly normalized bitmap */
+    std::unique_ptr<Bitmap> bitmap(result.toBitmap());
 
-                /* Compute the incident radiance */
-                value *= integrator->Li(scene, sampler, ray);
+    /* Save using the OpenEXR format */
+    bitmap->saveEXR(outputName);
 
-                /* Store in the image block */
-                block.put(pixelSample, value);
-            }
-        }
-    }
+    /* Save tonemapped (sRGB) output using the PNG format */
+    bitmap->savePNG(outputName);
 }
 
-static void render(Scene *scene, const std::string &filename) {
-    const Camera *camera = scene->getCamera();
-    Vector2i outputSize = camera->getOutputSize();
-    scene->getIntegrator()->preprocess(scene);
+/// Rendering state of the threads working for one NUMA node (or the entire machine)
+struct NodeState {
+    /* Per-thread rendering state (image block, sampler clone, scratch
+       memory). It is created lazily the first time a thread picks up
+       work and then reused for all of its blocks. */
+    tbb::enumerable_thread_specific<RenderContext> contexts;
+    tbb::enumerable_thread_specific<WavefrontRenderer> wavefronts;
 
-    /* Create a block generator (i.e. a work scheduler) */
-    BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE);
+    NodeState(const Scene *scene, bool reorder, SplatFilm *splatFilm)
+        : contexts(scene, splatFilm), wavefronts(scene, reorder) { }
+};
 
-    /* Allocate memory for the entire output image and clear it */
-    ImageBlock result(outputSize, camera->getReconstructionFilter());
-    result.clear();
+static void render(Scene *scene, const std::string &outputName, const RenderOptions &options,
+                   NumaScheduler *numa) {
+    const Camera *camera = scene->getCamera();
+    const ReconstructionFilter *filter = camera->getReconstructionFilter();
+
+    /* Determine the region of the image that should be rendered */
+    Point2i cropOffset;
+    Vector2i cropSize;
+    getCropWindow(camera, options, cropOffset, cropSize);
+
+    if (options.wavefront && scene->getIntegrator()->getWavefrontStrategy() == EWavefrontUnsupported)
+        throw NoriException("The integrator %s does not support --wavefront",
+                            scene->getIntegrator()->toString());
+
+    /* Samples at arbitrary pixels are only added to the image at the end,
+       so they can neither be streamed nor stored in checkpoints */
+    bool splatting = scene->getIntegrator()->usesSplatFilm();
+    if (splatting && (options.tiled || options.checkpointInterval > 0 || options.resume))
+        throw NoriException("The integrator %s cannot be combined with --tiled, "
+                            "--checkpoint or --resume", scene->getIntegrator()->toString());
+
+    /* Allocate memory for the entire output image and clear it. When the
+       image is streamed to disk, only the tiles in progress are kept. */
+    std::unique_ptr<ImageBlock> result;
+    std::unique_ptr<StreamingFilm> stream;
+    if (options.tiled) {
+        int borderSize = ImageBlock(Vector2i(0, 0), filter).getBorderSize();
+        stream.reset(new StreamingFilm(outputName + ".exr", cropOffset,
+                                       cropSize, NORI_BLOCK_SIZE, borderSize));
+    } else {
+        result.reset(new ImageBlock(cropSize, filter));
+        result->setOffset(cropOffset);
+        result->clear();
+    }
+    std::unique_ptr<SplatFilm> splatFilm;
+    if (splatting)
+        splatFilm.reset(new SplatFilm(cropOffset, cropSize));
+
+    /* Keep track of the progress, so that an interrupted render can be resumed */
+    RenderCheckpoint checkpoint(cropOffset, cropSize, (uint32_t) scene->getSampler()->getSampleCount());
+    std::string checkpointName = outputName + ".checkpoint";
+    bool checkpointing = options.checkpointInterval > 0 || options.resume;
+
+    if (options.resume) {
+        checkpoint.load(checkpointName, *result);
+        cout << "Resuming pass " << checkpoint.getPass() + 1 << " from \""
+             << checkpointName << "\"" << endl;
+    }
 
     /* Create a window that visualizes the partially rendered result */
-    nanogui::init();
-    NoriScreen *screen = new NoriScreen(result);
+    NoriScreen *screen = nullptr;
+    if (options.gui) {
+        nanogui::init();
+        screen = new NoriScreen(*result);
+    }
 
     /* Do the following in parallel and asynchronously */
     std::thread render_thread([&] {
@@ -85,75 +187,324 @@ static void render(Scene *scene, const std::string &filename) {
         cout.flush();
         Timer timer;
 
-        tbb::blocked_range<int> range(0, blockGenerator.getBlockCount());
+        /* Serializes merging blocks with writing checkpoints, so that a
+           checkpoint only ever contains completely merged blocks */
+        std::mutex filmMutex;
+        std::atomic<bool> saving(false);
+        std::atomic<double> nextCheckpoint(options.checkpointInterval * 1000.0);
+
+        auto saveCheckpoint = [&] {
+            try {
+                std::lock_guard<std::mutex> lock(filmMutex);
+                checkpoint.save(checkpointName, *result);
+            } catch (const std::exception &e) {
+                cerr << "Could not write checkpoint: " << e.what() << endl;
+            }
+            nextCheckpoint = timer.elapsed() + options.checkpointInterval * 1000.0;
+        };
+
+        /* One set of thread-local state per NUMA node, so that the memory
+           of a context is always touched first by a thread on its node */
+        std::vector<std::unique_ptr<NodeState>> nodes;
+        for (size_t i = 0; i < (numa ? numa->getNodeCount() : 1); ++i)
+            nodes.emplace_back(new NodeState(scene, options.reorder, splatFilm.get()));
+
+        /* Blocks are merged in the order of the block generator, which makes
+           the result independent of the number of threads and NUMA nodes
+           (except for the state that bdpt, sppm and path_guided accumulate
+           using atomicAdd(), which is summed in any order). Streamed images
+           accept blocks in any order (see StreamingFilm) and write the
+           block's tiles as soon as they (and their neighbors) are complete. */
+        OrderedBlockMerger merger(filter, [&](ImageBlock &block) {
+            std::lock_guard<std::mutex> lock(filmMutex);
+            result->put(block);
+            checkpoint.addBlock(block);
+        });
+
+        /* Render the block of a context and merge it into the image */
+        auto process = [&](NodeState &node, RenderContext &context, uint32_t pass, int index) {
+            ImageBlock &block = context.getBlock();
+
+            /* Skip blocks that were completed before the render was resumed */
+            if (checkpoint.isComplete(block)) {
+                merger.skip(index);
+                return;
+            }
 
-        auto map = [&](const tbb::blocked_range<int> &range) {
-            /* Allocate memory for a small image block to be rendered
-               by the current thread */
-            ImageBlock block(Vector2i(NORI_BLOCK_SIZE),
-                camera->getReconstructionFilter());
+            /* Inform the sampler about the block to be rendered */
+            context.getSampler()->prepare(block, pass);
+
+            /* Render all contained pixels */
+            if (options.wavefront)
+                node.wavefronts.local().renderBlock(scene, context);
+            else
+                renderBlock(scene, context);
+
+            /* The image block has been processed. Now add it to
+               the "big" block that represents the entire image */
+            if (stream)
+                stream->put(block);
+            else
+                merger.put(index, block);
+
+            /* Periodically save the progress (one thread at a time) */
+            if (options.checkpointInterval > 0 && timer.elapsed() >= nextCheckpoint &&
+                !saving.exchange(true)) {
+                saveCheckpoint();
+                saving = false;
+            }
+        };
+
+        for (uint32_t pass = checkpoint.getPass(); pass < options.passes; ++pass) {
+            checkpoint.setPass(pass);
+            merger.reset();
+            scene->getIntegrator()->preparePass(scene, pass);
+
+            /* Create a block generator (i.e. a work scheduler) */
+            BlockGenerator blockGenerator(cropSize, NORI_BLOCK_SIZE, cropOffset);
+
+            if (numa) {
+                /* Each node renders short runs of consecutive blocks (and
+                   then helps the others), so its threads work on neighboring
+                   parts of the image while the merger only holds back a few
+                   blocks that finish early */
+                std::vector<std::pair<Point2i, Vector2i>> blocks(blockGenerator.getBlockCount());
+                ImageBlock block(Vector2i(NORI_BLOCK_SIZE), nullptr);
+                for (auto &entry : blocks) {
+                    blockGenerator.next(block);
+                    entry = std::make_pair(block.getOffset(), block.getSize());
+                }
+
+                numa->parallelFor((uint32_t) blocks.size(), [&](uint32_t i, uint32_t n) {
+                    NodeState &node = *nodes[n];
+                    RenderContext &context = node.contexts.local();
+                    RenderContext::Scope scope(context);
+                    context.getBlock().setOffset(blocks[i].first);
+                    context.getBlock().setSize(blocks[i].second);
+                    process(node, context, pass, (int) i);
+                });
+                continue;
+            }
 
-            /* Create a clone of the sampler for the current thread */
-            std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+            tbb::blocked_range<int> range(0, blockGenerator.getBlockCount());
 
-            for (int i=range.begin(); i<range.end(); ++i) {
-                /* Request an image block from the block generator */
-                blockGenerator.next(block);
+            auto map = [&](const tbb::blocked_range<int> &range) {
+                RenderContext &context = nodes[0]->contexts.local();
+                RenderContext::Scope scope(context);
 
-                /* Inform the sampler about the block to be rendered */
-                sampler->prepare(block);
+                for (int i=range.begin(); i<range.end(); ++i) {
+                    /* Request an image block from the block generator */
+                    int index;
+                    blockGenerator.next(context.getBlock(), &index);
+                    process(*nodes[0], context, pass, index);
+                }
+            };
 
-                /* Render all contained pixels */
-                renderBlock(scene, sampler.get(), block);
+            /// Uncomment the following line for single threaded rendering
+            // map(range);
 
-                /* The image block has been processed. Now add it to
-                   the "big" block that represents the entire image */
-                result.put(block);
+            /// Default: parallel rendering
+            tbb::parallel_for(range, map);
+        }
+
+        /* Add the samples splatted to arbitrary pixels. Every pixel sample
+           contributes to the entire image, hence the normalization */
+        if (splatFilm) {
+            Vector2i outputSize = camera->getOutputSize();
+            double sampleCount = (double) cropSize.x() * cropSize.y()
+                * scene->getSampler()->getSampleCount() * options.passes;
+            std::lock_guard<std::mutex> lock(filmMutex);
+            splatFilm->develop(*result, (float) (outputSize.x() * (double) outputSize.y() / sampleCount));
+        }
+
+        /* Save the final state, which allows adding more passes later on */
+        if (checkpointing)
+            saveCheckpoint();
+
+        /* Merge the counters of the individual threads */
+        double elapsed = timer.elapsed() * 1e-3;
+        std::vector<RenderStatistics> threadStats, nodeStats(nodes.size());
+        RenderStatistics stats;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            for (const RenderContext &context : nodes[i]->contexts) {
+                nodeStats[i] += context.getStatistics();
+                threadStats.push_back(context.getStatistics());
             }
-        };
+            stats += nodeStats[i];
+        }
 
-        /// Uncomment the following line for single threaded rendering
-        // map(range);
+        cout << "done. (took " << timer.elapsedString() << ", "
+             << stats.samples << " samples, " << threadStats.size() << " threads, "
+             << tfm::format("%.2f", stats.getRayCount() / std::max(elapsed, 1e-3) * 1e-6)
+             << " Mrays/s, "
+             << tfm::format("%.1f", stats.nodesVisited / (double) std::max(stats.getRayCount(), (uint64_t) 1))
+             << " nodes/ray)" << endl;
+
+        if (numa) {
+            for (size_t i = 0; i < nodes.size(); ++i)
+                cout << "  NUMA node " << numa->getNode(i).id << ": " << nodeStats[i].blocks
+                     << " blocks, " << tfm::format("%.2f", nodeStats[i].getRayCount()
+                                                   / std::max(elapsed, 1e-3) * 1e-6)
+                     << " Mrays/s" << endl;
+            cout << "  At most " << merger.getPeakPendingCount()
+                 << " blocks were held back for merging in order" << endl;
+        }
 
-        /// Default: parallel rendering
-        tbb::parallel_for(range, map);
+        if (stats.invalidSamples > 0)
+            cerr << "Warning: the integrator computed " << stats.invalidSamples
+                 << " invalid radiance values, which were discarded" << endl;
 
-        cout << "done. (took " << timer.elapsedString() << ")" << endl;
+        try {
+            writeStatisticsReport(outputName + "_stats.json", threadStats, elapsed,
+                                  numa ? nodeStats : std::vector<RenderStatistics>());
+        } catch (const std::exception &e) {
+            cerr << "Could not write statistics: " << e.what() << endl;
+        }
     });
 
-    /* Enter the application main loop */
-    nanogui::mainloop();
+    if (options.gui) {
+        /* Enter the application main loop */
+        nanogui::mainloop();
+    }
 
     /* Shut down the user interface */
     render_thread.join();
 
-    delete screen;
-    nanogui::shutdown();
+    if (options.gui) {
+        delete screen;
+        nanogui::shutdown();
+    }
 
-    /* Now turn the rendered image block into
-       a properly normalized bitmap */
-    std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+    if (stream) {
+        cout << "Streamed the image with at most " << stream->getPeakTileCount()
+             << " tiles in memory" << endl;
+        stream.reset();
+    } else {
+        saveResult(*result, outputName);
+    }
+}
 
-    /* Determine the filename of the output bitmap */
-    std::string outputName = filename;
-    size_t lastdot = outputName.find_last_of(".");
-    if (lastdot != std::string::npos)
-        outputName.erase(lastdot, std::string::npos);
+/// Render the scene by distributing its tiles over worker processes (headless)
+static void renderDistributed(Scene *scene, const std::string &outputName,
+                              const RenderOptions &options) {
+    const Camera *camera = scene->getCamera();
 
-    /* Save using the OpenEXR format */
-    bitmap->saveEXR(outputName);
+    Point2i cropOffset;
+    Vector2i cropSize;
+    getCropWindow(camera, options, cropOffset, cropSize);
 
-    /* Save tonemapped (sRGB) output using the PNG format */
-    bitmap->savePNG(outputName);
+    ImageBlock result(cropSize, camera->getReconstructionFilter());
+    result.setOffset(cropOffset);
+    result.clear();
+
+    renderCoordinator(scene, options.coordinatorPort, options.timeout, result);
+
+    saveResult(result, outputName);
+}
+
+static void printUsage(const char *program) {
+    cerr << "Syntax: " << program << " [options] <scene.xml | image.exr>" << endl
+         << "Options:" << endl
+         << "   --passes <count>      Render the image this many times, each pass taking" << endl
+         << "                         the sampler's sample count (default: 1)" << endl
+         << "   --checkpoint <sec>    Save the progress to <scene>.checkpoint this often" << endl
+         << "   --resume              Continue the render saved in <scene>.checkpoint" << endl
+         << "   --nogui               Don't show the partially rendered image" << endl
+         << "   --crop <x> <y> <w> <h>  Only render the given region of the image" << endl
+         << "   --camera <index>      Only render the given camera (default: render all" << endl
+         << "                         cameras of the scene, one image per camera)" << endl
+         << "   --wavefront           Trace large batches of paths one bounce at a time" << endl
+         << "                         (path tracing integrators only)" << endl
+         << "   --reorder             Sort secondary and shadow rays by origin and" << endl
+         << "                         direction before tracing them (implies --wavefront)" << endl
+         << "   --numa                Pin the rendering threads to NUMA nodes, keep a copy" << endl
+         << "                         of the scene's BVH on every node and render" << endl
+         << "                         neighboring blocks on the same node" << endl
+         << "   --tiled               Write finished tiles to a tiled OpenEXR file while" << endl
+         << "                         rendering instead of keeping the entire image in" << endl
+         << "                         memory (implies --nogui, no PNG output)" << endl
+         << "   --coordinator <port>  Distribute the tiles of the image over worker" << endl
+         << "                         processes connecting to this port (single pass," << endl
+         << "                         no checkpoints)" << endl
+         << "   --worker <host:port>  Render tiles on behalf of a coordinator" << endl
+         << "   --timeout <seconds>   Reassign the tiles of workers that have not" << endl
+         << "                         delivered a tile for this long (default: 600)" << endl;
 }
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        cerr << "Syntax: " << argv[0] << " <scene.xml>" << endl;
+    std::string filename;
+    RenderOptions options;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--passes" && i + 1 < argc) {
+                int passes = toInt(argv[++i]);
+                if (passes < 1)
+                    throw NoriException("The number of passes must be positive");
+                options.passes = (uint32_t) passes;
+            } else if (arg == "--checkpoint" && i + 1 < argc) {
+                options.checkpointInterval = toFloat(argv[++i]);
+            } else if (arg == "--resume") {
+                options.resume = true;
+            } else if (arg == "--nogui") {
+                options.gui = false;
+            } else if (arg == "--crop" && i + 4 < argc) {
+                options.cropOffset = Point2i(toInt(argv[i + 1]), toInt(argv[i + 2]));
+                options.cropSize = Vector2i(toInt(argv[i + 3]), toInt(argv[i + 4]));
+                i += 4;
+            } else if (arg == "--camera" && i + 1 < argc) {
+                options.camera = toInt(argv[++i]);
+            } else if (arg == "--wavefront") {
+                options.wavefront = true;
+            } else if (arg == "--reorder") {
+                options.wavefront = true;
+                options.reorder = true;
+            } else if (arg == "--numa") {
+                options.numa = true;
+            } else if (arg == "--tiled") {
+                options.tiled = true;
+                options.gui = false;
+            } else if (arg == "--coordinator" && i + 1 < argc) {
+                options.coordinatorPort = toInt(argv[++i]);
+            } else if (arg == "--worker" && i + 1 < argc) {
+                std::string address = argv[++i];
+                size_t colon = address.find_last_of(':');
+                if (colon == std::string::npos)
+                    throw NoriException("Expected an address of the form host:port, got \"%s\"", address);
+                options.workerHost = address.substr(0, colon);
+                options.workerPort = toInt(address.substr(colon + 1));
+            } else if (arg == "--timeout" && i + 1 < argc) {
+                options.timeout = toFloat(argv[++i]);
+            } else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0) {
+                throw NoriException("Unknown option \"%s\"", arg);
+            } else if (filename.empty()) {
+                filename = arg;
+            } else {
+                throw NoriException("Only one input file may be specified");
+            }
+        }
+        if (filename.empty())
+            throw NoriException("No input file specified");
+        if (options.coordinatorPort >= 0 && options.workerPort >= 0)
+            throw NoriException("--coordinator and --worker are mutually exclusive");
+        if (options.wavefront && (options.coordinatorPort >= 0 || options.workerPort >= 0))
+            throw NoriException("--wavefront is only supported for local renders");
+        if (options.coordinatorPort >= 0 && (options.passes > 1 || options.resume ||
+                                             options.checkpointInterval > 0))
+            throw NoriException("--coordinator renders a single pass and cannot be combined with "
+                                "--passes, --checkpoint or --resume");
+        if (options.tiled && (options.passes > 1 || options.resume ||
+                              options.checkpointInterval > 0 || options.coordinatorPort >= 0))
+            throw NoriException("--tiled renders a single pass and cannot be combined with "
+                                "--passes, --checkpoint, --resume or --coordinator");
+    } catch (const std::exception &e) {
+        cerr << "Error: " << e.what() << endl;
+        printUsage(argv[0]);
         return -1;
     }
 
-    filesystem::path path(argv[1]);
+    filesystem::path path(filename);
 
     try {
         if (path.extension() == "xml") {
@@ -162,14 +513,70 @@ int main(int argc, char **argv) {
                resources (OBJ files, textures) using relative paths */
             getFileResolver()->prepend(path.parent_path());
 
-            std::unique_ptr<NoriObject> root(loadFromXML(argv[1]));
+            std::unique_ptr<NoriObject> root(loadFromXML(filename));
 
             /* When the XML root object is a scene, start rendering it .. */
-            if (root->getClassType() == NoriObject::EScene)
-                render(static_cast<Scene *>(root.get()), argv[1]);
+            if (root->getClassType() == NoriObject::EScene) {
+                Scene *scene = static_cast<Scene *>(root.get());
+                scene->getIntegrator()->preprocess(scene);
+
+                /* Render all cameras, or just the requested one */
+                size_t firstCamera = 0, lastCamera = scene->getCameraCount();
+                if (options.camera >= 0) {
+                    scene->setActiveCamera((size_t) options.camera);
+                    firstCamera = (size_t) options.camera;
+                    lastCamera = firstCamera + 1;
+                }
+
+                const Integrator *integrator = scene->getIntegrator();
+                if ((integrator->usesSplatFilm() || integrator->requiresPasses()) &&
+                    (options.workerPort >= 0 || options.coordinatorPort >= 0))
+                    throw NoriException("The integrator %s does not support distributed rendering",
+                                        integrator->toString());
+
+                if (options.workerPort >= 0) {
+                    renderWorker(scene, options.workerHost, options.workerPort);
+                } else if (options.coordinatorPort >= 0 && lastCamera - firstCamera > 1) {
+                    throw NoriException("The scene has %i cameras; please select the one to "
+                                        "distribute using --camera", scene->getCameraCount());
+                } else {
+                    /* Replicate the acceleration data structure on every NUMA node */
+                    std::unique_ptr<NumaScheduler> numa;
+                    if (options.numa && options.coordinatorPort < 0) {
+                        numa.reset(new NumaScheduler(getNumaNodes()));
+                        cout << "Replicating the scene on " << numa->getNodeCount()
+                             << " NUMA node(s) .. ";
+                        cout.flush();
+                        numa->forEachNode([&](uint32_t node) {
+                            scene->getAccel()->addReplica(node);
+                        });
+                        cout << "done." << endl;
+                    }
+
+                    /* The scene, its acceleration data structure and the thread
+                       pool are shared by all frames */
+                    std::string outputName = outputBaseName(filename);
+                    for (size_t i = firstCamera; i < lastCamera; ++i) {
+                        scene->setActiveCamera(i);
+
+                        /* Number the output files if there are several cameras */
+                        std::string frameName = outputName;
+                        if (scene->getCameraCount() > 1) {
+                            frameName += tfm::format("_%04i", i);
+                            cout << "Rendering camera " << i + 1 << " of "
+                                 << scene->getCameraCount() << endl;
+                        }
+
+                        if (options.coordinatorPort >= 0)
+                            renderDistributed(scene, frameName, options);
+                        else
+                            render(scene, frameName, options, numa.get());
+                    }
+                }
+            }
         } else if (path.extension() == "exr") {
             /* Alternatively, provide a basic OpenEXR image viewer */
-            Bitmap bitmap(argv[1]);
+            Bitmap bitmap(filename);
             ImageBlock block(Vector2i((int) bitmap.cols(), (int) bitmap.rows()), nullptr);
             block.fromBitmap(bitmap);
             nanogui::init();
@@ -178,7 +585,7 @@ int main(int argc, char **argv) {
             delete screen;
             nanogui::shutdown();
         } else {
-            cerr << "Fatal error: unknown file \"" << argv[1]
+            cerr << "Fatal error: unknown file \"" << filename
                  << "\", expected an extension of type .xml or .exr" << endl;
         }
     } catch (const std::exception &e) {
@@ -113,16 +113,17 @@ public:
         bRec.eta = 1.0f;
         bRec.measure = ESolidAngle;
 
-        // Specular Case
-        if (((float)rand()) / RAND_MAX < m_ks) {
-            Point2f point = _sample;
+        // Specular Case (the first component picks the lobe and is then
+        // rescaled to [0, 1] so that it can be reused for the direction)
+        if (_sample.x() < m_ks) {
+            Point2f point(_sample.x() / m_ks, _sample.y());
             Vector3f wn = Warp::squareToBeckmann(point, m_alpha);
             // calculates the reflected value
             bRec.wo = 2 * wn * bRec.wi.dot(wn) - bRec.wi;
         }
         // Diffuse Case
         else {
-            Point2f point = _sample;
+            Point2f point((_sample.x() - m_ks) / (1.0f - m_ks), _sample.y());
             bRec.wo = Warp::squareToCosineHemisphere(point);
         }
 
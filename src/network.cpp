@@ -0,0 +1,203 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/network.h>
+#include <cstring>
+
+#if defined(_WIN32)
+#  include <winsock2.h>
+#  include <ws2tcpip.h>
+#  pragma comment(lib, "ws2_32.lib")
+   typedef int socklen_t;
+#  define NORI_SOCKET_ERROR() WSAGetLastError()
+#else
+#  include <sys/types.h>
+#  include <sys/socket.h>
+#  include <sys/select.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <arpa/inet.h>
+#  include <netdb.h>
+#  include <unistd.h>
+#  include <errno.h>
+#  define NORI_SOCKET_ERROR() errno
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+#if defined(_WIN32)
+/* Winsock needs to be initialized once per process */
+static struct WinsockInitializer {
+    WinsockInitializer() { WSADATA data; WSAStartup(MAKEWORD(2, 2), &data); }
+    ~WinsockInitializer() { WSACleanup(); }
+} __winsockInitializer;
+#endif
+
+static std::string describe(const sockaddr_storage &addr) {
+    char host[NI_MAXHOST], port[NI_MAXSERV];
+    if (getnameinfo((const sockaddr *) &addr, sizeof(addr), host, sizeof(host),
+                    port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+        return "<unknown>";
+    return tfm::format("%s:%s", host, port);
+}
+
+Socket &Socket::operator=(Socket &&other) {
+    if (this != &other) {
+        close();
+        m_fd = other.m_fd;
+        m_peerName = std::move(other.m_peerName);
+        other.m_fd = -1;
+    }
+    return *this;
+}
+
+Socket Socket::listen(int port) {
+    Socket result;
+    result.m_fd = (int64_t) ::socket(AF_INET, SOCK_STREAM, 0);
+    if (result.m_fd == -1)
+        throw NoriException("Socket::listen(): could not create socket (error %i)", NORI_SOCKET_ERROR());
+
+    int flag = 1;
+    setsockopt((int) result.m_fd, SOL_SOCKET, SO_REUSEADDR, (const char *) &flag, sizeof(flag));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t) port);
+
+    if (::bind((int) result.m_fd, (const sockaddr *) &addr, sizeof(addr)) != 0)
+        throw NoriException("Socket::listen(): could not bind to port %i (error %i)", port, NORI_SOCKET_ERROR());
+    if (::listen((int) result.m_fd, 64) != 0)
+        throw NoriException("Socket::listen(): could not listen on port %i (error %i)", port, NORI_SOCKET_ERROR());
+
+    result.m_peerName = tfm::format("*:%i", port);
+    return result;
+}
+
+Socket Socket::connect(const std::string &host, int port) {
+    addrinfo hints, *info = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    std::string service = std::to_string(port);
+    if (getaddrinfo(host.c_str(), service.c_str(), &hints, &info) != 0 || !info)
+        throw NoriException("Socket::connect(): could not resolve \"%s\"", host);
+
+    Socket result;
+    for (addrinfo *it = info; it; it = it->ai_next) {
+        int64_t fd = (int64_t) ::socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+        if (fd == -1)
+            continue;
+        if (::connect((int) fd, it->ai_addr, (socklen_t) it->ai_addrlen) == 0) {
+            result.m_fd = fd;
+            break;
+        }
+#if defined(_WIN32)
+        closesocket((SOCKET) fd);
+#else
+        ::close((int) fd);
+#endif
+    }
+    freeaddrinfo(info);
+
+    if (result.m_fd == -1)
+        throw NoriException("Socket::connect(): could not connect to %s:%i", host, port);
+
+    /* Messages are small and latency-sensitive */
+    int flag = 1;
+    setsockopt((int) result.m_fd, IPPROTO_TCP, TCP_NODELAY, (const char *) &flag, sizeof(flag));
+    result.m_peerName = tfm::format("%s:%i", host, port);
+    return result;
+}
+
+Socket Socket::accept() {
+    sockaddr_storage addr;
+    socklen_t addrLen = sizeof(addr);
+    Socket result;
+    result.m_fd = (int64_t) ::accept((int) m_fd, (sockaddr *) &addr, &addrLen);
+    if (result.m_fd == -1)
+        throw NoriException("Socket::accept(): failed (error %i)", NORI_SOCKET_ERROR());
+
+    int flag = 1;
+    setsockopt((int) result.m_fd, IPPROTO_TCP, TCP_NODELAY, (const char *) &flag, sizeof(flag));
+    result.m_peerName = describe(addr);
+    return result;
+}
+
+bool Socket::waitReadable(double timeout) {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET((int) m_fd, &fds);
+
+    timeval tv;
+    tv.tv_sec = (long) timeout;
+    tv.tv_usec = (long) ((timeout - (double) tv.tv_sec) * 1e6);
+
+    int result = ::select((int) m_fd + 1, &fds, nullptr, nullptr, &tv);
+    if (result < 0)
+        throw NoriException("Socket::waitReadable(): failed (error %i)", NORI_SOCKET_ERROR());
+    return result > 0;
+}
+
+void Socket::send(const void *data, size_t size) {
+    const char *ptr = (const char *) data;
+    while (size > 0) {
+#if defined(MSG_NOSIGNAL)
+        /* Don't raise SIGPIPE when the peer has died */
+        auto sent = ::send((int) m_fd, ptr, size, MSG_NOSIGNAL);
+#else
+        auto sent = ::send((int) m_fd, ptr, (int) size, 0);
+#endif
+        if (sent <= 0)
+            throw NoriException("Socket::send(): connection to %s lost (error %i)",
+                                m_peerName, NORI_SOCKET_ERROR());
+        ptr += sent;
+        size -= (size_t) sent;
+    }
+}
+
+bool Socket::receive(void *data, size_t size) {
+    char *ptr = (char *) data;
+    size_t total = size;
+    while (size > 0) {
+        auto received = ::recv((int) m_fd, ptr, (int) std::min(size, (size_t) (1 << 30)), 0);
+        if (received == 0 && size == total)
+            return false; /* Orderly shutdown between two messages */
+        if (received <= 0)
+            throw NoriException("Socket::receive(): connection to %s lost (error %i)",
+                                m_peerName, NORI_SOCKET_ERROR());
+        ptr += received;
+        size -= (size_t) received;
+    }
+    return true;
+}
+
+void Socket::close() {
+    if (m_fd == -1)
+        return;
+#if defined(_WIN32)
+    closesocket((SOCKET) m_fd);
+#else
+    ::close((int) m_fd);
+#endif
+    m_fd = -1;
+}
+
+NORI_NAMESPACE_END
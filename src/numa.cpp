@@ -0,0 +1,215 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/numa.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
+#include <atomic>
+#include <fstream>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+/// Maximum node identifier that is probed in sysfs
+#define NORI_MAX_NUMA_NODES 256
+
+/// Number of consecutive work items that are handed to a node at a time
+#define NORI_NUMA_CHUNK_SIZE 16
+
+/* Index of the node that the current thread has been pinned to */
+static thread_local int t_numaNode = -1;
+
+/// Parse a Linux CPU list such as "0-7,16-23"
+static std::vector<int> parseCpuList(const std::string &str) {
+    std::vector<int> result;
+    for (const std::string &range : tokenize(str, ",\n")) {
+        size_t dash = range.find('-');
+        int first = toInt(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : toInt(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; ++cpu)
+            result.push_back(cpu);
+    }
+    return result;
+}
+
+std::vector<NumaNode> getNumaNodes() {
+    std::vector<NumaNode> nodes;
+
+#if defined(__linux__)
+    for (int id = 0; id < NORI_MAX_NUMA_NODES; ++id) {
+        std::ifstream is(tfm::format("/sys/devices/system/node/node%i/cpulist", id));
+        std::string line;
+        if (!is || !std::getline(is, line))
+            continue;
+        try {
+            NumaNode node;
+            node.id = id;
+            node.cpus = parseCpuList(line);
+            /* Skip memory-only nodes */
+            if (!node.cpus.empty())
+                nodes.push_back(node);
+        } catch (const std::exception &) {
+            nodes.clear();
+            break;
+        }
+    }
+#endif
+
+    if (nodes.empty()) {
+        NumaNode node;
+        node.id = 0;
+        for (int cpu = 0; cpu < (int) std::max(std::thread::hardware_concurrency(), 1u); ++cpu)
+            node.cpus.push_back(cpu);
+        nodes.push_back(node);
+    }
+
+    return nodes;
+}
+
+bool pinCurrentThread(const std::vector<int> &cpus) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+int getCurrentNumaNode() {
+    return t_numaNode;
+}
+
+/* Pin the calling thread to a node, unless it already is */
+static void bindToNode(const std::vector<NumaNode> &nodes, uint32_t index) {
+    if (t_numaNode == (int) index)
+        return;
+    pinCurrentThread(nodes[index].cpus);
+    t_numaNode = (int) index;
+}
+
+struct NumaScheduler::NodeState {
+    tbb::task_arena arena;
+    /// Chunks of work items assigned to the node (in increasing order)
+    std::vector<uint32_t> chunks;
+    /// Position of the next item within the node's chunks
+    std::atomic<uint32_t> next;
+    uint32_t end = 0;
+
+    /* One slot is reserved for the thread that enters the arena */
+    NodeState(int threads) : arena(threads, 1), next(0) { }
+};
+
+NumaScheduler::NumaScheduler(const std::vector<NumaNode> &nodes) : m_nodes(nodes) {
+    if (m_nodes.empty())
+        throw NoriException("NumaScheduler: no NUMA nodes were specified");
+    for (const NumaNode &node : m_nodes)
+        m_state.emplace_back(new NodeState((int) std::max(node.cpus.size(), (size_t) 1)));
+}
+
+NumaScheduler::~NumaScheduler() { }
+
+void NumaScheduler::forEachNode(const std::function<void(uint32_t)> &func) {
+    for (uint32_t n = 0; n < (uint32_t) m_nodes.size(); ++n) {
+        std::thread thread([&] {
+            bindToNode(m_nodes, n);
+            func(n);
+        });
+        thread.join();
+    }
+}
+
+void NumaScheduler::parallelFor(uint32_t count, const std::function<void(uint32_t, uint32_t)> &func) {
+    uint32_t nodeCount = (uint32_t) m_nodes.size();
+
+    /* Deal out chunks of consecutive items to the nodes in turn, in
+       proportion to their number of processors (smooth weighted round
+       robin). All nodes thus advance through the items at a similar pace. */
+    int64_t totalCpus = 0;
+    for (const NumaNode &node : m_nodes)
+        totalCpus += (int64_t) std::max(node.cpus.size(), (size_t) 1);
+    std::vector<int64_t> credit(nodeCount, 0);
+    for (uint32_t n = 0; n < nodeCount; ++n)
+        m_state[n]->chunks.clear();
+    uint32_t chunkCount = (count + NORI_NUMA_CHUNK_SIZE - 1) / NORI_NUMA_CHUNK_SIZE;
+    for (uint32_t chunk = 0; chunk < chunkCount; ++chunk) {
+        uint32_t best = 0;
+        for (uint32_t n = 0; n < nodeCount; ++n) {
+            credit[n] += (int64_t) std::max(m_nodes[n].cpus.size(), (size_t) 1);
+            if (credit[n] > credit[best])
+                best = n;
+        }
+        credit[best] -= totalCpus;
+        m_state[best]->chunks.push_back(chunk);
+    }
+    for (uint32_t n = 0; n < nodeCount; ++n) {
+        m_state[n]->next = 0;
+        m_state[n]->end = (uint32_t) m_state[n]->chunks.size() * NORI_NUMA_CHUNK_SIZE;
+    }
+
+    /* Fetch the next item of node 'n' (or return false if there is none) */
+    auto fetch = [&](uint32_t n, uint32_t &item) {
+        NodeState &state = *m_state[n];
+        if (state.next.load() >= state.end)
+            return false;
+        uint32_t position = state.next++;
+        if (position >= state.end)
+            return false;
+        item = state.chunks[position / NORI_NUMA_CHUNK_SIZE] * NORI_NUMA_CHUNK_SIZE
+             + position % NORI_NUMA_CHUNK_SIZE;
+        /* Only the very last chunk can be incomplete */
+        return item < count;
+    };
+
+    auto worker = [&](uint32_t n) {
+        bindToNode(m_nodes, n);
+        uint32_t item;
+        /* Process the local share, then steal from the other nodes */
+        for (uint32_t k = 0; k < nodeCount; ++k) {
+            uint32_t victim = (n + k) % nodeCount;
+            while (fetch(victim, item))
+                func(item, n);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t n = 0; n < nodeCount; ++n) {
+        threads.emplace_back([&, n] {
+            bindToNode(m_nodes, n);
+            m_state[n]->arena.execute([&] {
+                tbb::task_group group;
+                for (size_t i = 0; i < m_nodes[n].cpus.size(); ++i)
+                    group.run([&, n] { worker(n); });
+                group.wait();
+            });
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
+NORI_NAMESPACE_END
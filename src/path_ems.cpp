@@ -3,99 +3,101 @@
 #include <nori/mesh.h>
 #include <nori/emitter.h>
 #include <nori/bsdf.h>
-#include <nori/dpdf.h>
-#include <nori/warp.h>
-#include <stdlib.h>
+#include <nori/sampler.h>
 
 NORI_NAMESPACE_BEGIN
 
+/**
+ * \brief Path tracer using emitter sampling
+ *
+ * At every non-specular vertex, a position on an emitter is sampled from
+ * the scene's light hierarchy and connected using a shadow ray (next event
+ * estimation). The path is then extended by sampling the BSDF. Emission
+ * found by BSDF sampling is only counted for camera rays and after
+ * specular bounces, which next event estimation cannot handle; elsewhere
+ * it has already been accounted for by the shadow ray.
+ *
+ * Paths are terminated using Russian roulette based on their throughput.
+ */
 class PathEmsIntegrator : public Integrator {
 public:
-
-    PathEmsIntegrator(const PropertyList& props) {
-        // Do nothing
+    PathEmsIntegrator(const PropertyList &props) {
+        /* No parameters this time */
     }
 
-    Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f& ray) const {
-
-        Color3f c(0.0f), alpha(1.0f);
-        float eta = 1.f;
-
-        std::vector<Mesh*> emitterMeshes = std::vector<Mesh*>(); // meshes that have emitters
-        DiscretePDF dpdf = DiscretePDF();
-        dpdf.clear();
-
-        for (Mesh* m : scene->getMeshes()) {
-            if (m->isEmitter()) {
-                dpdf.append(1.0f);
-                emitterMeshes.push_back(m);
-            }
-        }
-
-        dpdf.normalize();
-
-        Intersection hitRecord;
-        Ray3f pathRay(ray.o, ray.d);
-
-        if (!scene->rayIntersect(pathRay, hitRecord))
-            return c;
-
-
-        for (int k = 0; ; ++k) {
-
-            const BSDF* bsdf = hitRecord.mesh->getBSDF();
-            const Emitter* em = hitRecord.mesh->getEmitter();
-
-            BSDFQueryRecord bRec(Vector3f(0.0f, 0.0f, 0.0f));
-
-            // If it hits light source, it adds it
-            if (em != nullptr) {
-                EmitQueryRecord eRec(hitRecord.shFrame.toLocal(-pathRay.d), hitRecord.p, hitRecord.shFrame.n);
-                c = em->getEmission(); // add or reassign?
-                bRec = BSDFQueryRecord(hitRecord.shFrame.toLocal(-pathRay.d));
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &_ray) const {
+        const LightBVH &lights = scene->getLightBVH();
+        Color3f result(0.0f), throughput(1.0f);
+        float eta = 1.0f;
+        bool specular = true;
+
+        Ray3f ray(_ray);
+        Intersection its;
+        if (!scene->rayIntersect(ray, its))
+            return result;
+
+        while (true) {
+            const Emitter *emitter = its.mesh->getEmitter();
+            if (emitter && specular) {
+                EmitQueryRecord eRec;
+                eRec.m_p = its.p;
+                eRec.m_np = its.shFrame.n;
+                eRec.m_wo = -ray.d;
+                eRec.m_emitter = emitter;
+                eRec.m_triangle = its.triangle;
+                result += throughput * emitter->eval(eRec);
             }
-            else {
-                float emitterPDF;
-                Mesh* eMesh = emitterMeshes.at(dpdf.sample(sampler->next1D(), emitterPDF)); // chooses a random emitter to sample from
-
-                Emitter* x = eMesh->getEmitter();
-
-                EmitQueryRecord eqr = EmitQueryRecord();
-                x->sample(eqr, sampler->next2D());
-
-                Vector3f nextDir = eqr.m_p - hitRecord.p;
-                nextDir.normalize();
-                
-                bRec = BSDFQueryRecord(hitRecord.shFrame.toLocal(-pathRay.d), hitRecord.shFrame.toLocal(nextDir), ESolidAngle);
-            
 
+            const BSDF *bsdf = its.mesh->getBSDF();
+            Vector3f wi = its.toLocal(-ray.d);
+
+            /* Next event estimation (not possible for specular surfaces) */
+            EmitQueryRecord lRec;
+            if (bsdf->isDiffuse() && lights.sample(its.p, its.shFrame.n, lRec, sampler->next2D())) {
+                Vector3f d = lRec.m_p - its.p;
+                float dist2 = d.squaredNorm(), dist = std::sqrt(dist2);
+                d /= dist;
+                lRec.m_wo = -d;
+                float cosLight = lRec.m_np.dot(-d);
+                Color3f Le = lRec.m_emitter->eval(lRec);
+
+                if (cosLight > 0.0f && !Le.isZero()) {
+                    BSDFQueryRecord bRec(wi, its.toLocal(d), ESolidAngle);
+                    Color3f f = bsdf->eval(bRec);
+                    if (!f.isZero() && !scene->rayIntersect(Ray3f(its.p, d, Epsilon, dist * (1.0f - Epsilon)))) {
+                        float lightPdf = lRec.m_probDensity * dist2 / cosLight;
+                        result += throughput * f * Le * std::abs(Frame::cosTheta(bRec.wo)) / lightPdf;
+                    }
+                }
             }
 
-            // This is probably wrong
-            Color3f xcolor = bsdf->sample(bRec, sampler->next2D());
-            c += alpha * xcolor /* Frame::cosTheta(nextDir)*/;// / bsdf->pdf(bRec);
+            /* Russian roulette */
+            float prob = std::min(throughput.maxCoeff() * eta * eta, 0.99f);
+            if (sampler->next1D() >= prob)
+                break;
+            throughput /= prob;
 
-            // Breaks with probability
-            float prob = fmin(fmax(fmax(alpha[0], alpha[1]), alpha[2]) * pow(eta, 2), 0.99);
-            if (sampler->next1D() < prob) {
+            /* BSDF sampling */
+            BSDFQueryRecord bRec(wi);
+            Color3f f = bsdf->sample(bRec, sampler->next2D());
+            if (f.isZero())
                 break;
-            }
+            throughput *= f;
+            eta *= bRec.eta;
+            specular = !bsdf->isDiffuse();
 
-            pathRay = Ray3f(hitRecord.p, hitRecord.shFrame.toWorld(bRec.wo));
-            if (!scene->rayIntersect(pathRay, hitRecord))
+            ray = Ray3f(its.p, its.toWorld(bRec.wo));
+            if (!scene->rayIntersect(ray, its))
                 break;
-            //*= bsdf->eval(BSDFQueryRecord(bRec.wi, bRec.wo, ESolidAngle))
-            alpha /= (1 - prob);
         }
 
-        return c;
+        return result;
     }
 
     std::string toString() const {
         return "PathEmsIntegrator[]";
     }
-
 };
 
 NORI_REGISTER_CLASS(PathEmsIntegrator, "path_ems");
-NORI_NAMESPACE_END
\ No newline at end of file
+NORI_NAMESPACE_END
@@ -0,0 +1,282 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/mesh.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/sampler.h>
+#include <nori/sdtree.h>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/// Maximum number of vertices of a path whose incident radiance is learned
+#define NORI_GUIDED_MAX_VERTICES 32
+
+/**
+ * \brief Path tracer guided by an online-learned SD-tree ("Practical Path
+ * Guiding", Mueller et al. 2017)
+ *
+ * This extends \c path_mis: at non-specular vertices, the next direction
+ * is drawn from a mixture of BSDF sampling (with probability \c
+ * bsdfSamplingFraction) and the incident radiance distribution learned at
+ * the vertex's position. Both next event estimation and emitters found by
+ * the sampled directions are weighted using the mixture's density, which
+ * keeps the estimate unbiased no matter how good the guiding distribution
+ * is.
+ *
+ * The first \c trainingPasses rendering passes are training passes: the
+ * radiance arriving at every vertex along the sampled direction is recorded
+ * into the SD-tree. After each of them, the tree is refined (see \ref
+ * SDTree::refine()) and the next pass samples from what was learned. Leaves
+ * are split once they have received more than <tt>spatialThreshold *
+ * sqrt(sampleCount)</tt> samples in a pass, and quadrants holding more than
+ * \c directionalThreshold of a leaf's energy are subdivided.
+ *
+ * Since all passes are unbiased, the images of the training passes are
+ * kept and averaged with the others. The SD-tree is trained by all threads
+ * at once, and the order of their updates affects the learned distribution
+ * slightly, which makes the renders depend on the thread count.
+ */
+class GuidedPathIntegrator : public Integrator {
+public:
+    GuidedPathIntegrator(const PropertyList &props) {
+        /* Number of passes in which the incident radiance is learned */
+        m_trainingPasses = props.getInteger("trainingPasses", 6);
+
+        /* Probability of sampling the BSDF instead of the learned distribution */
+        m_bsdfSamplingFraction = props.getFloat("bsdfSamplingFraction", 0.5f);
+
+        /* Refinement criteria of the spatial and directional trees */
+        m_spatialThreshold = props.getFloat("spatialThreshold", 12000.0f);
+        m_directionalThreshold = props.getFloat("directionalThreshold", 0.01f);
+
+        if (m_trainingPasses < 0)
+            throw NoriException("GuidedPathIntegrator: 'trainingPasses' must be nonnegative!");
+        if (m_bsdfSamplingFraction <= 0.0f || m_bsdfSamplingFraction > 1.0f)
+            throw NoriException("GuidedPathIntegrator: 'bsdfSamplingFraction' must be in (0, 1]!");
+        if (m_spatialThreshold <= 0.0f || m_directionalThreshold <= 0.0f)
+            throw NoriException("GuidedPathIntegrator: the refinement thresholds must be positive!");
+    }
+
+    bool requiresPasses() const { return true; }
+
+    void preparePass(const Scene *scene, uint32_t pass) {
+        if (pass == 0 || !m_tree) {
+            m_tree.reset(new SDTree(scene->getBoundingBox()));
+        } else if (m_training) {
+            /* Learn from the training pass that was just completed */
+            float sampleCount = (float) scene->getSampler()->getSampleCount();
+            m_tree->refine((uint32_t) (m_spatialThreshold * std::sqrt(sampleCount)),
+                           m_directionalThreshold);
+            cout << "Path guiding: refined after pass " << pass << ": "
+                 << m_tree->toString() << endl;
+        }
+        m_training = pass < (uint32_t) m_trainingPasses;
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &_ray) const {
+        const LightBVH &lights = scene->getLightBVH();
+        Color3f result(0.0f), throughput(1.0f);
+        float eta = 1.0f;
+
+        Ray3f ray(_ray);
+        Intersection its;
+        if (!scene->rayIntersect(ray, its))
+            return result;
+
+        /* State of the previous vertex for weighting emission found by BSDF sampling */
+        bool specular = true;
+        float bsdfPdf = 0.0f;
+        Point3f prevP;
+        Normal3f prevN;
+
+        /* Vertices whose incident radiance is recorded (training passes only) */
+        Vertex vertices[NORI_GUIDED_MAX_VERTICES];
+        int vertexCount = 0;
+        bool prevRecorded = false;
+
+        while (true) {
+            const Emitter *emitter = its.mesh->getEmitter();
+            if (emitter) {
+                EmitQueryRecord eRec;
+                eRec.m_p = its.p;
+                eRec.m_np = its.shFrame.n;
+                eRec.m_wo = -ray.d;
+                eRec.m_emitter = emitter;
+                eRec.m_triangle = its.triangle;
+                Color3f Le = throughput * emitter->eval(eRec);
+
+                if (specular) {
+                    result += Le;
+                    addRadiance(vertices, vertexCount, Le);
+                } else if (!Le.isZero()) {
+                    float cosLight = std::abs(its.shFrame.n.dot(ray.d));
+                    float lightPdf = lights.pdf(prevP, prevN, eRec)
+                        * its.t * its.t / cosLight;
+                    Color3f weighted = Le * powerHeuristic(bsdfPdf, lightPdf);
+                    result += weighted;
+
+                    /* The vertex that sampled this direction learns the
+                       full emission, the ones before it what was rendered */
+                    int count = prevRecorded ? vertexCount - 1 : vertexCount;
+                    addRadiance(vertices, count, weighted);
+                    if (prevRecorded)
+                        addRadiance(vertices + count, 1, Le);
+                }
+            }
+
+            const BSDF *bsdf = its.mesh->getBSDF();
+            Vector3f wi = its.toLocal(-ray.d);
+            bool diffuse = bsdf->isDiffuse();
+
+            /* Learned distribution at this position (if it is to be used) */
+            SDTree::Leaf *leaf = (diffuse && m_tree) ? &m_tree->lookup(its.p) : nullptr;
+            const DirectionalQuadTree *guide =
+                (leaf && leaf->sampling.getEnergy() > 0.0f) ? &leaf->sampling : nullptr;
+
+            /* Next event estimation (not possible for specular surfaces) */
+            EmitQueryRecord lRec;
+            if (diffuse && lights.sample(its.p, its.shFrame.n, lRec, sampler->next2D())) {
+                Vector3f d = lRec.m_p - its.p;
+                float dist2 = d.squaredNorm(), dist = std::sqrt(dist2);
+                d /= dist;
+                lRec.m_wo = -d;
+                float cosLight = lRec.m_np.dot(-d);
+                Color3f Le = lRec.m_emitter->eval(lRec);
+
+                if (cosLight > 0.0f && !Le.isZero()) {
+                    BSDFQueryRecord bRec(wi, its.toLocal(d), ESolidAngle);
+                    Color3f f = bsdf->eval(bRec);
+                    if (!f.isZero() && !scene->rayIntersect(Ray3f(its.p, d, Epsilon, dist * (1.0f - Epsilon)))) {
+                        float lightPdf = lRec.m_probDensity * dist2 / cosLight;
+                        float weight = powerHeuristic(lightPdf, samplingPdf(bsdf, bRec, guide, d));
+                        Color3f contribution = throughput * f * Le
+                            * std::abs(Frame::cosTheta(bRec.wo)) * (weight / lightPdf);
+                        result += contribution;
+                        addRadiance(vertices, vertexCount, contribution);
+                    }
+                }
+            }
+
+            /* Russian roulette */
+            float prob = std::min(throughput.maxCoeff() * eta * eta, 0.99f);
+            if (sampler->next1D() >= prob)
+                break;
+            throughput /= prob;
+
+            /* Sample the BSDF or the learned distribution */
+            BSDFQueryRecord bRec(wi);
+            Color3f weight;
+            float pdf = 0.0f;
+            if (guide) {
+                Point2f sample = sampler->next2D();
+                if (sample.x() < m_bsdfSamplingFraction) {
+                    sample.x() /= m_bsdfSamplingFraction;
+                    if (bsdf->sample(bRec, sample).isZero())
+                        break;
+                } else {
+                    sample.x() = (sample.x() - m_bsdfSamplingFraction) / (1.0f - m_bsdfSamplingFraction);
+                    bRec = BSDFQueryRecord(wi, its.toLocal(guide->sample(sample)), ESolidAngle);
+                }
+                pdf = samplingPdf(bsdf, bRec, guide, its.toWorld(bRec.wo));
+                if (pdf <= 0.0f)
+                    break;
+                weight = bsdf->eval(bRec) * std::abs(Frame::cosTheta(bRec.wo)) / pdf;
+            } else {
+                weight = bsdf->sample(bRec, sampler->next2D());
+                if (diffuse)
+                    pdf = bsdf->pdf(bRec);
+            }
+            if (weight.isZero())
+                break;
+            throughput *= weight;
+            eta *= bRec.eta;
+
+            specular = !diffuse;
+            bsdfPdf = pdf;
+            prevP = its.p;
+            prevN = its.shFrame.n;
+
+            ray = Ray3f(its.p, its.toWorld(bRec.wo));
+
+            /* Remember the vertex to learn the radiance arriving along the ray */
+            prevRecorded = m_training && diffuse && pdf > 0.0f
+                && vertexCount < NORI_GUIDED_MAX_VERTICES;
+            if (prevRecorded)
+                vertices[vertexCount++] = Vertex { leaf, ray.d, pdf, throughput, Color3f(0.0f) };
+
+            if (!scene->rayIntersect(ray, its))
+                break;
+        }
+
+        /* Record an estimate of the incident radiance, divided by the
+           sampling density (this estimates the integral over each quadrant) */
+        for (int i = 0; i < vertexCount; ++i) {
+            const Vertex &vertex = vertices[i];
+            float value = vertex.radiance.mean() / vertex.pdf;
+            if (std::isfinite(value))
+                vertex.leaf->record(vertex.d, value);
+        }
+
+        return result;
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "GuidedPathIntegrator[\n"
+            "  trainingPasses = %i,\n"
+            "  bsdfSamplingFraction = %f,\n"
+            "  spatialThreshold = %f,\n"
+            "  directionalThreshold = %f\n"
+            "]",
+            m_trainingPasses,
+            m_bsdfSamplingFraction,
+            m_spatialThreshold,
+            m_directionalThreshold
+        );
+    }
+
+private:
+    /// Path vertex whose incident radiance is being estimated
+    struct Vertex {
+        SDTree::Leaf *leaf;
+        /// Sampled direction (world space)
+        Vector3f d;
+        /// Density of the sampled direction
+        float pdf;
+        /// Path throughput including the sampled direction
+        Color3f throughput;
+        /// Radiance arriving along \c d
+        Color3f radiance;
+    };
+
+    /// Add a contribution of the path to the incident radiance of the given vertices
+    static void addRadiance(Vertex *vertices, int count, const Color3f &contribution) {
+        for (int i = 0; i < count; ++i) {
+            const Color3f &throughput = vertices[i].throughput;
+            for (int c = 0; c < 3; ++c)
+                if (throughput[c] > 0.0f)
+                    vertices[i].radiance[c] += contribution[c] / throughput[c];
+        }
+    }
+
+    /// Density of sampling a direction from the BSDF (and learned distribution) mixture
+    float samplingPdf(const BSDF *bsdf, const BSDFQueryRecord &bRec,
+                      const DirectionalQuadTree *guide, const Vector3f &d) const {
+        if (!guide)
+            return bsdf->pdf(bRec);
+        return m_bsdfSamplingFraction * bsdf->pdf(bRec)
+            + (1.0f - m_bsdfSamplingFraction) * guide->pdf(d);
+    }
+
+    int m_trainingPasses;
+    float m_bsdfSamplingFraction;
+    float m_spatialThreshold;
+    float m_directionalThreshold;
+    /// Whether the current pass is a training pass
+    bool m_training = false;
+    std::unique_ptr<SDTree> m_tree;
+};
+
+NORI_REGISTER_CLASS(GuidedPathIntegrator, "path_guided");
+NORI_NAMESPACE_END
@@ -22,19 +22,6 @@ public:
         float eta = 1.f;
         bool specularBounce = false;
 
-        std::vector<Mesh*> emitterMeshes = std::vector<Mesh*>(); // meshes that have emitters
-        DiscretePDF dpdf = DiscretePDF();
-        dpdf.clear();
-
-        for (Mesh* m : scene->getMeshes()) {
-            if (m->isEmitter()) {
-                dpdf.append(1.0f);
-                emitterMeshes.push_back(m);
-            }
-        }
-
-        dpdf.normalize();
-
         Intersection hitRecord;
         Ray3f pathRay(ray.o, ray.d);
 
@@ -67,6 +54,10 @@ public:
         }
     }
 
+    EWavefrontStrategy getWavefrontStrategy() const {
+        return EWavefrontMaterialSampling;
+    }
+
     std::string toString() const {
         return "PathMatsIntegrator[]";
     }
@@ -0,0 +1,131 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/mesh.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/sampler.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Path tracer combining emitter and BSDF sampling
+ *
+ * At every non-specular vertex, a position on an emitter is sampled from
+ * the scene's light hierarchy and connected using a shadow ray (next event
+ * estimation). The path is then extended by sampling the BSDF; when the
+ * new direction hits an emitter, its radiance is counted as well. Both
+ * estimates are weighted using the power heuristic, so that each strategy
+ * dominates where it has the lower variance. Emission found after specular
+ * bounces (and by camera rays) can only be found by BSDF sampling and is
+ * counted with full weight.
+ *
+ * Paths are terminated using Russian roulette based on their throughput.
+ */
+class PathMisIntegrator : public Integrator {
+public:
+    PathMisIntegrator(const PropertyList &props) {
+        /* No parameters this time */
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &_ray) const {
+        const LightBVH &lights = scene->getLightBVH();
+        Color3f result(0.0f), throughput(1.0f);
+        float eta = 1.0f;
+
+        Ray3f ray(_ray);
+        Intersection its;
+        if (!scene->rayIntersect(ray, its))
+            return result;
+
+        /* State of the previous vertex for weighting emission found by BSDF sampling */
+        bool specular = true;
+        float bsdfPdf = 0.0f;
+        Point3f prevP;
+        Normal3f prevN;
+
+        while (true) {
+            const Emitter *emitter = its.mesh->getEmitter();
+            if (emitter) {
+                EmitQueryRecord eRec;
+                eRec.m_p = its.p;
+                eRec.m_np = its.shFrame.n;
+                eRec.m_wo = -ray.d;
+                eRec.m_emitter = emitter;
+                eRec.m_triangle = its.triangle;
+                Color3f Le = emitter->eval(eRec);
+
+                if (specular) {
+                    result += throughput * Le;
+                } else if (!Le.isZero()) {
+                    /* Density of next event estimation producing the same
+                       position, converted to solid angle */
+                    float cosLight = std::abs(its.shFrame.n.dot(ray.d));
+                    float lightPdf = lights.pdf(prevP, prevN, eRec)
+                        * its.t * its.t / cosLight;
+                    result += throughput * Le * powerHeuristic(bsdfPdf, lightPdf);
+                }
+            }
+
+            const BSDF *bsdf = its.mesh->getBSDF();
+            Vector3f wi = its.toLocal(-ray.d);
+
+            /* Next event estimation (not possible for specular surfaces) */
+            EmitQueryRecord lRec;
+            if (bsdf->isDiffuse() && lights.sample(its.p, its.shFrame.n, lRec, sampler->next2D())) {
+                Vector3f d = lRec.m_p - its.p;
+                float dist2 = d.squaredNorm(), dist = std::sqrt(dist2);
+                d /= dist;
+                lRec.m_wo = -d;
+                float cosLight = lRec.m_np.dot(-d);
+                Color3f Le = lRec.m_emitter->eval(lRec);
+
+                if (cosLight > 0.0f && !Le.isZero()) {
+                    BSDFQueryRecord bRec(wi, its.toLocal(d), ESolidAngle);
+                    Color3f f = bsdf->eval(bRec);
+                    if (!f.isZero() && !scene->rayIntersect(Ray3f(its.p, d, Epsilon, dist * (1.0f - Epsilon)))) {
+                        float lightPdf = lRec.m_probDensity * dist2 / cosLight;
+                        float weight = powerHeuristic(lightPdf, bsdf->pdf(bRec));
+                        result += throughput * f * Le * std::abs(Frame::cosTheta(bRec.wo))
+                            * (weight / lightPdf);
+                    }
+                }
+            }
+
+            /* Russian roulette */
+            float prob = std::min(throughput.maxCoeff() * eta * eta, 0.99f);
+            if (sampler->next1D() >= prob)
+                break;
+            throughput /= prob;
+
+            /* BSDF sampling */
+            BSDFQueryRecord bRec(wi);
+            Color3f f = bsdf->sample(bRec, sampler->next2D());
+            if (f.isZero())
+                break;
+            throughput *= f;
+            eta *= bRec.eta;
+
+            specular = !bsdf->isDiffuse();
+            bsdfPdf = specular ? 0.0f : bsdf->pdf(bRec);
+            prevP = its.p;
+            prevN = its.shFrame.n;
+
+            ray = Ray3f(its.p, its.toWorld(bRec.wo));
+            if (!scene->rayIntersect(ray, its))
+                break;
+        }
+
+        return result;
+    }
+
+    EWavefrontStrategy getWavefrontStrategy() const {
+        return EWavefrontEmitterSampling;
+    }
+
+    std::string toString() const {
+        return "PathMisIntegrator[]";
+    }
+};
+
+NORI_REGISTER_CLASS(PathMisIntegrator, "path_mis");
+NORI_NAMESPACE_END
@@ -78,11 +78,22 @@ public:
         m_sampleToCamera = Transform( 
             Eigen::DiagonalMatrix<float, 3>(Vector3f(-0.5f, -0.5f * aspect, 1.0f)) *
             Eigen::Translation<float, 3>(-1.0f, -1.0f/aspect, 0.0f) * perspective).inverse();
+        m_cameraToSample = m_sampleToCamera.inverse();
+        m_worldToCamera = m_cameraToWorld.inverse();
+
+        /* Area of the film when it is placed at z=1 in camera space */
+        Point3f filmMin = m_sampleToCamera * Point3f(0.0f, 0.0f, 0.0f),
+                filmMax = m_sampleToCamera * Point3f(1.0f, 1.0f, 0.0f);
+        filmMin /= filmMin.z();
+        filmMax /= filmMax.z();
+        m_invFilmArea = 1.0f / std::abs((filmMax.x() - filmMin.x()) * (filmMax.y() - filmMin.y()));
 
         /* If no reconstruction filter was assigned, instantiate a Gaussian filter */
-        if (!m_rfilter)
+        if (!m_rfilter) {
             m_rfilter = static_cast<ReconstructionFilter *>(
                 NoriObjectFactory::createInstance("gaussian", PropertyList()));
+            m_rfilter->activate();
+        }
     }
 
     Color3f sampleRay(Ray3f &ray,
@@ -108,6 +119,25 @@ public:
         return Color3f(1.0f);
     }
 
+    float evalImportance(const Vector3f &d, Point2f &position, float &pdf) const {
+        Vector3f local = (m_worldToCamera * d).normalized();
+        float cosTheta = local.z();
+        if (cosTheta <= 0.0f)
+            return 0.0f;
+
+        /* Project onto the film (all points along the ray map to the same position) */
+        Point3f sample = m_cameraToSample * Point3f(local.x(), local.y(), local.z());
+        if (sample.x() < 0.0f || sample.x() >= 1.0f || sample.y() < 0.0f || sample.y() >= 1.0f)
+            return 0.0f;
+        position = Point2f(sample.x() * m_outputSize.x(), sample.y() * m_outputSize.y());
+
+        /* Uniform density on the film at z=1, converted to solid angle. The
+           importance is 1 / (A cos^4), which becomes the same after
+           multiplying with the cosine. */
+        pdf = m_invFilmArea / (cosTheta * cosTheta * cosTheta);
+        return pdf;
+    }
+
     void addChild(NoriObject *obj) {
         switch (obj->getClassType()) {
             case EReconstructionFilter:
@@ -143,7 +173,10 @@ public:
 private:
     Vector2f m_invOutputSize;
     Transform m_sampleToCamera;
+    Transform m_cameraToSample;
     Transform m_cameraToWorld;
+    Transform m_worldToCamera;
+    float m_invFilmArea;
     float m_fov;
     float m_nearClip;
     float m_farClip;
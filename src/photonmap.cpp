@@ -0,0 +1,97 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/photonmap.h>
+#include <nori/scene.h>
+#include <nori/emitter.h>
+#include <nori/frame.h>
+#include <nori/warp.h>
+#include <nori/bbox.h>
+#include <tbb/parallel_invoke.h>
+#include <algorithm>
+
+NORI_NAMESPACE_BEGIN
+
+/// Number of photons above which the subtrees of a node are built in parallel
+#define NORI_PHOTONMAP_PARALLEL_SIZE 65536
+
+bool sampleEmittedPhoton(const Scene *scene, const Point2f &positionSample,
+                         const Point2f &directionSample, Ray3f &ray, Color3f &power) {
+    EmitQueryRecord eRec;
+    if (!scene->sampleEmitter(eRec, positionSample))
+        return false;
+    Vector3f d = Frame(eRec.m_np).toWorld(Warp::squareToCosineHemisphere(directionSample));
+    eRec.m_wo = d;
+
+    /* Radiance * cos / (area density * cos / pi) */
+    power = eRec.m_emitter->eval(eRec) * M_PI / eRec.m_probDensity;
+    ray = Ray3f(eRec.m_p, d);
+    return !power.isZero();
+}
+
+void PhotonMap::clear() {
+    m_photons.clear();
+    m_photons.shrink_to_fit();
+    m_axis.clear();
+    m_axis.shrink_to_fit();
+}
+
+void PhotonMap::append(const std::vector<Photon> &photons) {
+    m_photons.insert(m_photons.end(), photons.begin(), photons.end());
+}
+
+void PhotonMap::scale(float factor) {
+    for (Photon &photon : m_photons)
+        photon.power *= factor;
+}
+
+void PhotonMap::build() {
+    m_axis.resize(m_photons.size());
+    build(0, (uint32_t) m_photons.size());
+}
+
+void PhotonMap::build(uint32_t begin, uint32_t end) {
+    if (begin >= end)
+        return;
+
+    BoundingBox3f bbox;
+    for (uint32_t i = begin; i < end; ++i)
+        bbox.expandBy(m_photons[i].p);
+    int axis = bbox.getLargestAxis();
+
+    uint32_t mid = (begin + end) / 2;
+    std::nth_element(m_photons.begin() + begin, m_photons.begin() + mid,
+                     m_photons.begin() + end,
+                     [axis](const Photon &a, const Photon &b) { return a.p[axis] < b.p[axis]; });
+    m_axis[mid] = (uint8_t) axis;
+
+    /* The subtrees occupy disjoint ranges and can be built in parallel */
+    if (end - begin >= NORI_PHOTONMAP_PARALLEL_SIZE) {
+        tbb::parallel_invoke([&] { build(begin, mid); },
+                             [&] { build(mid + 1, end); });
+    } else {
+        build(begin, mid);
+        build(mid + 1, end);
+    }
+}
+
+std::string PhotonMap::toString() const {
+    return tfm::format("PhotonMap[photons=%i]", m_photons.size());
+}
+
+NORI_NAMESPACE_END
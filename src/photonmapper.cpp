@@ -0,0 +1,151 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/mesh.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/sampler.h>
+#include <nori/context.h>
+#include <nori/timer.h>
+#include <nori/photonmap.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <pcg32.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Number of photons emitted by one parallel work item
+#define NORI_PHOTON_CHUNK_SIZE 4096
+
+/**
+ * \brief Photon mapper
+ *
+ * In a preprocess step, photons are emitted from the emitters (chosen
+ * proportional to their power) and traced through the scene. Each time
+ * a photon hits a diffuse surface, it is stored in a photon map; the
+ * path then continues by sampling the BSDF and is terminated using
+ * Russian roulette. Photons are traced in parallel, each thread filling
+ * its own buffer, until at least \c photonCount photons have been stored.
+ *
+ * Camera rays are followed through specular surfaces until they reach a
+ * diffuse one, where the reflected radiance is estimated from the power
+ * of the photons within \c photonRadius. This handles caustics (e.g.
+ * light focused by a dielectric) that path tracing struggles with, at the
+ * cost of some blur and bias that shrink with the radius.
+ */
+class PhotonMapper : public Integrator {
+public:
+    PhotonMapper(const PropertyList &props) {
+        /* Number of photons to store */
+        m_photonCount = props.getInteger("photonCount", 1000000);
+
+        /* Gathering radius (0: derive from the scene's size) */
+        m_photonRadius = props.getFloat("photonRadius", 0.0f);
+
+        if (m_photonCount <= 0)
+            throw NoriException("PhotonMapper: 'photonCount' must be positive!");
+    }
+
+    void preprocess(const Scene *scene) {
+        m_photonMap.clear();
+        m_emittedCount = 0;
+        if (m_photonRadius <= 0.0f)
+            m_photonRadius = scene->getBoundingBox().getExtents().norm() / 500.0f;
+        if (scene->getEmitterMeshes().empty())
+            return;
+
+        cout << "Tracing photons .. ";
+        cout.flush();
+        Timer timer;
+
+        /* Emit photons in rounds until enough of them have been stored.
+           Every chunk of a round has its own random number stream, so the
+           set of photons does not depend on the scheduling of the threads */
+        tbb::enumerable_thread_specific<std::vector<Photon>> buffers;
+        uint64_t chunks = 0;
+        while (m_photonMap.size() < (size_t) m_photonCount) {
+            /* Estimate how many photons to emit from the ratio so far. A photon
+               can be stored many times, so start with a small pilot round */
+            size_t missing = (size_t) m_photonCount - m_photonMap.size();
+            uint64_t emit = missing / 16;
+            if (m_emittedCount > 0 && m_photonMap.size() > 0)
+                emit = (uint64_t) (missing * ((double) m_emittedCount / m_photonMap.size()));
+            uint64_t roundChunks = std::max((uint64_t) 1,
+                (emit + NORI_PHOTON_CHUNK_SIZE - 1) / NORI_PHOTON_CHUNK_SIZE);
+
+            tbb::parallel_for(tbb::blocked_range<uint64_t>(chunks, chunks + roundChunks),
+                [&](const tbb::blocked_range<uint64_t> &range) {
+                    std::vector<Photon> &buffer = buffers.local();
+                    for (uint64_t chunk = range.begin(); chunk != range.end(); ++chunk) {
+                        pcg32 random(chunk, chunk);
+                        for (int i = 0; i < NORI_PHOTON_CHUNK_SIZE; ++i) {
+                            tracePhoton(scene, random, [&](const Intersection &its, const Vector3f &wi,
+                                                           const Color3f &power, int depth) {
+                                buffer.push_back(Photon(its.p, wi, power));
+                            });
+                        }
+                    }
+                });
+
+            for (std::vector<Photon> &buffer : buffers) {
+                m_photonMap.append(buffer);
+                buffer.clear();
+            }
+            chunks += roundChunks;
+            m_emittedCount += roundChunks * NORI_PHOTON_CHUNK_SIZE;
+
+            /* Give up on scenes where photons cannot reach diffuse surfaces */
+            if (m_photonMap.size() == 0 && m_emittedCount >= 100 * (uint64_t) m_photonCount)
+                break;
+        }
+
+        /* Every photon carries its share of the total emitted power */
+        m_photonMap.scale(1.0f / (float) m_emittedCount);
+        double traceTime = std::max(timer.lap(), 1.0);
+        m_photonMap.build();
+
+        cout << "done. (emitted " << m_emittedCount << " photons, stored "
+             << m_photonMap.size() << ", " << timeString(traceTime) << ", "
+             << tfm::format("%.2f", m_emittedCount / (traceTime * 1000.0)) << " M photons/s"
+             << ", kd-tree built in " << timer.elapsedString() << ")" << endl;
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &_ray) const {
+        /* Radiance of emitters seen directly or through specular surfaces */
+        Color3f result(0.0f), throughput(1.0f);
+        Ray3f ray(_ray);
+        Intersection its;
+        if (!traceToDiffuse(scene, sampler, ray, its, throughput, result))
+            return result;
+
+        /* Density estimation using the photons around the hit point */
+        const BSDF *bsdf = its.mesh->getBSDF();
+        Vector3f wi = its.toLocal(-ray.d);
+        Color3f sum(0.0f);
+        m_photonMap.lookup(its.p, m_photonRadius, [&](const Photon &photon) {
+            BSDFQueryRecord bRec(wi, its.toLocal(photon.wi), ESolidAngle);
+            sum += bsdf->eval(bRec) * photon.power;
+        });
+        return result + throughput * sum / (M_PI * m_photonRadius * m_photonRadius);
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "PhotonMapper[\n"
+            "  photonCount = %i,\n"
+            "  photonRadius = %f\n"
+            "]",
+            m_photonCount,
+            m_photonRadius
+        );
+    }
+
+private:
+    int m_photonCount;
+    float m_photonRadius;
+    uint64_t m_emittedCount = 0;
+    PhotonMap m_photonMap;
+};
+
+NORI_REGISTER_CLASS(PhotonMapper, "photonmapper");
+NORI_NAMESPACE_END
@@ -20,6 +20,49 @@
 
 NORI_NAMESPACE_BEGIN
 
+ReconstructionFilter::ReconstructionFilter(const PropertyList &propList) {
+    /* Importance sample the filter instead of splatting samples? */
+    m_importanceSample = propList.getBoolean("importanceSample", false);
+}
+
+void ReconstructionFilter::activate() {
+    if (!m_importanceSample || !m_table.empty())
+        return;
+
+    /* Tabulate the filter on [-radius, radius] */
+    int binCount = 2 * NORI_FILTER_RESOLUTION;
+    m_table.resize(binCount);
+    m_pdf = DiscretePDF(binCount);
+    for (int i=0; i<binCount; ++i) {
+        float x = m_radius * ((i + 0.5f) / NORI_FILTER_RESOLUTION - 1.0f);
+        m_table[i] = eval(std::abs(x));
+        m_pdf.append(std::abs(m_table[i]));
+    }
+    if (m_pdf.normalize() == 0)
+        throw NoriException("ReconstructionFilter: cannot importance sample "
+            "a filter that is zero everywhere!");
+}
+
+float ReconstructionFilter::sample1D(float sample, float &weight) const {
+    /* Pick a bin, then a uniformly distributed position within it */
+    size_t bin = m_pdf.sampleReuse(sample);
+    float binWidth = 2 * m_radius / m_table.size();
+    float x = -m_radius + (bin + sample) * binWidth;
+
+    /* The density is piecewise constant and proportional to |m_table|. After
+       dropping the normalization constant, which cancels when the pixel is
+       divided by its accumulated weight, the weight is the ratio below. */
+    weight = eval(std::abs(x)) / std::abs(m_table[bin]);
+    return x;
+}
+
+float ReconstructionFilter::sample(const Point2f &sample, Point2f &offset) const {
+    float weightX, weightY;
+    offset.x() = sample1D(sample.x(), weightX);
+    offset.y() = sample1D(sample.y(), weightY);
+    return weightX * weightY;
+}
+
 /**
  * Windowed Gaussian filter with configurable extent
  * and standard deviation. Often produces pleasing 
@@ -27,7 +70,7 @@ NORI_NAMESPACE_BEGIN
  */
 class GaussianFilter : public ReconstructionFilter {
 public:
-    GaussianFilter(const PropertyList &propList) {
+    GaussianFilter(const PropertyList &propList) : ReconstructionFilter(propList) {
         /* Half filter size */
         m_radius = propList.getFloat("radius", 2.0f);
         /* Standard deviation of the Gaussian */
@@ -56,7 +99,7 @@ protected:
  */
 class MitchellNetravaliFilter : public ReconstructionFilter {
 public:
-    MitchellNetravaliFilter(const PropertyList &propList) {
+    MitchellNetravaliFilter(const PropertyList &propList) : ReconstructionFilter(propList) {
         /* Filter size in pixels */
         m_radius = propList.getFloat("radius", 2.0f);
         /* B parameter from the paper */
@@ -90,7 +133,7 @@ protected:
 /// Tent filter 
 class TentFilter : public ReconstructionFilter {
 public:
-    TentFilter(const PropertyList &) {
+    TentFilter(const PropertyList &propList) : ReconstructionFilter(propList) {
         m_radius = 1.0f;
     }
 
@@ -106,7 +149,7 @@ public:
 /// Box filter -- fastest, but prone to aliasing
 class BoxFilter : public ReconstructionFilter {
 public:
-    BoxFilter(const PropertyList &) {
+    BoxFilter(const PropertyList &propList) : ReconstructionFilter(propList) {
         m_radius = 0.5f;
     }
 
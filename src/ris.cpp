@@ -0,0 +1,308 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/mesh.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/context.h>
+#include <nori/sampler.h>
+#include <pcg32.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Direct illumination using resampled importance sampling (RIS)
+ *
+ * For every shading point, a number of cheap candidate positions on the
+ * emitters are drawn from the light hierarchy (see \ref LightBVH). Each is
+ * weighted by its unshadowed contribution (BSDF times emitted radiance
+ * times the geometry term) relative to its sampling density, and one of
+ * them is chosen by weighted reservoir sampling. Only the chosen candidate
+ * is tested for visibility, so a single shadow ray is traced per shading
+ * point no matter how many candidates were considered.
+ *
+ * With spatial reuse enabled, the integrator renders whole image blocks:
+ * after the reservoirs of all pixels have been generated, each pixel
+ * merges the reservoirs of a few random neighbors within the block, which
+ * effectively multiplies the number of candidates. Neighbors whose surface
+ * differs too much (normal, depth) are rejected. Since candidates taken
+ * from neighbors are not tested for visibility at the receiving pixel
+ * during resampling, this introduces a small amount of bias near shadow
+ * boundaries.
+ *
+ * Non-diffuse surfaces (mirrors, dielectrics) are handled by following
+ * the sampled BSDF direction until a diffuse surface is found (using
+ * Russian roulette).
+ *
+ * Parameters:
+ *   - \c candidates: number of candidate emitter samples (default 32)
+ *   - \c spatialReuse: merge reservoirs of neighboring pixels (default false)
+ *   - \c neighbors: number of neighbors merged per pixel (default 4)
+ *   - \c radius: maximum distance of the neighbors in pixels (default 8)
+ *   - \c maxDepth: maximum number of specular bounces (default 8)
+ */
+class RISIntegrator : public Integrator {
+public:
+    RISIntegrator(const PropertyList &props) {
+        m_candidates = props.getInteger("candidates", 32);
+        m_spatialReuse = props.getBoolean("spatialReuse", false);
+        m_neighbors = props.getInteger("neighbors", 4);
+        m_radius = props.getInteger("radius", 8);
+        m_maxDepth = props.getInteger("maxDepth", 8);
+        if (m_candidates < 1)
+            throw NoriException("RISIntegrator: at least one candidate is required!");
+        if (m_neighbors < 0 || m_neighbors > MaxNeighbors)
+            throw NoriException("RISIntegrator: the number of neighbors must be between 0 and %i!", MaxNeighbors);
+    }
+
+    /// Largest supported number of neighbors for spatial reuse
+    enum { MaxNeighbors = 32 };
+
+    /// Weighted reservoir holding one emitter sample
+    struct Reservoir {
+        EmitQueryRecord sample;
+        /// Target density of the chosen sample
+        float target = 0.0f;
+        /// Sum of the resampling weights
+        float weightSum = 0.0f;
+        /// Number of candidates seen
+        float count = 0.0f;
+
+        /// Stream in a candidate with the given resampling weight
+        void update(const EmitQueryRecord &candidate, float candidateTarget, float weight,
+                    float count_, float u) {
+            weightSum += weight;
+            count += count_;
+            if (weight > 0.0f && u * weightSum < weight) {
+                sample = candidate;
+                target = candidateTarget;
+            }
+        }
+    };
+
+    /// First diffuse surface seen by a camera path
+    struct ShadingPoint {
+        Intersection its;
+        /// Direction towards the previous vertex (world space)
+        Vector3f wi;
+        /// Throughput of the camera path up to this point
+        Color3f throughput;
+        bool valid;
+    };
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
+        ShadingPoint sp;
+        Color3f result = traceToDiffuse(scene, sampler, ray, sp);
+        if (!sp.valid)
+            return result;
+
+        Reservoir r = generateReservoir(scene, sampler, sp);
+        return result + shade(scene, sp, r, r.count);
+    }
+
+    bool renderBlock(const Scene *scene, RenderContext &context) const {
+        if (!m_spatialReuse)
+            return false;
+
+        ImageBlock &block = context.getBlock();
+        Sampler *sampler = context.getSampler();
+        SampleBuffer &samples = context.getSampleBuffer();
+        MemoryArena &arena = context.getArena();
+        Point2i offset = block.getOffset();
+        Vector2i size = block.getSize();
+        uint32_t sampleCount = (uint32_t) sampler->getSampleCount();
+        size_t count = (size_t) size.x() * size.y();
+
+        /* Reuse only combines samples with the same index, hence the samples
+           are processed one index at a time. The per-pixel state lives in the
+           scratch arena and is reused for all sample indices. */
+        ShadingPoint *points = arena.alloc<ShadingPoint>(count);
+        Reservoir *reservoirs = arena.alloc<Reservoir>(count);
+        Color3f *radiance = arena.alloc<Color3f>(count);
+        Point2f *positions = arena.alloc<Point2f>(count);
+        float *weights = arena.alloc<float>(count);
+        pcg32 *random = arena.alloc<pcg32>(count);
+
+        for (uint32_t i = 0; i < sampleCount; ++i) {
+            /* Pass 1: trace the camera paths and fill the reservoirs */
+            for (int y = 0; y < size.y(); ++y) {
+                for (int x = 0; x < size.x(); ++x) {
+                    Point2i pixel(x + offset.x(), y + offset.y());
+                    size_t index = (size_t) y * size.x() + x;
+                    sampler->startSample(pixel, i);
+
+                    Ray3f ray;
+                    Color3f value = sampleCameraRay(scene, sampler, pixel, ray, positions[index], weights[index]);
+                    ShadingPoint &sp = *new (&points[index]) ShadingPoint();
+                    radiance[index] = value * traceToDiffuse(scene, sampler, ray, sp);
+                    if (sp.valid)
+                        sp.throughput *= value;
+
+                    Reservoir &r = *new (&reservoirs[index]) Reservoir();
+                    if (sp.valid)
+                        r = generateReservoir(scene, sampler, sp);
+
+                    /* Random numbers for the reuse pass */
+                    new (&random[index]) pcg32();
+                    sampler->seedStream(random[index], pixel, i, 1);
+                }
+            }
+
+            /* Pass 2: merge the reservoirs of random neighbors, then shade */
+            for (int y = 0; y < size.y(); ++y) {
+                for (int x = 0; x < size.x(); ++x) {
+                    size_t index = (size_t) y * size.x() + x;
+                    const ShadingPoint &sp = points[index];
+                    if (sp.valid) {
+                        pcg32 &rng = random[index];
+                        size_t merged[MaxNeighbors + 1];
+                        int mergedCount = 0;
+                        Reservoir r;
+                        merge(r, sp, reservoirs[index], rng.nextFloat());
+                        merged[mergedCount++] = index;
+
+                        for (int k = 0; k < m_neighbors; ++k) {
+                            int nx = clamp(x + (int) std::floor((2.0f * rng.nextFloat() - 1.0f) * m_radius), 0, size.x() - 1);
+                            int ny = clamp(y + (int) std::floor((2.0f * rng.nextFloat() - 1.0f) * m_radius), 0, size.y() - 1);
+                            size_t other = (size_t) ny * size.x() + nx;
+                            if (other == index || !similar(sp, points[other]))
+                                continue;
+                            merge(r, sp, reservoirs[other], rng.nextFloat());
+                            merged[mergedCount++] = other;
+                        }
+
+                        /* Only count the candidates of pixels that could have
+                           produced the chosen sample (this avoids darkening) */
+                        float z = 0.0f;
+                        if (r.target > 0.0f) {
+                            for (int k = 0; k < mergedCount; ++k) {
+                                size_t other = merged[k];
+                                if (other == index || target(points[other], r.sample) > 0.0f)
+                                    z += reservoirs[other].count;
+                            }
+                        }
+                        radiance[index] += shade(scene, sp, r, z);
+                    }
+                    samples.put(block, positions[index], radiance[index], weights[index]);
+                }
+                samples.flush(block);
+            }
+        }
+
+        arena.reset();
+        return true;
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "RISIntegrator[\n"
+            "  candidates = %i,\n"
+            "  spatialReuse = %s,\n"
+            "  neighbors = %i,\n"
+            "  radius = %i,\n"
+            "  maxDepth = %i\n"
+            "]",
+            m_candidates, m_spatialReuse ? "true" : "false",
+            m_neighbors, m_radius, m_maxDepth);
+    }
+
+private:
+    /**
+     * Follow a camera ray through non-diffuse surfaces. Returns the emitted
+     * radiance found on the way and fills in the first diffuse surface.
+     */
+    Color3f traceToDiffuse(const Scene *scene, Sampler *sampler, const Ray3f &_ray,
+                           ShadingPoint &sp) const {
+        Color3f result(0.0f), throughput(1.0f);
+        Ray3f ray(_ray);
+        sp.valid = nori::traceToDiffuse(scene, sampler, ray, sp.its, throughput, result, m_maxDepth);
+        sp.wi = -ray.d;
+        sp.throughput = throughput;
+        return result;
+    }
+
+    /// Unshadowed contribution of an emitter sample to a shading point
+    Color3f contribution(const ShadingPoint &sp, const EmitQueryRecord &rec, Vector3f &d,
+                         float &dist) const {
+        d = rec.m_p - sp.its.p;
+        float dist2 = d.squaredNorm();
+        dist = std::sqrt(dist2);
+        if (dist2 == 0.0f)
+            return Color3f(0.0f);
+        d /= dist;
+
+        float cosLight = -rec.m_np.dot(d);
+        if (cosLight <= 0.0f)
+            return Color3f(0.0f);
+
+        BSDFQueryRecord bRec(sp.its.toLocal(sp.wi), sp.its.toLocal(d), ESolidAngle);
+        Color3f f = sp.its.mesh->getBSDF()->eval(bRec);
+        return sp.throughput * f * rec.m_emitter->getEmission()
+            * (std::abs(Frame::cosTheta(bRec.wo)) * cosLight / dist2);
+    }
+
+    /// Target density of the resampling (per unit area)
+    float target(const ShadingPoint &sp, const EmitQueryRecord &rec) const {
+        Vector3f d;
+        float dist;
+        return contribution(sp, rec, d, dist).getLuminance();
+    }
+
+    /// Draw the candidates of a shading point into a reservoir
+    Reservoir generateReservoir(const Scene *scene, Sampler *sampler, const ShadingPoint &sp) const {
+        Reservoir r;
+        const LightBVH &lights = scene->getLightBVH();
+        for (int i = 0; i < m_candidates; ++i) {
+            EmitQueryRecord rec;
+            float weight = 0.0f, p = 0.0f;
+            if (lights.sample(sp.its.p, sp.its.shFrame.n, rec, sampler->next2D())) {
+                p = target(sp, rec);
+                weight = p / rec.m_probDensity;
+            }
+            r.update(rec, p, weight, 1.0f, sampler->next1D());
+        }
+        return r;
+    }
+
+    /// Merge the reservoir of a (possibly neighboring) pixel into 'r'
+    void merge(Reservoir &r, const ShadingPoint &sp, const Reservoir &other, float u) const {
+        /* Re-evaluate the sample at the receiving shading point */
+        float p = other.target > 0.0f ? target(sp, other.sample) : 0.0f;
+        float W = other.target > 0.0f ? other.weightSum / (other.count * other.target) : 0.0f;
+        r.update(other.sample, p, p * W * other.count, other.count, u);
+    }
+
+    /// Trace a shadow ray for the chosen sample and return its weighted contribution
+    Color3f shade(const Scene *scene, const ShadingPoint &sp, const Reservoir &r, float z) const {
+        if (r.target <= 0.0f || z <= 0.0f)
+            return Color3f(0.0f);
+
+        Vector3f d;
+        float dist;
+        Color3f value = contribution(sp, r.sample, d, dist);
+        if (value.isZero() || scene->rayIntersect(Ray3f(sp.its.p, d, Epsilon, dist * (1.0f - Epsilon))))
+            return Color3f(0.0f);
+
+        /* Unbiased contribution weight of the reservoir */
+        float W = r.weightSum / (z * r.target);
+        return value * W;
+    }
+
+    /// Are two shading points similar enough to share their reservoirs?
+    bool similar(const ShadingPoint &a, const ShadingPoint &b) const {
+        if (!b.valid)
+            return false;
+        if (a.its.shFrame.n.dot(b.its.shFrame.n) < 0.9f)
+            return false;
+        float depthA = a.its.t, depthB = b.its.t;
+        return std::abs(depthA - depthB) <= 0.1f * std::max(depthA, depthB);
+    }
+
+    int m_candidates;
+    bool m_spatialReuse;
+    int m_neighbors;
+    int m_radius;
+    int m_maxDepth;
+};
+
+NORI_REGISTER_CLASS(RISIntegrator, "ris");
+NORI_NAMESPACE_END
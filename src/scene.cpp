@@ -33,16 +33,39 @@ Scene::Scene(const PropertyList &) {
 Scene::~Scene() {
     delete m_accel;
     delete m_sampler;
-    delete m_camera;
+    for (Camera *camera : m_cameras)
+        delete camera;
     delete m_integrator;
 }
 
 void Scene::activate() {
     m_accel->build();
 
+    /* Distribution for choosing an emitter proportional to its power */
+    m_emitterMeshes.clear();
+    m_emitterIndex.clear();
+    m_emitterPDF.clear();
+    for (Mesh *mesh : m_meshes) {
+        if (!mesh->isEmitter())
+            continue;
+        m_emitterIndex[mesh->getEmitter()] = (uint32_t) m_emitterMeshes.size();
+        m_emitterMeshes.push_back(mesh);
+        m_emitterPDF.append(mesh->getEmitter()->getTriangles().getPower());
+    }
+    if (!m_emitterMeshes.empty() && m_emitterPDF.normalize() <= 0) {
+        /* Only black emitters -- fall back to uniform selection */
+        m_emitterPDF.clear();
+        for (size_t i = 0; i < m_emitterMeshes.size(); ++i)
+            m_emitterPDF.append(1.0f);
+        m_emitterPDF.normalize();
+    }
+
+    /* Hierarchy for choosing emitters by their contribution to a shading point */
+    m_lightBVH.build(m_emitterMeshes);
+
     if (!m_integrator)
         throw NoriException("No integrator was specified!");
-    if (!m_camera)
+    if (m_cameras.empty())
         throw NoriException("No camera was specified!");
     
     if (!m_sampler) {
@@ -79,9 +102,7 @@ void Scene::addChild(NoriObject *obj) {
             break;
 
         case ECamera:
-            if (m_camera)
-                throw NoriException("There can only be one camera per scene!");
-            m_camera = static_cast<Camera *>(obj);
+            m_cameras.push_back(static_cast<Camera *>(obj));
             break;
         
         case EIntegrator:
@@ -96,6 +117,40 @@ void Scene::addChild(NoriObject *obj) {
     }
 }
 
+bool Scene::sampleEmitter(EmitQueryRecord &rec, const Point2f &_sample) const {
+    if (m_emitterMeshes.empty())
+        return false;
+
+    Point2f sample(_sample);
+    float selectionPdf;
+    size_t index = m_emitterPDF.sampleAliasReuse(sample.x(), selectionPdf);
+    const Emitter *emitter = m_emitterMeshes[index]->getEmitter();
+    emitter->sample(rec, sample);
+    rec.m_emitter = emitter;
+    rec.m_probDensity *= selectionPdf;
+    return true;
+}
+
+float Scene::pdfEmitter(const EmitQueryRecord &rec) const {
+    if (!rec.m_emitter)
+        return 0.0f;
+    return pdfEmitterSelection(rec.m_emitter) * rec.m_emitter->pdf(rec);
+}
+
+float Scene::pdfEmitterSelection(const Emitter *emitter) const {
+    auto it = m_emitterIndex.find(emitter);
+    if (it == m_emitterIndex.end())
+        return 0.0f;
+    return m_emitterPDF[it->second];
+}
+
+void Scene::setActiveCamera(size_t index) {
+    if (index >= m_cameras.size())
+        throw NoriException("Scene::setActiveCamera(): invalid camera index %i "
+                            "(the scene has %i cameras)", index, m_cameras.size());
+    m_activeCamera = index;
+}
+
 std::string Scene::toString() const {
     std::string meshes;
     for (size_t i=0; i<m_meshes.size(); ++i) {
@@ -105,17 +160,26 @@ std::string Scene::toString() const {
         meshes += "\n";
     }
 
+    std::string cameras;
+    for (size_t i=0; i<m_cameras.size(); ++i) {
+        cameras += std::string("  ") + indent(m_cameras[i]->toString(), 2);
+        if (i + 1 < m_cameras.size())
+            cameras += ",";
+        cameras += "\n";
+    }
+
     return tfm::format(
         "Scene[\n"
         "  integrator = %s,\n"
         "  sampler = %s\n"
-        "  camera = %s,\n"
+        "  cameras = {\n"
+        "  %s  },\n"
         "  meshes = {\n"
         "  %s  }\n"
         "]",
         indent(m_integrator->toString()),
         indent(m_sampler->toString()),
-        indent(m_camera->toString()),
+        indent(cameras, 2),
         indent(meshes, 2)
     );
 }
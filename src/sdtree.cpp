@@ -0,0 +1,285 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/sdtree.h>
+#include <nori/atomic.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+NORI_NAMESPACE_BEGIN
+
+/* Map a direction to the unit square (equal-area cylindrical mapping) */
+static Point2f directionToSquare(const Vector3f &d) {
+    float cosTheta = clamp(d.z(), -1.0f, 1.0f);
+    float phi = std::atan2(d.y(), d.x());
+    if (phi < 0.0f)
+        phi += 2.0f * M_PI;
+    return Point2f(clamp(0.5f * (cosTheta + 1.0f), 0.0f, 1.0f),
+                   clamp(phi * (0.5f * INV_PI), 0.0f, 1.0f));
+}
+
+/* Inverse of directionToSquare() */
+static Vector3f squareToDirection(const Point2f &p) {
+    float cosTheta = 2.0f * p.x() - 1.0f;
+    float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    float phi = 2.0f * M_PI * p.y();
+    return Vector3f(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+}
+
+/* Return the quadrant containing 'p' and map 'p' into it */
+static inline int descend(Point2f &p) {
+    int quadrant = 0;
+    for (int axis = 0; axis < 2; ++axis) {
+        p[axis] *= 2.0f;
+        if (p[axis] >= 1.0f) {
+            p[axis] -= 1.0f;
+            quadrant |= 1 << axis;
+        }
+    }
+    return quadrant;
+}
+
+DirectionalQuadTree::DirectionalQuadTree() {
+    m_nodes.emplace_back();
+}
+
+void DirectionalQuadTree::record(const Vector3f &d, float value) {
+    Point2f p = directionToSquare(d);
+    uint32_t index = 0;
+    while (true) {
+        Node &node = m_nodes[index];
+        int quadrant = descend(p);
+        atomicAdd(node.sum[quadrant], value);
+        if (!node.children[quadrant])
+            break;
+        index = node.children[quadrant];
+    }
+}
+
+float DirectionalQuadTree::getEnergy() const {
+    return m_nodes[0].getEnergy();
+}
+
+Vector3f DirectionalQuadTree::sample(const Point2f &_sample) const {
+    Point2f sample(_sample), origin(0.0f, 0.0f);
+    float size = 1.0f;
+    uint32_t index = 0;
+
+    while (true) {
+        const Node &node = m_nodes[index];
+        float sum[4];
+        for (int i = 0; i < 4; ++i)
+            sum[i] = node.sum[i].load(std::memory_order_relaxed);
+
+        /* Choose the half along x, then the quadrant within it (reusing the sample) */
+        int quadrant = 0;
+        float left = sum[0] + sum[2], right = sum[1] + sum[3];
+        float probLeft = left / (left + right);
+        if (sample.x() < probLeft) {
+            sample.x() /= probLeft;
+        } else {
+            sample.x() = (sample.x() - probLeft) / (1.0f - probLeft);
+            quadrant |= 1;
+        }
+        float probBottom = sum[quadrant] / (sum[quadrant] + sum[quadrant | 2]);
+        if (sample.y() < probBottom) {
+            sample.y() /= probBottom;
+        } else {
+            sample.y() = (sample.y() - probBottom) / (1.0f - probBottom);
+            quadrant |= 2;
+        }
+        sample = sample.cwiseMin(Point2f::Constant(std::nextafter(1.0f, 0.0f))).cwiseMax(Point2f::Constant(0.0f));
+
+        size *= 0.5f;
+        origin.x() += (quadrant & 1) ? size : 0.0f;
+        origin.y() += (quadrant & 2) ? size : 0.0f;
+        if (!node.children[quadrant])
+            break;
+        index = node.children[quadrant];
+    }
+
+    return squareToDirection(origin + size * sample);
+}
+
+float DirectionalQuadTree::pdf(const Vector3f &d) const {
+    Point2f p = directionToSquare(d);
+    float density = INV_FOURPI;
+    uint32_t index = 0;
+    while (true) {
+        const Node &node = m_nodes[index];
+        float total = node.getEnergy();
+        if (total <= 0.0f)
+            return 0.0f;
+        int quadrant = descend(p);
+        density *= 4.0f * node.sum[quadrant].load(std::memory_order_relaxed) / total;
+        if (!node.children[quadrant])
+            break;
+        index = node.children[quadrant];
+    }
+    return density;
+}
+
+void DirectionalQuadTree::refine(const DirectionalQuadTree &source, float threshold) {
+    struct StackItem {
+        /// Node of this tree
+        uint32_t node;
+        /// Corresponding node of 'tree'
+        const DirectionalQuadTree *tree;
+        uint32_t treeNode;
+        int depth;
+    };
+
+    m_nodes.clear();
+    m_nodes.emplace_back();
+    float total = source.getEnergy();
+
+    std::vector<StackItem> stack;
+    stack.push_back(StackItem { 0, &source, 0, 1 });
+    while (!stack.empty()) {
+        StackItem item = stack.back();
+        stack.pop_back();
+
+        for (int i = 0; i < 4; ++i) {
+            const Node &sourceNode = item.tree->m_nodes[item.treeNode];
+            float sum = sourceNode.sum[i].load(std::memory_order_relaxed);
+            uint32_t sourceChild = sourceNode.children[i];
+
+            /* Without any energy, refine uniformly */
+            float fraction = total > 0.0f ? sum / total : std::pow(0.25f, (float) item.depth);
+            if (item.depth >= NORI_QUADTREE_MAX_DEPTH || fraction <= threshold)
+                continue;
+
+            /* New child; where the source is not refined as far, its energy
+               is split evenly among the quadrants of the child */
+            uint32_t child = (uint32_t) m_nodes.size();
+            m_nodes.emplace_back();
+            for (int j = 0; j < 4; ++j)
+                m_nodes[child].sum[j].store(0.25f * sum, std::memory_order_relaxed);
+            m_nodes[item.node].children[i] = child;
+
+            if (sourceChild)
+                stack.push_back(StackItem { child, item.tree, sourceChild, item.depth + 1 });
+            else
+                stack.push_back(StackItem { child, this, child, item.depth + 1 });
+        }
+    }
+
+    for (Node &node : m_nodes)
+        for (int i = 0; i < 4; ++i)
+            node.sum[i].store(0.0f, std::memory_order_relaxed);
+}
+
+std::string DirectionalQuadTree::toString() const {
+    return tfm::format("DirectionalQuadTree[nodes=%i, energy=%f]", m_nodes.size(), getEnergy());
+}
+
+SDTree::SDTree(const BoundingBox3f &bounds) : m_bounds(bounds) {
+    Node root;
+    root.children[0] = root.children[1] = 0;
+    root.leaf = 0;
+    root.axis = 0;
+    root.isLeaf = true;
+    m_nodes.push_back(root);
+    m_leaves.emplace_back();
+}
+
+uint32_t SDTree::lookupNode(const Point3f &p) const {
+    /* Position relative to the bounds of the current node */
+    Vector3f extents = m_bounds.getExtents().cwiseMax(Vector3f::Constant(Epsilon));
+    Point3f rel = ((p - m_bounds.min).cwiseQuotient(extents))
+        .cwiseMax(Point3f::Constant(0.0f)).cwiseMin(Point3f::Constant(1.0f));
+
+    uint32_t index = 0;
+    while (!m_nodes[index].isLeaf) {
+        const Node &node = m_nodes[index];
+        float &x = rel[node.axis];
+        if (x < 0.5f) {
+            x *= 2.0f;
+            index = node.children[0];
+        } else {
+            x = 2.0f * x - 1.0f;
+            index = node.children[1];
+        }
+    }
+    return index;
+}
+
+SDTree::Leaf &SDTree::lookup(const Point3f &p) {
+    return m_leaves[m_nodes[lookupNode(p)].leaf];
+}
+
+const SDTree::Leaf &SDTree::lookup(const Point3f &p) const {
+    return m_leaves[m_nodes[lookupNode(p)].leaf];
+}
+
+void SDTree::refine(uint32_t spatialThreshold, float directionalThreshold) {
+    /* Sample from what was recorded in the last pass */
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, m_leaves.size()),
+        [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t i = range.begin(); i != range.end(); ++i)
+                m_leaves[i].sampling = m_leaves[i].building;
+        });
+
+    /* Split leaves with many samples; both halves start out with the
+       parent's distributions and (for further splits) half of its samples */
+    for (size_t i = 0; i < m_nodes.size(); ++i) {
+        if (!m_nodes[i].isLeaf)
+            continue;
+        uint32_t leaf = m_nodes[i].leaf;
+        uint32_t sampleCount = m_leaves[leaf].sampleCount.load(std::memory_order_relaxed);
+        if (sampleCount <= spatialThreshold)
+            continue;
+
+        m_leaves[leaf].sampleCount.store(sampleCount / 2, std::memory_order_relaxed);
+        Leaf copy(m_leaves[leaf]);
+        m_leaves.push_back(copy);
+
+        Node child;
+        child.children[0] = child.children[1] = 0;
+        child.axis = (uint8_t) ((m_nodes[i].axis + 1) % 3);
+        child.isLeaf = true;
+        uint32_t childIndex = (uint32_t) m_nodes.size();
+        child.leaf = leaf;
+        m_nodes.push_back(child);
+        child.leaf = (uint32_t) m_leaves.size() - 1;
+        m_nodes.push_back(child);
+
+        Node &node = m_nodes[i];
+        node.children[0] = childIndex;
+        node.children[1] = childIndex + 1;
+        node.isLeaf = false;
+    }
+
+    /* Adapt the recording quadtrees to the new sampling distributions */
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, m_leaves.size()),
+        [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t i = range.begin(); i != range.end(); ++i) {
+                m_leaves[i].building.refine(m_leaves[i].sampling, directionalThreshold);
+                m_leaves[i].sampleCount.store(0, std::memory_order_relaxed);
+            }
+        });
+}
+
+std::string SDTree::toString() const {
+    size_t quadTreeNodes = 0;
+    for (const Leaf &leaf : m_leaves)
+        quadTreeNodes += leaf.sampling.getNodeCount();
+    return tfm::format("SDTree[leaves=%i, quadtree nodes=%i]", m_leaves.size(), quadTreeNodes);
+}
+
+NORI_NAMESPACE_END
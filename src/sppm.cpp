@@ -0,0 +1,400 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/mesh.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/camera.h>
+#include <nori/context.h>
+#include <nori/sampler.h>
+#include <nori/block.h>
+#include <nori/photonmap.h>
+#include <nori/atomic.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <pcg32.h>
+#include <atomic>
+
+NORI_NAMESPACE_BEGIN
+
+/// Number of photons traced by one parallel work item
+#define NORI_SPPM_CHUNK_SIZE 4096
+
+/// Largest number of grid cells overlapped by a visible point (three per axis)
+#define NORI_SPPM_MAX_BUCKETS 27
+
+/**
+ * \brief Stochastic progressive photon mapping (SPPM)
+ *
+ * Every rendering pass runs three stages before its image blocks are
+ * written (see \ref Integrator::preparePass()):
+ *
+ * 1. A camera ray is traced for every pixel, through specular surfaces,
+ *    until it reaches a diffuse one. Emission found along the way and
+ *    direct illumination (sampled using the light hierarchy) are computed
+ *    right away; the diffuse hit becomes the pixel's "visible point".
+ * 2. The visible points are inserted into a spatial hash grid, and a batch
+ *    of \c photonCount photons is traced. Wherever a photon hits a diffuse
+ *    surface after its first bounce, it deposits its flux at all visible
+ *    points within their pixel's current radius.
+ * 3. Every pixel updates its photon count statistics and shrinks its
+ *    radius such that only a fraction \c alpha of the new photons is kept.
+ *
+ * The image blocks then receive the estimate of this pass (direct light
+ * plus the deposited flux over the area of the radius used in this pass).
+ * Because of the way the radius and the accumulated flux are reduced,
+ * the average of these per-pass estimates, which is exactly what the film
+ * computes over all passes, equals the SPPM estimate. The render can thus
+ * be stopped after any pass, and it converges to the correct solution
+ * (including caustics and specular-diffuse-specular paths) as the number
+ * of passes grows, while the memory usage only depends on the number of
+ * pixels.
+ *
+ * One visible point is traced per pixel and pass (the sample count of
+ * the sampler is ignored); use more passes to improve the result.
+ *
+ * The photons of a pass are traced in parallel and deposit their flux
+ * using atomic additions, hence the images are not bit-for-bit identical
+ * between runs with different thread counts.
+ */
+class SPPMIntegrator : public Integrator {
+public:
+    SPPMIntegrator(const PropertyList &props) {
+        /* Number of photons traced per pass */
+        m_photonCount = props.getInteger("photonCount", 250000);
+
+        /* Initial radius of the pixels (0: derive from the scene's size) */
+        m_initialRadius = props.getFloat("initialRadius", 0.0f);
+
+        /* Fraction of the photons that is kept in each pass */
+        m_alpha = props.getFloat("alpha", 0.7f);
+
+        if (m_photonCount <= 0)
+            throw NoriException("SPPMIntegrator: 'photonCount' must be positive!");
+        if (m_alpha <= 0.0f || m_alpha > 1.0f)
+            throw NoriException("SPPMIntegrator: 'alpha' must be in (0, 1]!");
+    }
+
+    bool requiresPasses() const { return true; }
+
+    void preparePass(const Scene *scene, uint32_t pass) {
+        Vector2i size = scene->getCamera()->getOutputSize();
+        if (pass == 0 || !m_pixels || size != m_size)
+            reset(scene, size);
+
+        generateVisiblePoints(scene, pass);
+        buildGrid();
+        tracePhotons(scene, pass);
+        updatePixels();
+    }
+
+    bool renderBlock(const Scene *scene, RenderContext &context) const {
+        if (!m_pixels)
+            throw NoriException("SPPMIntegrator: the pass was not prepared "
+                                "(SPPM cannot be used for distributed rendering)");
+
+        ImageBlock &block = context.getBlock();
+        SampleBuffer &samples = context.getSampleBuffer();
+        Point2i offset = block.getOffset();
+        Vector2i size = block.getSize();
+
+        for (int y = 0; y < size.y(); ++y) {
+            for (int x = 0; x < size.x(); ++x) {
+                Point2i pixel(x + offset.x(), y + offset.y());
+                const Pixel &p = m_pixels[(size_t) pixel.y() * m_size.x() + pixel.x()];
+                samples.put(block, Point2f(pixel.x() + 0.5f, pixel.y() + 0.5f), p.value, 1.0f);
+            }
+        }
+        samples.flush(block);
+        return true;
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
+        /* Not used: all pixels are computed by preparePass() */
+        return Color3f(0.0f);
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "SPPMIntegrator[\n"
+            "  photonCount = %i,\n"
+            "  initialRadius = %f,\n"
+            "  alpha = %f\n"
+            "]",
+            m_photonCount,
+            m_initialRadius,
+            m_alpha
+        );
+    }
+
+private:
+    /// Diffuse surface seen through a pixel
+    struct VisiblePoint {
+        Point3f p;
+        /// Direction towards the camera (in the local frame)
+        Vector3f wi;
+        Frame frame;
+        /// Surface BSDF, or \c nullptr if the camera ray was lost
+        const BSDF *bsdf;
+        /// Throughput of the camera path
+        Color3f beta;
+    };
+
+    /// Per-pixel state, which persists across passes
+    struct Pixel {
+        VisiblePoint vp;
+        /// Current gathering radius
+        float radius;
+        /// Accumulated (fractional) number of photons
+        float N;
+        /// Direct illumination of the current pass
+        Color3f Ld;
+        /// Flux deposited at the visible point in the current pass
+        std::atomic<float> phi[3];
+        /// Number of photons deposited in the current pass
+        std::atomic<int> M;
+        /// Estimate of the current pass (what is written to the film)
+        Color3f value;
+    };
+
+    /// Allocate and initialize the per-pixel state
+    void reset(const Scene *scene, const Vector2i &size) {
+        m_size = size;
+        m_pixels.reset(new Pixel[(size_t) size.x() * size.y()]);
+
+        float radius = m_initialRadius;
+        if (radius <= 0.0f)
+            radius = scene->getBoundingBox().getExtents().norm() / 200.0f;
+        for (size_t i = 0; i < (size_t) size.x() * size.y(); ++i) {
+            Pixel &pixel = m_pixels[i];
+            pixel.vp.bsdf = nullptr;
+            pixel.radius = radius;
+            pixel.N = 0.0f;
+            for (int c = 0; c < 3; ++c)
+                pixel.phi[c] = 0.0f;
+            pixel.M = 0;
+        }
+    }
+
+    /// Stage 1: trace a camera ray for every pixel
+    void generateVisiblePoints(const Scene *scene, uint32_t pass) {
+        tbb::enumerable_thread_specific<std::unique_ptr<Sampler>> samplers([&] {
+            std::unique_ptr<Sampler> sampler = scene->getSampler()->clone();
+            sampler->prepare(ImageBlock(Vector2i(1, 1), nullptr), pass);
+            return sampler;
+        });
+
+        tbb::parallel_for(tbb::blocked_range<int>(0, m_size.y()), [&](const tbb::blocked_range<int> &range) {
+            Sampler *sampler = samplers.local().get();
+            for (int y = range.begin(); y != range.end(); ++y) {
+                for (int x = 0; x < m_size.x(); ++x) {
+                    Pixel &pixel = m_pixels[(size_t) y * m_size.x() + x];
+                    VisiblePoint &vp = pixel.vp;
+                    vp.bsdf = nullptr;
+                    pixel.Ld = Color3f(0.0f);
+
+                    Point2i position(x, y);
+                    sampler->startSample(position, 0);
+                    Ray3f ray;
+                    Point2f filmPosition;
+                    float filterWeight;
+                    Color3f beta = sampleCameraRay(scene, sampler, position, ray, filmPosition, filterWeight);
+
+                    /* Follow specular surfaces, gathering emission seen on the way */
+                    Intersection its;
+                    if (!traceToDiffuse(scene, sampler, ray, its, beta, pixel.Ld))
+                        continue;
+
+                    const BSDF *bsdf = its.mesh->getBSDF();
+                    Vector3f wi = its.toLocal(-ray.d);
+                    vp.p = its.p;
+                    vp.wi = wi;
+                    vp.frame = its.shFrame;
+                    vp.bsdf = bsdf;
+                    vp.beta = beta;
+                    pixel.Ld += beta * sampleDirectLight(scene, sampler, its, bsdf, wi);
+                }
+            }
+        });
+    }
+
+    /// Return the hash grid bucket of a grid cell
+    size_t bucket(int x, int y, int z) const {
+        uint32_t h = ((uint32_t) x * 73856093u) ^ ((uint32_t) y * 19349663u) ^ ((uint32_t) z * 83492791u);
+        return h % (m_cellStart.size() - 1);
+    }
+
+    /// Return the grid cell containing a position
+    Vector3i cell(const Point3f &p) const {
+        Vector3f rel = (p - m_gridBounds.min) / m_cellSize;
+        return Vector3i(clamp((int) rel.x(), 0, m_gridRes.x() - 1),
+                        clamp((int) rel.y(), 0, m_gridRes.y() - 1),
+                        clamp((int) rel.z(), 0, m_gridRes.z() - 1));
+    }
+
+    /// Collect the (distinct) buckets of all cells overlapped by a visible point
+    int buckets(const Pixel &pixel, size_t *result) const {
+        Vector3f r = Vector3f::Constant(pixel.radius);
+        Vector3i lo = cell(pixel.vp.p - r), hi = cell(pixel.vp.p + r);
+        int count = 0;
+        for (int z = lo.z(); z <= hi.z(); ++z) {
+            for (int y = lo.y(); y <= hi.y(); ++y) {
+                for (int x = lo.x(); x <= hi.x(); ++x) {
+                    size_t b = bucket(x, y, z);
+                    if (count < NORI_SPPM_MAX_BUCKETS &&
+                        std::find(result, result + count, b) == result + count)
+                        result[count++] = b;
+                }
+            }
+        }
+        return count;
+    }
+
+    /// Stage 2a: insert the visible points into the hash grid
+    void buildGrid() {
+        size_t pixelCount = (size_t) m_size.x() * m_size.y();
+
+        /* Bounds of all visible points, cells slightly larger than twice
+           any radius (so that each point usually overlaps at most 8 cells,
+           rounding can add a third one per axis) */
+        m_gridBounds.reset();
+        float maxRadius = 0.0f;
+        for (size_t i = 0; i < pixelCount; ++i) {
+            const Pixel &pixel = m_pixels[i];
+            if (!pixel.vp.bsdf)
+                continue;
+            m_gridBounds.expandBy(pixel.vp.p);
+            maxRadius = std::max(maxRadius, pixel.radius);
+        }
+        m_cellStart.assign(pixelCount + 1, 0);
+        m_cellEntries.clear();
+        if (!m_gridBounds.isValid())
+            return;
+        m_gridBounds.min -= Vector3f::Constant(maxRadius);
+        m_gridBounds.max += Vector3f::Constant(maxRadius);
+        m_cellSize = 2.0f * maxRadius * (1.0f + 1e-4f);
+        Vector3f extents = m_gridBounds.getExtents();
+        for (int i = 0; i < 3; ++i)
+            m_gridRes[i] = std::max(1, std::min((int) std::ceil(extents[i] / m_cellSize), 1 << 20));
+
+        /* Count the entries per bucket, then fill them in (both in parallel) */
+        std::unique_ptr<std::atomic<uint32_t>[]> counts(new std::atomic<uint32_t>[pixelCount + 1]);
+        for (size_t i = 0; i <= pixelCount; ++i)
+            counts[i] = 0;
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, pixelCount), [&](const tbb::blocked_range<size_t> &range) {
+            size_t result[NORI_SPPM_MAX_BUCKETS];
+            for (size_t i = range.begin(); i != range.end(); ++i) {
+                if (!m_pixels[i].vp.bsdf)
+                    continue;
+                int n = buckets(m_pixels[i], result);
+                for (int k = 0; k < n; ++k)
+                    counts[result[k]]++;
+            }
+        });
+
+        for (size_t i = 0; i < pixelCount; ++i) {
+            m_cellStart[i + 1] = m_cellStart[i] + counts[i];
+            counts[i] = m_cellStart[i];
+        }
+        m_cellEntries.resize(m_cellStart[pixelCount]);
+
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, pixelCount), [&](const tbb::blocked_range<size_t> &range) {
+            size_t result[NORI_SPPM_MAX_BUCKETS];
+            for (size_t i = range.begin(); i != range.end(); ++i) {
+                if (!m_pixels[i].vp.bsdf)
+                    continue;
+                int n = buckets(m_pixels[i], result);
+                for (int k = 0; k < n; ++k)
+                    m_cellEntries[counts[result[k]]++] = (uint32_t) i;
+            }
+        });
+    }
+
+    /// Stage 2b: trace photons and deposit their flux at the visible points
+    void tracePhotons(const Scene *scene, uint32_t pass) {
+        if (m_cellEntries.empty())
+            return;
+
+        uint64_t chunks = ((uint64_t) m_photonCount + NORI_SPPM_CHUNK_SIZE - 1) / NORI_SPPM_CHUNK_SIZE;
+        tbb::parallel_for(tbb::blocked_range<uint64_t>(0, chunks), [&](const tbb::blocked_range<uint64_t> &range) {
+            for (uint64_t chunk = range.begin(); chunk != range.end(); ++chunk) {
+                /* Every chunk of every pass has its own random number stream */
+                pcg32 random(chunk, pass);
+                uint64_t count = std::min((uint64_t) NORI_SPPM_CHUNK_SIZE,
+                                          (uint64_t) m_photonCount - chunk * NORI_SPPM_CHUNK_SIZE);
+                for (uint64_t i = 0; i < count; ++i) {
+                    tracePhoton(scene, random, [&](const Intersection &its, const Vector3f &wi,
+                                                   const Color3f &power, int depth) {
+                        /* Direct illumination is computed at the visible points */
+                        if (depth > 0)
+                            deposit(its.p, wi, power);
+                    });
+                }
+            }
+        });
+    }
+
+    /// Deposit the flux of a photon at all visible points within their radius of \c p
+    void deposit(const Point3f &p, const Vector3f &wi, const Color3f &power) {
+        if (!m_gridBounds.contains(p))
+            return;
+        Vector3i c = cell(p);
+        size_t b = bucket(c.x(), c.y(), c.z());
+        for (uint32_t k = m_cellStart[b]; k < m_cellStart[b + 1]; ++k) {
+            Pixel &pixel = m_pixels[m_cellEntries[k]];
+            const VisiblePoint &vp = pixel.vp;
+            if ((vp.p - p).squaredNorm() > pixel.radius * pixel.radius)
+                continue;
+            BSDFQueryRecord bRec(vp.wi, vp.frame.toLocal(wi), ESolidAngle);
+            Color3f phi = vp.bsdf->eval(bRec) * power;
+            for (int i = 0; i < 3; ++i)
+                atomicAdd(pixel.phi[i], phi[i]);
+            pixel.M++;
+        }
+    }
+
+    /// Stage 3: compute the estimates of this pass and shrink the radii
+    void updatePixels() {
+        size_t pixelCount = (size_t) m_size.x() * m_size.y();
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, pixelCount), [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t i = range.begin(); i != range.end(); ++i) {
+                Pixel &pixel = m_pixels[i];
+                Color3f phi(pixel.phi[0], pixel.phi[1], pixel.phi[2]);
+                int M = pixel.M;
+
+                pixel.value = pixel.Ld;
+                if (M > 0) {
+                    pixel.value += pixel.vp.beta * phi
+                        / ((float) m_photonCount * M_PI * pixel.radius * pixel.radius);
+
+                    /* Keep the fraction alpha of the new photons */
+                    float N = pixel.N + m_alpha * M;
+                    pixel.radius *= std::sqrt(N / (pixel.N + M));
+                    pixel.N = N;
+                }
+
+                for (int c = 0; c < 3; ++c)
+                    pixel.phi[c] = 0.0f;
+                pixel.M = 0;
+            }
+        });
+    }
+
+    int m_photonCount;
+    float m_initialRadius;
+    float m_alpha;
+
+    /* Per-pixel state */
+    Vector2i m_size = Vector2i(0, 0);
+    std::unique_ptr<Pixel[]> m_pixels;
+
+    /* Hash grid over the visible points */
+    BoundingBox3f m_gridBounds;
+    float m_cellSize = 0.0f;
+    Vector3i m_gridRes;
+    std::vector<uint32_t> m_cellStart;
+    std::vector<uint32_t> m_cellEntries;
+};
+
+NORI_REGISTER_CLASS(SPPMIntegrator, "sppm");
+NORI_NAMESPACE_END
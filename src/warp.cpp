@@ -20,6 +20,7 @@
 #include <nori/vector.h>
 #include <nori/frame.h>
 #include <math.h> 
+#include <Eigen/Geometry>
 
 NORI_NAMESPACE_BEGIN
 
@@ -126,4 +127,67 @@ float Warp::squareToBeckmannPdf(const Vector3f& m, float alpha) {
     else return 0.0f;
 }
 
+/* Angle between two unit vectors, accurate also for (nearly) parallel vectors */
+static float angleBetween(const Vector3f &v1, const Vector3f &v2) {
+    if (v1.dot(v2) < 0.0f)
+        return M_PI - 2.0f * std::asin(std::min(0.5f * (v1 + v2).norm(), 1.0f));
+    return 2.0f * std::asin(std::min(0.5f * (v2 - v1).norm(), 1.0f));
+}
+
+/* Component of 'v' orthogonal to the unit vector 'w', normalized */
+static Vector3f orthogonalize(const Vector3f &v, const Vector3f &w) {
+    Vector3f result = v - v.dot(w) * w;
+    float length = result.norm();
+    return length > 0.0f ? Vector3f(result / length) : Vector3f(0.0f, 0.0f, 0.0f);
+}
+
+Vector3f Warp::squareToSphericalTriangle(const Point2f &sample, const Vector3f &a,
+                                         const Vector3f &b, const Vector3f &c) {
+    /* Normals of the great circles through the edges */
+    Vector3f nab = a.cross(b), nbc = b.cross(c), nca = c.cross(a);
+    if (nab.squaredNorm() == 0.0f || nbc.squaredNorm() == 0.0f || nca.squaredNorm() == 0.0f)
+        return a;
+    nab.normalize(); nbc.normalize(); nca.normalize();
+
+    /* Interior angles of the triangle */
+    float alpha = angleBetween(nab, -nca);
+    float beta = angleBetween(nbc, -nab);
+    float gamma = angleBetween(nca, -nbc);
+
+    /* Choose the area of the sub-triangle (a, b, c') uniformly and find
+       the corresponding position of c' on the edge from a to c */
+    float areaPi = (1.0f - sample.x()) * (float) M_PI + sample.x() * (alpha + beta + gamma);
+    float cosAlpha = std::cos(alpha), sinAlpha = std::sin(alpha);
+    float sinPhi = std::sin(areaPi) * cosAlpha - std::cos(areaPi) * sinAlpha;
+    float cosPhi = std::cos(areaPi) * cosAlpha + std::sin(areaPi) * sinAlpha;
+    float k1 = cosPhi + cosAlpha;
+    float k2 = sinPhi - sinAlpha * a.dot(b);
+    float denom = (k2 * sinPhi + k1 * cosPhi) * sinAlpha;
+    float cosB = denom != 0.0f ? (k2 + (k2 * cosPhi - k1 * sinPhi) * cosAlpha) / denom : 1.0f;
+    cosB = clamp(cosB, -1.0f, 1.0f);
+    float sinB = std::sqrt(std::max(0.0f, 1.0f - cosB * cosB));
+    Vector3f cp = cosB * a + sinB * orthogonalize(c, a);
+
+    /* Sample a direction on the arc from b to c' */
+    float cosTheta = 1.0f - sample.y() * (1.0f - cp.dot(b));
+    float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    return (cosTheta * b + sinTheta * orthogonalize(cp, b)).normalized();
+}
+
+float Warp::squareToSphericalTrianglePdf(const Vector3f &v, const Vector3f &a,
+                                         const Vector3f &b, const Vector3f &c) {
+    /* The direction must lie on the inner side of all three great circles */
+    float orientation = a.dot(b.cross(c)) < 0.0f ? -1.0f : 1.0f;
+    if (orientation * v.dot(a.cross(b)) < 0.0f || orientation * v.dot(b.cross(c)) < 0.0f ||
+        orientation * v.dot(c.cross(a)) < 0.0f)
+        return 0.0f;
+    float area = sphericalTriangleArea(a, b, c);
+    return area > 0.0f ? 1.0f / area : 0.0f;
+}
+
+float Warp::sphericalTriangleArea(const Vector3f &a, const Vector3f &b, const Vector3f &c) {
+    /* Van Oosterom and Strackee's formula */
+    return std::abs(2.0f * std::atan2(a.dot(b.cross(c)), 1.0f + a.dot(b) + b.dot(c) + c.dot(a)));
+}
+
 NORI_NAMESPACE_END
@@ -74,11 +74,12 @@ enum WarpType : int {
     CosineHemisphere,
     Beckmann,
     MicrofacetBRDF,
+    SphericalTriangle,
     WarpTypeCount
 };
 static const std::string kWarpTypeNames[WarpTypeCount] = {
     "square", "tent", "disk", "uniform_sphere", "uniform_hemisphere",
-    "cosine_hemisphere", "beckmann", "microfacet_brdf"
+    "cosine_hemisphere", "beckmann", "microfacet_brdf", "spherical_triangle"
 };
 
 struct WarpTest {
@@ -173,6 +174,9 @@ struct WarpTest {
                     br.wo = v;
                     br.measure = nori::ESolidAngle;
                     return bsdf->pdf(br);
+                } else if (warpType == SphericalTriangle) {
+                    return Warp::squareToSphericalTrianglePdf(v, triangleVertex(0),
+                        triangleVertex(1), triangleVertex(2));
                 } else {
                     throw NoriException("Invalid warp type");
                 }
@@ -187,6 +191,10 @@ struct WarpTest {
         else
             scale *= 4*M_PI;
 
+        /* The edges of the spherical triangle cross the cells at arbitrary
+           angles and need a tighter tolerance to be integrated accurately */
+        double eps = warpType == SphericalTriangle ? 1e-8 : 1e-6;
+
         double *ptr = expFrequencies.get();
         for (int y=0; y<yres; ++y) {
             double yStart =  y    / (double) yres;
@@ -195,7 +203,7 @@ struct WarpTest {
                 double xStart =  x    / (double) xres;
                 double xEnd   = (x+1) / (double) xres;
                 ptr[y * xres + x] = hypothesis::adaptiveSimpson2D(
-                    integrand, yStart, xStart, yEnd, xEnd) * scale;
+                    integrand, yStart, xStart, yEnd, xEnd, eps) * scale;
                 if (ptr[y * xres + x] < 0)
                     throw NoriException("The Pdf() function returned negative values!");
             }
@@ -214,6 +222,16 @@ struct WarpTest {
     }
 
 
+    /// Corners of the fixed spherical triangle used by the \c SphericalTriangle warp
+    static Vector3f triangleVertex(int i) {
+        static const Vector3f vertices[3] = {
+            Vector3f(1.0f, 0.2f, 0.5f).normalized(),
+            Vector3f(-0.3f, 1.0f, 0.6f).normalized(),
+            Vector3f(0.2f, -0.4f, -0.8f).normalized()
+        };
+        return vertices[i];
+    }
+
     std::pair<Point3f, float> warpPoint(const Point2f &sample) {
         Point3f result;
 
@@ -240,6 +258,9 @@ struct WarpTest {
                     value == 0 ? 0.f : bsdf->eval(br)[0]
                 );
              }
+            case SphericalTriangle:
+                result << Warp::squareToSphericalTriangle(sample, triangleVertex(0),
+                    triangleVertex(1), triangleVertex(2)); break;
              default:
                 throw std::runtime_error("Unsupported warp type.");
         }
@@ -631,7 +652,8 @@ public:
 
         new Label(m_window, "Warping method", "sans-bold");
         m_warpTypeBox = new ComboBox(m_window, { "Square", "Tent", "Disk", "Sphere", "Hemisphere (unif.)",
-                "Hemisphere (cos)", "Beckmann distr.", "Microfacet BRDF" });
+                "Hemisphere (cos)", "Beckmann distr.", "Microfacet BRDF",
+                "Spherical triangle" });
         m_warpTypeBox->setCallback([&](int) { refresh(); });
 
         panel = new Widget(m_window);
@@ -0,0 +1,393 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/wavefront.h>
+#include <nori/bsdf.h>
+#include <nori/camera.h>
+#include <nori/emitter.h>
+#include <nori/rfilter.h>
+#include <nori/scene.h>
+#include <nori/timer.h>
+#include <Eigen/Geometry>
+
+NORI_NAMESPACE_BEGIN
+
+/// Number of paths that are traced at once (per thread)
+#define NORI_WAVEFRONT_BATCH_SIZE (64 * 1024)
+
+/// Number of bits per axis used to quantize ray origins for reordering
+#define NORI_WAVEFRONT_CELL_BITS 5
+
+/// Spread the lower 10 bits of \c x so that there are two zero bits between each
+static uint32_t expandBits(uint32_t x) {
+    x &= 0x3FF;
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x <<  8)) & 0x0300F00F;
+    x = (x | (x <<  4)) & 0x030C30C3;
+    x = (x | (x <<  2)) & 0x09249249;
+    return x;
+}
+
+void RayQueue::reserve(size_t capacity) {
+    for (std::vector<float> *v : { &ox, &oy, &oz, &dx, &dy, &dz, &maxt, &r, &g, &b,
+                                   &nx, &ny, &nz, &pdf, &eta })
+        v->resize(capacity);
+    sample.resize(capacity);
+    specular.resize(capacity);
+}
+
+size_t RayQueue::push(const Ray3f &ray, const Color3f &value, uint32_t sampleIndex, bool isSpecular) {
+    size_t i = size++;
+    ox[i] = ray.o.x(); oy[i] = ray.o.y(); oz[i] = ray.o.z();
+    dx[i] = ray.d.x(); dy[i] = ray.d.y(); dz[i] = ray.d.z();
+    maxt[i] = ray.maxt;
+    setValue(i, value);
+    sample[i] = sampleIndex;
+    specular[i] = isSpecular ? 1 : 0;
+    return i;
+}
+
+void RayQueue::gather(const RayQueue &source, const uint32_t *order, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        size_t j = order[i];
+        ox[i] = source.ox[j]; oy[i] = source.oy[j]; oz[i] = source.oz[j];
+        dx[i] = source.dx[j]; dy[i] = source.dy[j]; dz[i] = source.dz[j];
+        maxt[i] = source.maxt[j];
+        r[i] = source.r[j]; g[i] = source.g[j]; b[i] = source.b[j];
+        nx[i] = source.nx[j]; ny[i] = source.ny[j]; nz[i] = source.nz[j];
+        pdf[i] = source.pdf[j];
+        eta[i] = source.eta[j];
+        sample[i] = source.sample[j];
+        specular[i] = source.specular[j];
+    }
+    size = count;
+}
+
+WavefrontRenderer::WavefrontRenderer(const Scene *scene, bool reorder)
+    : m_strategy(scene->getIntegrator()->getWavefrontStrategy()), m_reorder(reorder) {
+    if (m_strategy == EWavefrontUnsupported)
+        throw NoriException("The integrator %s does not support wavefront rendering",
+                            scene->getIntegrator()->toString());
+
+    /* Never trace more paths at once than a block can produce */
+    m_batchSize = std::min((size_t) NORI_WAVEFRONT_BATCH_SIZE,
+        (size_t) NORI_BLOCK_SIZE * NORI_BLOCK_SIZE * scene->getSampler()->getSampleCount());
+
+    m_positions.resize(m_batchSize);
+    m_weights.resize(m_batchSize);
+    m_radiance.resize(m_batchSize);
+    m_random.resize(m_batchSize);
+    m_paths.reserve(m_batchSize);
+    m_nextPaths.reserve(m_batchSize);
+    m_shadowRays.reserve(m_batchSize);
+    m_hits.resize(m_batchSize);
+    m_hit.resize(m_batchSize);
+    m_order.resize(m_batchSize);
+
+    if (m_reorder) {
+        m_sceneBounds = scene->getBoundingBox();
+        m_sortKeys.resize(m_batchSize);
+        m_sortKeysTemp.resize(m_batchSize);
+        m_sortOrder.resize(m_batchSize);
+        m_sortOrderTemp.resize(m_batchSize);
+        m_sortedRays.reserve(m_batchSize);
+    }
+
+    for (const Mesh *mesh : scene->getMeshes()) {
+        /* Assign consecutive indices to all distinct materials */
+        if (m_materialIndex.find(mesh->getBSDF()) == m_materialIndex.end()) {
+            uint32_t index = (uint32_t) m_materialIndex.size();
+            m_materialIndex[mesh->getBSDF()] = index;
+        }
+    }
+    m_materialCount.resize(m_materialIndex.size() + 1);
+}
+
+void WavefrontRenderer::renderBlock(const Scene *scene, RenderContext &context) {
+    ImageBlock &block = context.getBlock();
+    Timer timer;
+    Sampler *sampler = context.getSampler();
+    SampleBuffer &samples = context.getSampleBuffer();
+
+    Point2i offset = block.getOffset();
+    Vector2i size  = block.getSize();
+    uint32_t sampleCount = (uint32_t) sampler->getSampleCount();
+    uint64_t totalSamples = (uint64_t) size.x() * size.y() * sampleCount;
+
+    /* Clear the block contents */
+    block.clear();
+
+    for (uint64_t start = 0; start < totalSamples; start += m_batchSize) {
+        uint64_t end = std::min(start + (uint64_t) m_batchSize, totalSamples);
+
+        generateCameraRays(scene, sampler, offset, size, sampleCount, start, end);
+
+        /* Advance all paths one bounce at a time until they have terminated.
+           Camera rays are coherent already and never need to be reordered. */
+        for (int depth = 0; m_paths.size > 0; ++depth) {
+            if (m_reorder && depth > 0)
+                reorder(m_paths);
+            intersectPaths(scene);
+            accumulateEmission(scene);
+            if (m_strategy == EWavefrontEmitterSampling) {
+                sampleEmitters(scene);
+                if (m_reorder)
+                    reorder(m_shadowRays);
+                traceShadowRays(scene);
+            }
+            sampleBSDFs();
+        }
+
+        /* Splat the samples of this batch */
+        for (uint64_t i = 0; i < end - start; ++i)
+            samples.put(block, m_positions[i], m_radiance[i], m_weights[i]);
+        samples.flush(block);
+    }
+
+    RenderStatistics &stats = context.getStatistics();
+    stats.blocks++;
+    stats.samples += totalSamples;
+    stats.renderTime += timer.elapsed() * 1e-3;
+}
+
+void WavefrontRenderer::generateCameraRays(const Scene *scene, Sampler *sampler,
+        const Point2i &offset, const Vector2i &size, uint32_t sampleCount,
+        uint64_t start, uint64_t end) {
+    const Camera *camera = scene->getCamera();
+    const ReconstructionFilter *filter = camera->getReconstructionFilter();
+    bool sampleFilter = filter->isImportanceSampled();
+
+    m_paths.clear();
+    for (uint64_t index = start; index < end; ++index) {
+        uint32_t i = (uint32_t) (index - start);
+        uint64_t pixel = index / sampleCount;
+        int x = (int) (pixel % size.x()), y = (int) (pixel / size.x());
+
+        /* Every path gets its own random number stream, which is seeded
+           by the sampler for this pixel sample */
+        pcg32 &random = m_random[i];
+        sampler->seedStream(random, Point2i(x + offset.x(), y + offset.y()),
+                            (uint32_t) (index % sampleCount), 1);
+
+        Point2f pixelCenter((float) (x + offset.x()) + 0.5f, (float) (y + offset.y()) + 0.5f);
+        Point2f pixelSample, filterOffset;
+        float weight = 1.0f;
+        if (sampleFilter) {
+            weight = filter->sample(Point2f(random.nextFloat(), random.nextFloat()), filterOffset);
+            pixelSample = pixelCenter + filterOffset;
+        } else {
+            pixelSample = Point2f((float) (x + offset.x()) + random.nextFloat(),
+                                  (float) (y + offset.y()) + random.nextFloat());
+        }
+        Point2f apertureSample(random.nextFloat(), random.nextFloat());
+
+        /* Importance sampled filters record the sample in the current pixel only */
+        m_positions[i] = sampleFilter ? pixelCenter : pixelSample;
+        m_weights[i] = weight;
+        m_radiance[i] = Color3f(0.0f);
+
+        Ray3f ray;
+        Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+        if (!value.isZero())
+            m_paths.setVertex(m_paths.push(ray, value, i, true), Normal3f(0.0f), 0.0f, 1.0f);
+    }
+}
+
+void WavefrontRenderer::intersectPaths(const Scene *scene) {
+    for (size_t i = 0; i < m_paths.size; ++i)
+        m_hit[i] = scene->rayIntersect(m_paths.getRay(i), m_hits[i]) ? 1 : 0;
+}
+
+void WavefrontRenderer::accumulateEmission(const Scene *scene) {
+    const LightBVH &lights = scene->getLightBVH();
+
+    for (size_t i = 0; i < m_paths.size; ++i) {
+        if (!m_hit[i])
+            continue;
+        const Intersection &its = m_hits[i];
+        const Emitter *emitter = its.mesh->getEmitter();
+        if (!emitter)
+            continue;
+
+        if (m_strategy == EWavefrontMaterialSampling) {
+            m_radiance[m_paths.sample[i]] += m_paths.getValue(i) * emitter->getEmission();
+            continue;
+        }
+
+        Vector3f d(m_paths.dx[i], m_paths.dy[i], m_paths.dz[i]);
+        EmitQueryRecord eRec;
+        eRec.m_p = its.p;
+        eRec.m_np = its.shFrame.n;
+        eRec.m_wo = -d;
+        eRec.m_emitter = emitter;
+        eRec.m_triangle = its.triangle;
+        Color3f Le = m_paths.getValue(i) * emitter->eval(eRec);
+
+        /* Emission found after a discrete bounce (or by a camera ray) has full
+           weight, otherwise it is weighted against next event estimation */
+        if (!m_paths.specular[i] && !Le.isZero()) {
+            float cosLight = std::abs(its.shFrame.n.dot(d));
+            Point3f origin(m_paths.ox[i], m_paths.oy[i], m_paths.oz[i]);
+            float lightPdf = lights.pdf(origin, m_paths.getNormal(i), eRec)
+                * its.t * its.t / cosLight;
+            Le *= powerHeuristic(m_paths.pdf[i], lightPdf);
+        }
+        m_radiance[m_paths.sample[i]] += Le;
+    }
+}
+
+void WavefrontRenderer::sampleEmitters(const Scene *scene) {
+    const LightBVH &lights = scene->getLightBVH();
+    m_shadowRays.clear();
+
+    for (size_t i = 0; i < m_paths.size; ++i) {
+        if (!m_hit[i])
+            continue;
+        const Intersection &its = m_hits[i];
+        const BSDF *bsdf = its.mesh->getBSDF();
+        if (!bsdf->isDiffuse())
+            continue;
+        pcg32 &random = m_random[m_paths.sample[i]];
+
+        /* Sample a position on an emitter from the light hierarchy */
+        EmitQueryRecord lRec;
+        float u1 = random.nextFloat(), u2 = random.nextFloat();
+        if (!lights.sample(its.p, its.shFrame.n, lRec, Point2f(u1, u2)))
+            continue;
+
+        Vector3f d = lRec.m_p - its.p;
+        float dist2 = d.squaredNorm(), dist = std::sqrt(dist2);
+        d /= dist;
+        lRec.m_wo = -d;
+        float cosLight = lRec.m_np.dot(-d);
+        if (cosLight <= 0.0f)
+            continue;
+
+        /* Weight against BSDF sampling, using densities with respect to solid angle */
+        BSDFQueryRecord bRec(its.toLocal(-Vector3f(m_paths.dx[i], m_paths.dy[i], m_paths.dz[i])),
+                             its.toLocal(d), ESolidAngle);
+        float lightPdf = lRec.m_probDensity * dist2 / cosLight;
+        float weight = powerHeuristic(lightPdf, bsdf->pdf(bRec));
+        Color3f value = m_paths.getValue(i) * bsdf->eval(bRec) * lRec.m_emitter->eval(lRec)
+                      * std::abs(Frame::cosTheta(bRec.wo)) * (weight / lightPdf);
+        if (value.isZero())
+            continue;
+
+        m_shadowRays.push(Ray3f(its.p, d, Epsilon, dist * (1.0f - Epsilon)),
+                          value, m_paths.sample[i], false);
+    }
+}
+
+void WavefrontRenderer::traceShadowRays(const Scene *scene) {
+    for (size_t i = 0; i < m_shadowRays.size; ++i) {
+        if (!scene->rayIntersect(m_shadowRays.getRay(i)))
+            m_radiance[m_shadowRays.sample[i]] += m_shadowRays.getValue(i);
+    }
+}
+
+void WavefrontRenderer::sampleBSDFs() {
+    /* Counting sort of the surviving paths by material */
+    uint32_t materials = (uint32_t) m_materialIndex.size();
+    std::fill(m_materialCount.begin(), m_materialCount.end(), 0);
+    for (size_t i = 0; i < m_paths.size; ++i) {
+        if (m_hit[i])
+            m_materialCount[m_materialIndex[m_hits[i].mesh->getBSDF()] + 1]++;
+    }
+    for (uint32_t i = 0; i < materials; ++i)
+        m_materialCount[i + 1] += m_materialCount[i];
+    size_t count = m_materialCount[materials];
+    for (size_t i = 0; i < m_paths.size; ++i) {
+        if (m_hit[i])
+            m_order[m_materialCount[m_materialIndex[m_hits[i].mesh->getBSDF()]]++] = (uint32_t) i;
+    }
+
+    m_nextPaths.clear();
+    for (size_t k = 0; k < count; ++k) {
+        size_t i = m_order[k];
+        const Intersection &its = m_hits[i];
+        pcg32 &random = m_random[m_paths.sample[i]];
+        Color3f throughput = m_paths.getValue(i);
+        float eta = m_paths.eta[i];
+
+        /* Russian roulette */
+        float prob = std::min(throughput.maxCoeff() * eta * eta, 0.99f);
+        if (random.nextFloat() > prob)
+            continue;
+        throughput /= prob;
+
+        /* Sample the BSDF for the next direction */
+        BSDFQueryRecord bRec(its.toLocal(-m_paths.getRay(i).d));
+        Point2f sample(random.nextFloat(), random.nextFloat());
+        const BSDF *bsdf = its.mesh->getBSDF();
+        throughput *= bsdf->sample(bRec, sample);
+        if (throughput.isZero())
+            continue;
+
+        /* Emitter sampling only handles diffuse surfaces; emission found
+           by the other paths must be accounted for by the next bounce */
+        bool specular = !bsdf->isDiffuse();
+        size_t j = m_nextPaths.push(Ray3f(its.p, its.toWorld(bRec.wo)), throughput,
+                                    m_paths.sample[i], specular);
+        m_nextPaths.setVertex(j, its.shFrame.n, specular ? 0.0f : bsdf->pdf(bRec),
+                              eta * bRec.eta);
+    }
+    std::swap(m_paths, m_nextPaths);
+}
+
+void WavefrontRenderer::reorder(RayQueue &queue) {
+    const uint32_t cellCount = 1u << NORI_WAVEFRONT_CELL_BITS;
+    const uint32_t radixBits = (3 * NORI_WAVEFRONT_CELL_BITS + 3 + 1) / 2;
+    const uint32_t radixSize = 1u << radixBits;
+    Vector3f scale = Vector3f(m_sceneBounds.getExtents()).cwiseMax(Epsilon).cwiseInverse() * (float) cellCount;
+
+    /* Sort key: direction octant followed by the Morton code of the origin cell */
+    for (size_t i = 0; i < queue.size; ++i) {
+        Vector3f o(queue.ox[i], queue.oy[i], queue.oz[i]);
+        Vector3f cell = (o - m_sceneBounds.min).cwiseProduct(scale);
+        uint32_t code = 0;
+        for (int j = 0; j < 3; ++j) {
+            uint32_t c = (uint32_t) std::min(std::max(cell[j], 0.0f), (float) (cellCount - 1));
+            code |= expandBits(c) << j;
+        }
+        uint32_t octant = (queue.dx[i] < 0 ? 1 : 0) | (queue.dy[i] < 0 ? 2 : 0) | (queue.dz[i] < 0 ? 4 : 0);
+        m_sortKeys[i] = octant << (3 * NORI_WAVEFRONT_CELL_BITS) | code;
+        m_sortOrder[i] = (uint32_t) i;
+    }
+
+    /* Two passes of a stable LSD radix sort */
+    uint32_t counts[radixSize + 1];
+    for (uint32_t shift = 0; shift < 2 * radixBits; shift += radixBits) {
+        std::fill(counts, counts + radixSize + 1, 0);
+        for (size_t i = 0; i < queue.size; ++i)
+            counts[((m_sortKeys[i] >> shift) & (radixSize - 1)) + 1]++;
+        for (uint32_t i = 0; i < radixSize; ++i)
+            counts[i + 1] += counts[i];
+        for (size_t i = 0; i < queue.size; ++i) {
+            uint32_t pos = counts[(m_sortKeys[i] >> shift) & (radixSize - 1)]++;
+            m_sortKeysTemp[pos] = m_sortKeys[i];
+            m_sortOrderTemp[pos] = m_sortOrder[i];
+        }
+        std::swap(m_sortKeys, m_sortKeysTemp);
+        std::swap(m_sortOrder, m_sortOrderTemp);
+    }
+
+    m_sortedRays.gather(queue, m_sortOrder.data(), queue.size);
+    std::swap(queue, m_sortedRays);
+}
+
+NORI_NAMESPACE_END
@@ -32,29 +32,10 @@ public:
         if (its.mesh->getEmitter() != nullptr)
             og = em->getEmission();
 
-        std::vector<Mesh*> emitterMeshes = std::vector<Mesh*>(); // meshes that have emitters
-        DiscretePDF dpdf = DiscretePDF();
-        dpdf.clear();
-
-        for (Mesh* m : scene->getMeshes()) {
-            if (m->isEmitter()) {
-                dpdf.append(1.0f);
-                emitterMeshes.push_back(m);
-            }
-        }
-
-        dpdf.normalize();
-
-        if (emitterMeshes.size() > 0) {
-            //cout << "\t\tMany meshies!\n";
-            // pick a random emission mesh
-            float emitterPDF;
-            Mesh* eMesh = emitterMeshes.at(dpdf.sample(((float)rand())/RAND_MAX, emitterPDF)); // chooses a random emitter to sample from
-
-            // Now pick a random point on that emission mesh
-            Emitter* e = eMesh->getEmitter();
-            EmitQueryRecord eqr = EmitQueryRecord();
-            e->sample(eqr, Point2f(((float)rand()) / RAND_MAX, ((float)rand()) / RAND_MAX));
+        // Pick an emitter (by its estimated contribution to x) and a point on it
+        EmitQueryRecord eqr = EmitQueryRecord();
+        if (scene->getLightBVH().sample(x, its.shFrame.n, eqr, sampler->next2D())) {
+            const Emitter* e = eqr.m_emitter;
 
             Point3f p = eqr.m_p;
             Vector3f np = eqr.m_np;
@@ -80,7 +61,7 @@ public:
 
 
             float g = fmax(0.0f,-np.dot(distN)) * fabs(nn.dot(distN))
-                / (distVal * distVal) * intersectVal / emitterPDF / (1.0f/e->getDPDF().normalize());
+                / (distVal * distVal) * intersectVal / eqr.m_probDensity;
             
             // Getting the Le value
             Color3f emission = e->getEmission();
@@ -89,9 +70,9 @@ public:
 
             Color3f result = Lr + og;
 
-            if (((float)rand()) / RAND_MAX < 0.95) {
+            if (sampler->next1D() < 0.95) {
                 if (!bsdfVal->isDiffuse()) {
-                    Color3f c = bsdfVal->sample(query, Point2f(((float)rand()) / RAND_MAX, ((float)rand()) / RAND_MAX));
+                    Color3f c = bsdfVal->sample(query, sampler->next2D());
                     result += c  / 0.95f * Li(scene, sampler, Ray3f(its.p,its.shFrame.toWorld(query.wo)));
                 }
             }